@@ -48,8 +48,12 @@
 #define GTID_INTERVAL_SKIPLIST_MAXLEVEL 32 /* Should be enough for 2^64 elements */
 #define GTID_INTERVAL_SKIPLIST_P 0.25      /* Skiplist P = 1/4 */
 
-/* most gtid interval nodes are level 1 */
-#define GTID_INTERVAL_MEMORY (sizeof(gtidIntervalNode) + sizeof(gtidIntervalNode*))
+/* Allocated size of ptr (requested size if allocator can't tell) */
+#ifdef gtid_malloc_size
+#define gtidAllocSize(ptr,size) gtid_malloc_size(ptr)
+#else
+#define gtidAllocSize(ptr,size) (size)
+#endif
 
 static inline int gtidIntervalIsValid(gno_t start, gno_t end) {
     return start >= GTID_GNO_INITIAL && start <= end;
@@ -112,6 +116,11 @@ void gtidIntervalNodeFree(gtidIntervalNode* interval) {
     gtid_free(interval);
 }
 
+static inline size_t gtidIntervalNodeMemory(gtidIntervalNode *interval) {
+    return gtidAllocSize(interval, sizeof(gtidIntervalNode) +
+            interval->level*sizeof(gtidIntervalNode*));
+}
+
 gtidIntervalSkipList *gtidIntervalSkipListNew() {
     gtidIntervalSkipList *gsl = gtid_malloc(sizeof(*gsl));
     gsl->level = 1;
@@ -119,6 +128,8 @@ gtidIntervalSkipList *gtidIntervalSkipListNew() {
     gsl->tail = gsl->header;
     gsl->node_count = 1;
     gsl->gno_count = 0;
+    gsl->used_memory = gtidAllocSize(gsl,sizeof(*gsl)) +
+        gtidIntervalNodeMemory(gsl->header);
     return gsl;
 }
 
@@ -140,6 +151,8 @@ gtidIntervalSkipList *gtidIntervalSkipListDup(gtidIntervalSkipList *gsl) {
     dup->node_count = gsl->node_count;
     dup->gno_count = gsl->gno_count;
     dup->header = gtidIntervalNodeNew(GTID_INTERVAL_SKIPLIST_MAXLEVEL,0,0);
+    dup->used_memory = gtidAllocSize(dup,sizeof(*dup)) +
+        gtidIntervalNodeMemory(dup->header);
 
     for (int i = 0; i < GTID_INTERVAL_SKIPLIST_MAXLEVEL; i++)
         leads[i] = dup->header;
@@ -148,6 +161,7 @@ gtidIntervalSkipList *gtidIntervalSkipListDup(gtidIntervalSkipList *gsl) {
     cur = gsl->header->forwards[0];
     while (cur) {
         x = gtidIntervalNodeNew(cur->level,cur->start,cur->end);
+        dup->used_memory += gtidIntervalNodeMemory(x);
         for (int level = 0; level < x->level; level++) {
             leads[level]->forwards[level] = x;
             leads[level] = x;
@@ -221,6 +235,7 @@ gno_t gtidIntervalSkipListAdd(gtidIntervalSkipList *gsl, gno_t start, gno_t end)
        added = end-start+1;
        gsl->gno_count += added;
        gsl->node_count++;
+       gsl->used_memory += gtidIntervalNodeMemory(x);
 
        if (gsl->tail->forwards[0]) gsl->tail = gsl->tail->forwards[0];
     } else {
@@ -242,6 +257,7 @@ gno_t gtidIntervalSkipListAdd(gtidIntervalSkipList *gsl, gno_t start, gno_t end)
         while (l && l != r) {
             next = l->forwards[0];
             gsl->node_count--;
+            gsl->used_memory -= gtidIntervalNodeMemory(l);
             added -= gtidIntervalNodeGnoCount(l);
             gtidIntervalNodeFree(l);
             l = next;
@@ -310,6 +326,7 @@ gno_t gtidIntervalSkipListRemove(gtidIntervalSkipList *gsl, gno_t start,
         removed = end-start+1;
         gsl->gno_count -= removed;
         gsl->node_count++;
+        gsl->used_memory += gtidIntervalNodeMemory(x);
         if (gsl->tail->forwards[0]) gsl->tail = gsl->tail->forwards[0];
     } else {
         size_t saved_gno_count;
@@ -337,6 +354,7 @@ gno_t gtidIntervalSkipListRemove(gtidIntervalSkipList *gsl, gno_t start,
         while (l && l != r) {
             next = l->forwards[0];
             gsl->node_count--;
+            gsl->used_memory -= gtidIntervalNodeMemory(l);
             removed += gtidIntervalNodeGnoCount(l);
             gtidIntervalNodeFree(l);
             l = next;
@@ -362,6 +380,20 @@ gno_t gtidIntervalSkipListDiff(gtidIntervalSkipList *dst,
     return removed;
 }
 
+/* Count gnos in a but not in b, without touching either list. */
+gno_t gtidIntervalSkipListDiffCount(gtidIntervalSkipList *a,
+        gtidIntervalSkipList *b) {
+    gno_t overlap = 0;
+    gtidIntervalNode *x = a->header->forwards[0], *y = b->header->forwards[0];
+    while (x && y) {
+        gno_t start = MAX(x->start,y->start), end = MIN(x->end,y->end);
+        if (start <= end) overlap += end-start+1;
+        if (x->end < y->end) x = x->forwards[0];
+        else y = y->forwards[0];
+    }
+    return a->gno_count - overlap;
+}
+
 int gtidIntervalSkipListContains(gtidIntervalSkipList *gsl, gno_t gno) {
     int i;
     gtidIntervalNode *x = gsl->header;
@@ -572,6 +604,13 @@ gno_t uuidSetDiff(uuidSet* dst, uuidSet* src) {
     return gtidIntervalSkipListDiff(dst->intervals, src->intervals);
 }
 
+gno_t uuidSetDiffCount(uuidSet* uuid_set, uuidSet* other) {
+    if (uuid_set->uuid_len != other->uuid_len ||
+            memcmp(uuid_set->uuid, other->uuid, other->uuid_len))
+        return uuidSetCount(uuid_set);
+    return gtidIntervalSkipListDiffCount(uuid_set->intervals, other->intervals);
+}
+
 int uuidSetContains(uuidSet* uuid_set, gno_t gno) {
     if (!gtidIntervalIsValid(1, gno)) return 0;
     return gtidIntervalSkipListContains(uuid_set->intervals, gno);
@@ -603,8 +642,15 @@ int uuidSetIteratorSeek(uuidSetIterator* iterator, gno_t gno) {
     return iterator->next != NULL;
 }
 
+static unsigned long long gtid_set_version_clock = 0;
+
+void gtidSetTouch(gtidSet *gtid_set) {
+    gtid_set->version = ++gtid_set_version_clock;
+}
+
 gtidSet* gtidSetNew() {
     gtidSet *gtid_set = gtid_malloc(sizeof(*gtid_set));
+    gtidSetTouch(gtid_set);
     gtid_set->header = NULL;
     gtid_set->tail = NULL;
     gtid_set->current = NULL;
@@ -627,6 +673,7 @@ void gtidSetFree(gtidSet *gtid_set) {
 gtidSet* gtidSetDup(gtidSet *gtid_set) {
     gtidSet *result = gtid_malloc(sizeof(gtidSet));
     uuidSet *cur = gtid_set->header, *x = NULL, *p = NULL;
+    gtidSetTouch(result);
     result->current = NULL;
     result->curnext = 0;
     result->cached = NULL;
@@ -644,6 +691,7 @@ gtidSet* gtidSetDup(gtidSet *gtid_set) {
 
 gno_t gtidSetAppend(gtidSet *gtid_set, uuidSet *uuid_set) {
     if (uuid_set == NULL) return 0;
+    gtidSetTouch(gtid_set);
     if (gtid_set->header == NULL) {
         gtid_set->header = uuid_set;
         gtid_set->tail = uuid_set;
@@ -743,7 +791,9 @@ gno_t gtidSetAdd(gtidSet* gtid_set, const char* uuid, size_t uuid_len,
         gtidSetAppend(gtid_set, cur);
     }
     gtid_set->cached = cur;
-    return uuidSetAdd(cur, start, end);
+    gno_t added = uuidSetAdd(cur, start, end);
+    if (added) gtidSetTouch(gtid_set);
+    return added;
 }
 
 gno_t gtidSetRemove(gtidSet* gtid_set, const char *uuid, size_t uuid_len,
@@ -754,6 +804,7 @@ gno_t gtidSetRemove(gtidSet* gtid_set, const char *uuid, size_t uuid_len,
         if (cur->uuid_len == uuid_len &&
                 memcmp(cur->uuid, uuid, uuid_len) == 0) {
             removed = uuidSetRemove(cur,start,end);
+            if (removed) gtidSetTouch(gtid_set);
             if (uuidSetCount(cur) == 0) {
                 if (gtid_set->current == cur) gtid_set->current = NULL;
                 if (prev) prev->next = cur->next;
@@ -785,6 +836,7 @@ gno_t gtidSetMerge(gtidSet* dst, gtidSet* src) {
         }
         src_uuid_set = src_uuid_set->next;
     }
+    if (added) gtidSetTouch(dst);
     return added;
 }
 
@@ -811,9 +863,23 @@ gno_t gtidSetDiff(gtidSet* dst, gtidSet* src) {
         }
         cur = next;
     }
+    if (removed) gtidSetTouch(dst);
     return removed;
 }
 
+/* Same as gtidSetCount of gtid_set after gtidSetDiff(gtid_set,other),
+ * but neither set is changed or copied. */
+gno_t gtidSetDiffCount(gtidSet* gtid_set, gtidSet* other) {
+    gno_t count = 0;
+    uuidSet *cur, *other_uuid_set;
+    for (cur = gtid_set->header; cur != NULL; cur = cur->next) {
+        other_uuid_set = other ? gtidSetFind(other,cur->uuid,cur->uuid_len) : NULL;
+        if (other_uuid_set) count += uuidSetDiffCount(cur,other_uuid_set);
+        else count += uuidSetCount(cur);
+    }
+    return count;
+}
+
 gno_t gtidSetNext(gtidSet* gtid_set, const char* uuid, size_t uuid_len,
         int update) {
     uuidSet *uuid_set = gtidSetFind(gtid_set, uuid, uuid_len);
@@ -826,6 +892,7 @@ gno_t gtidSetNext(gtidSet* gtid_set, const char* uuid, size_t uuid_len,
         }
     }
     gtid_set->cached = uuid_set;
+    if (update) gtidSetTouch(gtid_set);
     return uuidSetNext(uuid_set,update);
 }
 
@@ -852,22 +919,8 @@ void gtidStatMerge(gtidStat *sum, gtidStat *one) {
 }
 
 int gtidSetEqual(gtidSet *set1, gtidSet *set2) {
-    gtidSet *set;
-    gno_t count;
-
-    set = gtidSetDup(set1);
-    gtidSetDiff(set,set2);
-    count = gtidSetCount(set);
-    gtidSetFree(set);
-
-    if (count) return 0;
-
-    set = gtidSetDup(set2);
-    gtidSetDiff(set,set1);
-    count = gtidSetCount(set);
-    gtidSetFree(set);
-
-    return count ? 0 : 1;
+    if (gtidSetCount(set1) != gtidSetCount(set2)) return 0;
+    return gtidSetDiffCount(set1,set2) == 0;
 }
 
 /* return 1 if set1 and set2 has common uuid */
@@ -916,9 +969,15 @@ int gtidSetIteratorSeek(gtidSetIterator* iterator, const char* uuid,
     return 0;
 }
 
+static inline size_t uuidSetMemory(uuidSet *uuid_set) {
+    return gtidAllocSize(uuid_set,sizeof(*uuid_set)) +
+        gtidAllocSize(uuid_set->uuid,uuid_set->uuid_len+1) +
+        uuid_set->intervals->used_memory;
+}
+
 void uuidSetGetStat(uuidSet *uuid_set, gtidStat *stat) {
     stat->uuid_count = 1;
-    stat->used_memory = uuid_set->intervals->node_count * GTID_INTERVAL_MEMORY;
+    stat->used_memory = uuidSetMemory(uuid_set);
     stat->gap_count = uuid_set->intervals->node_count-1;
     stat->gno_count = uuid_set->intervals->gno_count;
 }
@@ -926,6 +985,7 @@ void uuidSetGetStat(uuidSet *uuid_set, gtidStat *stat) {
 void gtidSetGetStat(gtidSet *gtid_set, gtidStat *stat) {
     uuidSet *uuid_set = gtid_set->header;
     memset(stat,0,sizeof(*stat));
+    stat->used_memory = gtidAllocSize(gtid_set,sizeof(*gtid_set));
     while (uuid_set) {
         gtidStat uuid_stat;
         uuidSetGetStat(uuid_set, &uuid_stat);
@@ -943,6 +1003,7 @@ void gtidSetCurrentUuidSetUpdate(gtidSet *gtid_set, const char *uuid,
         gtidSetAppend(gtid_set,uuid_set);
     }
     gtid_set->current = uuid_set;
+    gtidSetTouch(gtid_set);
 }
 
 const char *gtidAllocatorName() {
@@ -954,9 +1015,64 @@ gtidSegment *gtidSegmentNew() {
     memset(seg,0,sizeof(gtidSegment));
     seg->capacity = GTID_SEGMENT_NGNO_DEFAULT;
     seg->deltas = gtid_malloc(sizeof(segoff_t)*GTID_SEGMENT_NGNO_DEFAULT);
+    seg->sample = 1;
     return seg;
 }
 
+/* Index of deltas keeping offset of the idx-th gno, or of the nearest sampled
+ * gno before it. */
+static inline size_t gtidSegmentSlot(gtidSegment *seg, size_t idx) {
+    if (idx < GTID_SEGMENT_MIX_NGNO) return idx;
+    return GTID_SEGMENT_MIX_NGNO + (idx-GTID_SEGMENT_MIX_NGNO)/seg->sample;
+}
+
+/* Index of gno whose offset is kept by slot. */
+static inline size_t gtidSegmentSlotIdx(gtidSegment *seg, size_t slot) {
+    if (slot < GTID_SEGMENT_MIX_NGNO) return slot;
+    return GTID_SEGMENT_MIX_NGNO + (slot-GTID_SEGMENT_MIX_NGNO)*seg->sample;
+}
+
+static inline int gtidSegmentSampled(gtidSegment *seg, size_t idx) {
+    return gtidSegmentSlotIdx(seg,gtidSegmentSlot(seg,idx)) == idx;
+}
+
+static inline size_t gtidSegmentNslot(gtidSegment *seg) {
+    return seg->ngno ? gtidSegmentSlot(seg,seg->ngno-1)+1 : 0;
+}
+
+/* Offset of the last sampled gno. */
+static inline long long gtidSegmentTailOffset(gtidSegment *seg) {
+    return seg->base_offset + seg->deltas[gtidSegmentNslot(seg)-1];
+}
+
+/* Whether deltas will grow on next append. */
+static inline int gtidSegmentFull(gtidSegment *seg) {
+    return gtidSegmentSampled(seg,seg->ngno) &&
+        gtidSegmentSlot(seg,seg->ngno) == seg->capacity;
+}
+
+/* Release mixed columns, segment turns back to plain segment. */
+static void gtidSegmentUnmix(gtidSegment *seg) {
+    if (seg->uuids) {
+        for (size_t i = 0; i < seg->nuuid; i++) {
+            gtid_free(seg->uuids[i].uuid);
+        }
+        gtid_free(seg->uuids);
+        seg->uuids = NULL;
+    }
+    if (seg->uuid_ids) {
+        gtid_free(seg->uuid_ids);
+        seg->uuid_ids = NULL;
+    }
+    if (seg->gno_deltas) {
+        gtid_free(seg->gno_deltas);
+        seg->gno_deltas = NULL;
+    }
+    seg->nuuid = 0;
+    seg->uuid_capacity = 0;
+    seg->mixed = 0;
+}
+
 void gtidSegmentFree(gtidSegment *seg) {
     if (seg == NULL) return;
     if (seg->uuid) {
@@ -967,39 +1083,237 @@ void gtidSegmentFree(gtidSegment *seg) {
         gtid_free(seg->deltas);
         seg->deltas = NULL;
     }
+    gtidSegmentUnmix(seg);
     gtid_free(seg);
 }
 
+static inline size_t gtidSegmentMemory(gtidSegment *seg) {
+    size_t memory = gtidAllocSize(seg,sizeof(gtidSegment)) +
+        gtidAllocSize(seg->deltas,sizeof(segoff_t)*seg->capacity);
+    if (seg->uuid) memory += gtidAllocSize(seg->uuid,seg->uuid_len+1);
+    if (seg->mixed) {
+        memory += gtidAllocSize(seg->uuids,
+                sizeof(gtidSegmentUuid)*seg->uuid_capacity);
+        for (size_t i = 0; i < seg->nuuid; i++) {
+            memory += gtidAllocSize(seg->uuids[i].uuid,
+                    seg->uuids[i].uuid_len+1);
+        }
+        memory += gtidAllocSize(seg->uuid_ids,sizeof(seguuid_t)*seg->capacity);
+        memory += gtidAllocSize(seg->gno_deltas,sizeof(seggno_t)*seg->capacity);
+    }
+    return memory;
+}
+
 void gtidSegmentReset(gtidSegment *seg, const char *uuid,
         size_t uuid_len, gno_t base_gno, long long base_offset) {
     if (seg->uuid_len != uuid_len || memcmp(seg->uuid, uuid, uuid_len)) {
         if (seg->uuid) gtid_free(seg->uuid);
         uuidDup(&seg->uuid,&seg->uuid_len,uuid,uuid_len);
     }
+    gtidSegmentUnmix(seg);
     seg->base_offset = base_offset;
     seg->base_gno = base_gno;
     seg->tgno = 0;
     seg->ngno = 0;
 }
 
+static inline void gtidSegmentGrow(gtidSegment *seg) {
+    seg->capacity *= 2;
+    seg->deltas = gtid_realloc(seg->deltas,sizeof(segoff_t)*seg->capacity);
+    if (seg->mixed) {
+        seg->uuid_ids = gtid_realloc(seg->uuid_ids,
+                sizeof(seguuid_t)*seg->capacity);
+        seg->gno_deltas = gtid_realloc(seg->gno_deltas,
+                sizeof(seggno_t)*seg->capacity);
+    }
+}
+
 void gtidSegmentAppend(gtidSegment *seg, long long offset) {
     size_t delta = offset - seg->base_offset;
+    assert(!seg->mixed);
     assert(delta >= 0 && delta <= SEGOFF_MAX);
+    if (gtidSegmentSampled(seg,seg->ngno)) {
+        size_t slot = gtidSegmentSlot(seg,seg->ngno);
+        assert(slot <= seg->capacity);
+        if (slot == seg->capacity) gtidSegmentGrow(seg);
+        seg->deltas[slot] = delta;
+    }
+    seg->ngno++;
+}
+
+/* Convert plain segment to mixed segment, gnos already appended are kept
+ * as entries of uuid 0. */
+void gtidSegmentMix(gtidSegment *seg) {
+    gtidSegmentUuid *seg_uuid;
+
+    if (seg->mixed) return;
+    assert(seg->ngno > 0 && seg->ngno <= GTID_SEGMENT_MIX_NGNO);
+
+    seg->uuid_capacity = GTID_SEGMENT_NUUID_DEFAULT;
+    seg->uuids = gtid_malloc(sizeof(gtidSegmentUuid)*seg->uuid_capacity);
+    seg->uuid_ids = gtid_malloc(sizeof(seguuid_t)*seg->capacity);
+    seg->gno_deltas = gtid_malloc(sizeof(seggno_t)*seg->capacity);
+
+    seg_uuid = &seg->uuids[0];
+    uuidDup(&seg_uuid->uuid,&seg_uuid->uuid_len,seg->uuid,seg->uuid_len);
+    seg_uuid->base_gno = seg->base_gno;
+    seg_uuid->start_gno = seg->base_gno;
+    seg_uuid->end_gno = seg->base_gno + seg->ngno - 1;
+    seg->nuuid = 1;
+
+    for (size_t i = 0; i < seg->ngno; i++) {
+        seg->uuid_ids[i] = 0;
+        seg->gno_deltas[i] = (seggno_t)i;
+    }
+    seg->sample = 1; /* mixed segment keeps offset of every entry */
+    seg->mixed = 1;
+}
+
+/* Returns uuid id of mixed segment, -1 if uuid not in segment. */
+static inline int gtidSegmentUuidId(gtidSegment *seg, const char *uuid,
+        size_t uuid_len) {
+    gtidSegmentUuid *seg_uuid;
+
+    /* fast path: uuid of last entry */
+    if (seg->ngno > 0) {
+        seg_uuid = &seg->uuids[seg->uuid_ids[seg->ngno-1]];
+        if (seg_uuid->uuid_len == uuid_len &&
+                !memcmp(seg_uuid->uuid,uuid,uuid_len)) {
+            return seg->uuid_ids[seg->ngno-1];
+        }
+    }
+
+    for (size_t id = 0; id < seg->nuuid; id++) {
+        seg_uuid = &seg->uuids[id];
+        if (seg_uuid->uuid_len == uuid_len &&
+                !memcmp(seg_uuid->uuid,uuid,uuid_len)) {
+            return (int)id;
+        }
+    }
+    return -1;
+}
+
+/* Append gtid to mixed segment, returns 0 if uuid table is full or gno delta
+ * overflows, caller should switch to a new segment then. */
+int gtidSegmentAppendMixed(gtidSegment *seg, const char *uuid,
+        size_t uuid_len, gno_t gno, long long offset) {
+    size_t delta = offset - seg->base_offset;
+    gtidSegmentUuid *seg_uuid;
+    int id;
+
+    assert(seg->mixed);
+    assert(delta <= SEGOFF_MAX);
     assert(seg->ngno <= seg->capacity);
-    if (seg->ngno == seg->capacity) {
-        seg->capacity *= 2;
-        seg->deltas = gtid_realloc(seg->deltas,sizeof(segoff_t)*seg->capacity);
+
+    if ((id = gtidSegmentUuidId(seg,uuid,uuid_len)) < 0) {
+        if (seg->nuuid == GTID_SEGMENT_NUUID_MAX) return 0;
+        if (seg->nuuid == seg->uuid_capacity) {
+            seg->uuid_capacity *= 2;
+            seg->uuids = gtid_realloc(seg->uuids,
+                    sizeof(gtidSegmentUuid)*seg->uuid_capacity);
+        }
+        id = (int)seg->nuuid++;
+        seg_uuid = &seg->uuids[id];
+        uuidDup(&seg_uuid->uuid,&seg_uuid->uuid_len,uuid,uuid_len);
+        seg_uuid->base_gno = gno;
+        seg_uuid->start_gno = gno;
+        seg_uuid->end_gno = gno;
+    } else {
+        seg_uuid = &seg->uuids[id];
+        if (gno - seg_uuid->base_gno < SEGGNO_MIN ||
+                gno - seg_uuid->base_gno > SEGGNO_MAX) return 0;
+        if (gno < seg_uuid->start_gno) seg_uuid->start_gno = gno;
+        if (gno > seg_uuid->end_gno) seg_uuid->end_gno = gno;
+    }
+
+    if (seg->ngno == seg->capacity) gtidSegmentGrow(seg);
+    seg->deltas[seg->ngno] = delta;
+    seg->uuid_ids[seg->ngno] = (seguuid_t)id;
+    seg->gno_deltas[seg->ngno] = (seggno_t)(gno - seg_uuid->base_gno);
+    seg->ngno++;
+    return 1;
+}
+
+/* Get gtid and offset of the idx-th entry of segment, offset is -1 if idx
+ * is not sampled. */
+void gtidSegmentGet(gtidSegment *seg, size_t idx, const char **uuid,
+        size_t *uuid_len, gno_t *gno, long long *offset) {
+    assert(idx < seg->ngno);
+    if (seg->mixed) {
+        gtidSegmentUuid *seg_uuid = &seg->uuids[seg->uuid_ids[idx]];
+        if (uuid) *uuid = seg_uuid->uuid;
+        if (uuid_len) *uuid_len = seg_uuid->uuid_len;
+        if (gno) *gno = seg_uuid->base_gno + seg->gno_deltas[idx];
+    } else {
+        if (uuid) *uuid = seg->uuid;
+        if (uuid_len) *uuid_len = seg->uuid_len;
+        if (gno) *gno = seg->base_gno + idx;
+    }
+    if (offset) {
+        *offset = gtidSegmentSampled(seg,idx) ?
+            seg->base_offset + seg->deltas[gtidSegmentSlot(seg,idx)] : -1;
+    }
+}
+
+/* Add gtids of entries [from, ngno) to gtid_set. */
+void gtidSegmentAddToGtidSet(gtidSegment *seg, size_t from,
+        gtidSet *gtid_set) {
+    size_t i = from;
+
+    if (from >= seg->ngno) return;
+
+    if (!seg->mixed) {
+        gtidSetAdd(gtid_set,seg->uuid,seg->uuid_len,
+                seg->base_gno+from,seg->base_gno+seg->ngno-1);
+        return;
+    }
+
+    while (i < seg->ngno) {
+        seguuid_t id = seg->uuid_ids[i];
+        gtidSegmentUuid *seg_uuid = &seg->uuids[id];
+        gno_t start = seg_uuid->base_gno + seg->gno_deltas[i], end = start;
+        /* merge run of consecutive gnos of the same uuid */
+        while (i+1 < seg->ngno && seg->uuid_ids[i+1] == id &&
+                seg->gno_deltas[i+1] == seg->gno_deltas[i]+1) {
+            i++, end++;
+        }
+        gtidSetAdd(gtid_set,seg_uuid->uuid,seg_uuid->uuid_len,start,end);
+        i++;
     }
-    seg->deltas[seg->ngno++] = delta;
+}
+
+/* Returns offset of gtid in mixed segment, -1 if not found. */
+static long long gtidSegmentMixedLookup(gtidSegment *seg, const char *uuid,
+        size_t uuid_len, gno_t gno) {
+    gtidSegmentUuid *seg_uuid;
+    seggno_t gno_delta;
+    int id;
+
+    if ((id = gtidSegmentUuidId(seg,uuid,uuid_len)) < 0) return -1;
+    seg_uuid = &seg->uuids[id];
+    if (gno < seg_uuid->start_gno || gno > seg_uuid->end_gno) return -1;
+    gno_delta = (seggno_t)(gno - seg_uuid->base_gno);
+
+    for (size_t i = seg->ngno; i > seg->tgno; i--) {
+        if (seg->uuid_ids[i-1] == id && seg->gno_deltas[i-1] == gno_delta) {
+            return seg->base_offset + seg->deltas[i-1];
+        }
+    }
+    return -1;
 }
 
 gtidSeq *gtidSeqCreate() {
     gtidSeq *seq = gtid_malloc(sizeof(struct gtidSeq));
     seq->segment_size = SEGMENT_SIZE;
+    seq->sample = GTID_SEQ_SAMPLE_DEFAULT;
+    seq->scan = NULL;
+    seq->scan_privdata = NULL;
     seq->nsegment = 0;
     seq->nfreeseg = 0;
     seq->nsegment_deltas = 0;
     seq->nfreeseg_deltas = 0;
+    seq->nsegment_memory = 0;
+    seq->nfreeseg_memory = 0;
     seq->firstseg = NULL;
     seq->lastseg = NULL;
     seq->freeseg = NULL;
@@ -1016,27 +1330,42 @@ void gtidSeqDestroy(gtidSeq *seq) {
         next = seg->next;
         seq->nsegment--;
         seq->nsegment_deltas -= seg->capacity;
+        seq->nsegment_memory -= gtidSegmentMemory(seg);
         gtidSegmentFree(seg);
         seg = next;
     }
     seq->firstseg = NULL;
     seq->lastseg = NULL;
-    assert(seq->nsegment == 0 && seq->nsegment_deltas == 0);
+    assert(seq->nsegment == 0 && seq->nsegment_deltas == 0 &&
+            seq->nsegment_memory == 0);
 
     seg = seq->freeseg;
     while (seg) {
         next = seg->next;
         seq->nfreeseg--;
         seq->nfreeseg_deltas -= seg->capacity;
+        seq->nfreeseg_memory -= gtidSegmentMemory(seg);
         gtidSegmentFree(seg);
         seg = next;
     }
     seq->freeseg = NULL;
-    assert(seq->nfreeseg == 0 && seq->nfreeseg_deltas == 0);
+    assert(seq->nfreeseg == 0 && seq->nfreeseg_deltas == 0 &&
+            seq->nfreeseg_memory == 0);
 
     gtid_free(seq);
 }
 
+/* Index offset of one in every sample gnos, applies to segments switched
+ * afterwards. Offsets in between are located by scan proc if set. */
+void gtidSeqSetSample(gtidSeq *seq, size_t sample) {
+    seq->sample = sample > 0 ? sample : 1;
+}
+
+void gtidSeqSetScanProc(gtidSeq *seq, gtidSeqScanProc scan, void *privdata) {
+    seq->scan = scan;
+    seq->scan_privdata = privdata;
+}
+
 static inline
 gtidSegment *gtidSeqSwitchSegment(gtidSeq *seq, const char *uuid,
         size_t uuid_len, gno_t base_gno, long long base_offset) {
@@ -1050,12 +1379,14 @@ gtidSegment *gtidSeqSwitchSegment(gtidSeq *seq, const char *uuid,
         seg->next = NULL;
         seq->nfreeseg--;
         seq->nfreeseg_deltas -= seg->capacity;
+        seq->nfreeseg_memory -= gtidSegmentMemory(seg);
     } else {
         /* create new seg */
         seg = gtidSegmentNew();
     }
 
     gtidSegmentReset(seg,uuid,uuid_len,base_gno,base_offset);
+    seg->sample = seq->sample;
 
     seg->prev = seq->lastseg;
     if (!seq->firstseg) seq->firstseg = seg;
@@ -1063,32 +1394,67 @@ gtidSegment *gtidSeqSwitchSegment(gtidSeq *seq, const char *uuid,
     seq->lastseg = seg;
     seq->nsegment++;
     seq->nsegment_deltas += seg->capacity;
+    seq->nsegment_memory += gtidSegmentMemory(seg);
 
     return seg;
 }
 
+static inline int gtidSeqSegmentAppend(gtidSegment *seg, const char *uuid,
+        size_t uuid_len, gno_t gno, long long offset) {
+    if (seg->mixed) {
+        return gtidSegmentAppendMixed(seg,uuid,uuid_len,gno,offset);
+    } else {
+        gtidSegmentAppend(seg,offset);
+        return 1;
+    }
+}
+
 void gtidSeqAppend(gtidSeq *seq, const char *uuid, size_t uuid_len,
         gno_t gno, long long offset) {
     gtidSegment *lastseg = seq->lastseg;
+    int appended;
 
     if (lastseg) {
         long long tail_offset;
         assert(lastseg->ngno > 0);
-        tail_offset = lastseg->base_offset + lastseg->deltas[lastseg->ngno-1];
+        tail_offset = gtidSegmentTailOffset(lastseg);
         assert(tail_offset < offset);
     }
 
     if(lastseg == NULL /* no previous segment */ ||
-            lastseg->uuid_len != uuid_len /* uuid switch */ ||
-            memcmp(lastseg->uuid, uuid, uuid_len) /* uuid switch */ ||
-            lastseg->base_gno + (gno_t)lastseg->ngno != gno /* gno gap */ ||
             lastseg->base_offset + (long long)seq->segment_size <= offset) {
         lastseg = gtidSeqSwitchSegment(seq,uuid,uuid_len,gno,offset);
+    } else if (!lastseg->mixed &&
+            (lastseg->uuid_len != uuid_len /* uuid switch */ ||
+            memcmp(lastseg->uuid, uuid, uuid_len) /* uuid switch */ ||
+            lastseg->base_gno + (gno_t)lastseg->ngno != gno /* gno gap */)) {
+        if (lastseg->ngno < GTID_SEGMENT_MIX_NGNO) {
+            /* short run, write sources are probably interleaving: cheaper
+             * to index per entry uuid than a segment per run. */
+            seq->nsegment_memory -= gtidSegmentMemory(lastseg);
+            gtidSegmentMix(lastseg);
+            seq->nsegment_memory += gtidSegmentMemory(lastseg);
+        } else {
+            lastseg = gtidSeqSwitchSegment(seq,uuid,uuid_len,gno,offset);
+        }
     }
 
-    size_t prev_capacity = lastseg->capacity;
-    gtidSegmentAppend(lastseg,offset);
-    seq->nsegment_deltas += lastseg->capacity - prev_capacity;
+    if (gtidSegmentFull(lastseg) /* deltas will grow */ ||
+            (lastseg->mixed && gtidSegmentUuidId(lastseg,uuid,uuid_len) < 0)) {
+        size_t prev_capacity = lastseg->capacity;
+        seq->nsegment_memory -= gtidSegmentMemory(lastseg);
+        appended = gtidSeqSegmentAppend(lastseg,uuid,uuid_len,gno,offset);
+        seq->nsegment_memory += gtidSegmentMemory(lastseg);
+        seq->nsegment_deltas += lastseg->capacity - prev_capacity;
+    } else {
+        appended = gtidSeqSegmentAppend(lastseg,uuid,uuid_len,gno,offset);
+    }
+
+    if (!appended) {
+        /* mixed segment can't hold more uuid or gno delta overflows */
+        lastseg = gtidSeqSwitchSegment(seq,uuid,uuid_len,gno,offset);
+        gtidSegmentAppend(lastseg,offset);
+    }
 }
 
 void gtidSeqTrim(gtidSeq *seq, long long until) {
@@ -1099,11 +1465,14 @@ void gtidSeqTrim(gtidSeq *seq, long long until) {
         /* no empty segment allowed */
         assert(seg->ngno > seg->tgno);
 
-        tail_offset = seg->base_offset + seg->deltas[seg->ngno-1];
+        /* gnos after last sample are trimmed along with it: their offsets
+         * are unknown, index them less rather than wrongly. */
+        tail_offset = gtidSegmentTailOffset(seg);
 
         if (tail_offset < until) { /* whole segment trimmed */
             seq->nsegment--;
             seq->nsegment_deltas -= seg->capacity;
+            seq->nsegment_memory -= gtidSegmentMemory(seg);
             seq->firstseg = seg->next;
             if (seq->firstseg) seq->firstseg->prev = NULL;
             if (!seq->firstseg) seq->lastseg = NULL;
@@ -1114,12 +1483,14 @@ void gtidSeqTrim(gtidSeq *seq, long long until) {
                 seq->freeseg = seg;
                 seq->nfreeseg++;
                 seq->nfreeseg_deltas += seg->capacity;
+                seq->nfreeseg_memory += gtidSegmentMemory(seg);
             } else {
                 gtidSegmentFree(seg);
             }
-        } else { /* at least last gno will be kept */
+        } else { /* at least last sample will be kept */
             long long offset;
-            size_t l = seg->tgno, r = seg->ngno, m;
+            size_t l = gtidSegmentSlot(seg,seg->tgno),
+                   r = gtidSegmentNslot(seg), m;
 
             while (l < r) {
                 m = l + (r-l)/2;
@@ -1131,29 +1502,56 @@ void gtidSeqTrim(gtidSeq *seq, long long until) {
                 }
             }
 
-            /* l is the first segment that should be kept */
-            seg->tgno = l;
+            /* l is the first sample that should be kept */
+            seg->tgno = gtidSegmentSlotIdx(seg,l);
             assert(seg->ngno > seg->tgno);
             break;
         }
     }
 }
 
-/* <uuid>:[<gno_1>=<offset_1>,<gno_2>=<offset_2>,...] */
+/* plain segment: <uuid>:[<gno_1>=<offset_1>,<gno_2>=<offset_2>,...]
+ * mixed segment: [<uuid_1>:<gno_1>=<offset_1>,<uuid_2>:<gno_2>=<offset_2>,...] */
 static inline size_t gtidSegmentEstimatedEncodeBufferSize(gtidSegment *seg) {
     size_t len = 0;
-    len += seg->uuid_len + 1; /* uuid: */
-    len += 2; /* [] */
-    len += (seg->ngno-seg->tgno)*(20+1+20+1); /* <gno_i>=<offset_i>, */
+    if (seg->mixed) {
+        size_t uuid_len = 0;
+        for (size_t id = 0; id < seg->nuuid; id++) {
+            if (seg->uuids[id].uuid_len > uuid_len)
+                uuid_len = seg->uuids[id].uuid_len;
+        }
+        len += 2; /* [] */
+        /* <uuid_i>:<gno_i>=<offset_i>, */
+        len += (seg->ngno-seg->tgno)*(uuid_len+1+20+1+20+1);
+    } else {
+        len += seg->uuid_len + 1; /* uuid: */
+        len += 2; /* [] */
+        /* <gno_i>=<offset_i>, of sampled gnos */
+        len += (gtidSegmentNslot(seg)-gtidSegmentSlot(seg,seg->tgno))*(20+1+20+1);
+    }
     return len;
 }
 
 static inline size_t gtidSegmentEncode(char *buf, size_t maxlen, gtidSegment *seg) {
     size_t len = 0;
+    if (seg->mixed) {
+        len += snprintf(buf+len,maxlen-len,"[");
+        for (size_t i = seg->tgno; i < seg->ngno; i++) {
+            gtidSegmentUuid *seg_uuid = &seg->uuids[seg->uuid_ids[i]];
+            len += snprintf(buf+len,maxlen-len,"%.*s:%llu=%llu,",
+                    (int)seg_uuid->uuid_len,seg_uuid->uuid,
+                    seg_uuid->base_gno+seg->gno_deltas[i],
+                    seg->base_offset+seg->deltas[i]);
+        }
+        len += snprintf(buf+len,maxlen-len,"]");
+        return len;
+    }
     len += snprintf(buf+len,maxlen-len,"%.*s:[",(int)seg->uuid_len,seg->uuid);
-    for (size_t i = seg->tgno; i < seg->ngno; i++) {
+    for (size_t slot = gtidSegmentSlot(seg,seg->tgno);
+            slot < gtidSegmentNslot(seg); slot++) {
         len += snprintf(buf+len,maxlen-len,"%llu=%llu,",
-                seg->base_gno+i,seg->base_offset+seg->deltas[i]);
+                seg->base_gno+gtidSegmentSlotIdx(seg,slot),
+                seg->base_offset+seg->deltas[slot]);
     }
     len += snprintf(buf+len,maxlen-len,"]");
     return len;
@@ -1185,21 +1583,83 @@ ssize_t gtidSeqEncode(char *buf, size_t maxlen, gtidSeq* seq) {
 }
 
 
+/* Offset of the idx-th gno of plain segment, scans forward from the nearest
+ * sample if idx is not sampled. Returns -1 if it can't be located. */
+static long long gtidSeqSegmentOffset(gtidSeq *seq, gtidSegment *seg,
+        size_t idx) {
+    size_t slot = gtidSegmentSlot(seg,idx);
+    long long offset = seg->base_offset + seg->deltas[slot];
+    if (gtidSegmentSlotIdx(seg,slot) == idx) return offset;
+    if (seq->scan == NULL) return -1;
+    return seq->scan(seq->scan_privdata,offset,seg->uuid,seg->uuid_len,
+            seg->base_gno+idx);
+}
+
+/* Returns the first gno in (idx,until) of plain segment located at or after
+ * offset (idx_offset, offset of idx, is before offset), until if none. Gnos
+ * between samples are located by scan proc, -1 if they can't be located:
+ * guessing either way would apply or skip gnos twice. */
+static ssize_t gtidSeqSegmentRefine(gtidSeq *seq, gtidSegment *seg,
+        size_t idx, long long idx_offset, size_t until, long long offset) {
+    for (size_t i = idx+1; i < until; i++) {
+        if (seq->scan == NULL) return -1;
+        idx_offset = seq->scan(seq->scan_privdata,idx_offset,seg->uuid,
+                seg->uuid_len,seg->base_gno+i);
+        if (idx_offset < 0) return -1;
+        if (idx_offset >= offset) return i;
+    }
+    return until;
+}
+
 long long gtidSeqLookup(gtidSeq *seq, char* uuid, size_t uuid_len, gno_t gno) {
     gtidSegment *seg = seq->lastseg;
     while (seg) {
-        if (seg->uuid_len == uuid_len &&
+        if (seg->mixed) {
+            long long offset = gtidSegmentMixedLookup(seg,uuid,uuid_len,gno);
+            if (offset >= 0) return offset;
+        } else if (seg->uuid_len == uuid_len &&
             memcmp(seg->uuid, uuid, uuid_len) == 0 &&
             gno >= seg->base_gno + (gno_t)seg->tgno &&
             gno < seg->base_gno + (gno_t)seg->ngno) {
             size_t idx = (size_t)(gno - seg->base_gno);
-            return seg->base_offset + seg->deltas[idx];
+            return gtidSeqSegmentOffset(seq,seg,idx);
         }
         seg = seg->prev;
     }
     return -1;
 }
 
+/* Get the earliest gtid in seq and its offset, returns 0 if seq is empty. */
+int gtidSeqFirst(gtidSeq *seq, const char **uuid, size_t *uuid_len,
+        gno_t *gno, long long *offset) {
+    gtidSegment *seg = seq->firstseg;
+    if (seg == NULL) return 0;
+    gtidSegmentGet(seg,seg->tgno,uuid,uuid_len,gno,offset);
+    return 1;
+}
+
+/* Locate xsync continue position in mixed segment: entries after the last
+ * one already in req should be continued. Returns index of the first entry
+ * to continue, seg->tgno if the whole segment should be continued. */
+static size_t gtidSegmentMixedXsync(gtidSegment *seg, gtidSet *req) {
+    gno_t next_gnos[GTID_SEGMENT_NUUID_MAX];
+    size_t i;
+
+    for (size_t id = 0; id < seg->nuuid; id++) {
+        uuidSet *uuid_set = gtidSetFind(req,seg->uuids[id].uuid,
+                seg->uuids[id].uuid_len);
+        next_gnos[id] = uuid_set ? uuidSetNext(uuid_set,0) : GTID_GNO_INITIAL;
+    }
+
+    for (i = seg->ngno; i > seg->tgno; i--) {
+        seguuid_t id = seg->uuid_ids[i-1];
+        gno_t gno = seg->uuids[id].base_gno + seg->gno_deltas[i-1];
+        if (gno < next_gnos[id]) break;
+    }
+
+    return i;
+}
+
 /* Locate xsync continue position, return continue offset and gitset from
  * continue to end. */
 long long gtidSeqXsync(gtidSeq *seq, gtidSet *req, gtidSet **pcont) {
@@ -1208,6 +1668,16 @@ long long gtidSeqXsync(gtidSeq *seq, gtidSet *req, gtidSet **pcont) {
     gtidSet *cont = gtidSetNew();
 
     while (seg) {
+        if (seg->mixed) {
+            size_t idx = gtidSegmentMixedXsync(seg,req);
+            if (idx < seg->ngno) {
+                offset = seg->base_offset + seg->deltas[idx];
+                gtidSegmentAddToGtidSet(seg,idx,cont);
+            }
+            seg = idx > seg->tgno ? NULL : seg->prev;
+            continue;
+        }
+
         uuidSet *uuid_set = gtidSetFind(req,seg->uuid,seg->uuid_len);
         gno_t next_gno = uuid_set ? uuidSetNext(uuid_set,0) : GTID_GNO_INITIAL;
         gno_t start_gno = seg->base_gno + seg->tgno;
@@ -1216,11 +1686,20 @@ long long gtidSeqXsync(gtidSeq *seq, gtidSet *req, gtidSet **pcont) {
         if (next_gno > end_gno) {
             seg = NULL;
         } else if (next_gno > start_gno) {
-            offset = seg->base_offset + seg->deltas[next_gno - seg->base_gno];
+            size_t idx = (size_t)(next_gno - seg->base_gno);
+            if ((offset = gtidSeqSegmentOffset(seq,seg,idx)) < 0) {
+                /* continue from the sample before, replica skips gtids
+                 * already executed. */
+                size_t slot = gtidSegmentSlot(seg,idx);
+                offset = seg->base_offset + seg->deltas[slot];
+                next_gno = seg->base_gno + gtidSegmentSlotIdx(seg,slot);
+            }
             gtidSetAdd(cont,seg->uuid,seg->uuid_len,next_gno,end_gno);
             seg = NULL;
         } else {
-            offset = seg->base_offset + seg->deltas[start_gno - seg->base_gno];
+            /* trimmed gno count is always sampled */
+            offset = seg->base_offset +
+                seg->deltas[gtidSegmentSlot(seg,seg->tgno)];
             gtidSetAdd(cont,seg->uuid,seg->uuid_len,start_gno,end_gno);
             seg = seg->prev;
         }
@@ -1235,22 +1714,22 @@ long long gtidSeqXsync(gtidSeq *seq, gtidSet *req, gtidSet **pcont) {
     return offset;
 }
 
+/* Gtids at or after offset, NULL if they can't be told exactly. */
 gtidSet *gtidSeqPsync(gtidSeq *seq, long long offset) {
     gtidSegment *seg = seq->lastseg;
     gtidSet *gtid_set = gtidSetNew();
 
     while (seg) {
-        gno_t start_gno, end_gno;
-        long long start_offset = seg->base_offset + seg->deltas[seg->tgno];
+        size_t tslot = gtidSegmentSlot(seg,seg->tgno);
+        long long start_offset = seg->base_offset + seg->deltas[tslot];
 
         if (start_offset >= offset) {
-            start_gno = seg->base_gno + seg->tgno;
-            end_gno = seg->base_gno + seg->ngno - 1; /* inclusive */
-            gtidSetAdd(gtid_set,seg->uuid,seg->uuid_len,start_gno,end_gno);
+            gtidSegmentAddToGtidSet(seg,seg->tgno,gtid_set);
             seg = seg->prev;
         } else {
             long long moffset;
-            size_t l = seg->tgno, r = seg->ngno, m;
+            size_t l = tslot, r = gtidSegmentNslot(seg), m;
+            ssize_t from;
             while (l < r) {
                 m = (l + r)/2;
                 moffset = seg->base_offset + seg->deltas[m];
@@ -1260,9 +1739,20 @@ gtidSet *gtidSeqPsync(gtidSeq *seq, long long offset) {
                     r = m;
                 }
             }
-            start_gno = seg->base_gno + l;
-            end_gno = seg->base_gno + seg->ngno - 1; /* inclusive */
-            gtidSetAdd(gtid_set,seg->uuid,seg->uuid_len,start_gno,end_gno);
+            /* gnos between sample l-1 and l might be at or after offset */
+            from = l < gtidSegmentNslot(seg) ?
+                gtidSegmentSlotIdx(seg,l) : seg->ngno;
+            if (l == gtidSegmentNslot(seg) ||
+                    seg->base_offset+seg->deltas[l] != offset) {
+                from = gtidSeqSegmentRefine(seq,seg,
+                        gtidSegmentSlotIdx(seg,l-1),
+                        seg->base_offset+seg->deltas[l-1],from,offset);
+            }
+            if (from < 0) {
+                gtidSetFree(gtid_set);
+                return NULL;
+            }
+            gtidSegmentAddToGtidSet(seg,from,gtid_set);
             seg = NULL;
         }
     }
@@ -1271,11 +1761,10 @@ gtidSet *gtidSeqPsync(gtidSeq *seq, long long offset) {
 }
 
 void gtidSeqGetStat(gtidSeq *seq, gtidSeqStat *stat) {
-    stat->segment_memory = seq->nsegment*sizeof(gtidSegment) +
-        seq->nsegment_deltas*sizeof(segoff_t);
-    stat->freeseg_memory = seq->nfreeseg*sizeof(gtidSegment) +
-        seq->nfreeseg_deltas*sizeof(segoff_t);
-    stat->used_memory = stat->segment_memory + stat->freeseg_memory;
+    stat->segment_memory = seq->nsegment_memory;
+    stat->freeseg_memory = seq->nfreeseg_memory;
+    stat->used_memory = gtidAllocSize(seq,sizeof(*seq)) +
+        stat->segment_memory + stat->freeseg_memory;
 }
 
 void gtidSeqRebaseOffset(gtidSeq *seq, size_t offset) {
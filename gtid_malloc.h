@@ -5,5 +5,12 @@
 #define gtid_malloc malloc
 #define gtid_realloc realloc
 #define gtid_free free
+#if defined(__GLIBC__)
+#include <malloc.h>
+#define gtid_malloc_size malloc_usable_size
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define gtid_malloc_size malloc_size
+#endif
 #endif
 
@@ -900,8 +900,6 @@ int test_uuidSetNextEncode() {
     return 1;
 }
 
-#define GTID_INTERVAL_MEMORY (sizeof(gtidIntervalNode) + sizeof(gtidIntervalNode*))
-
 int test_gtidSetNew() {
     gtidSet* gtid_set = gtidSetNew();
     assert(gtid_set->header == NULL);
@@ -1230,32 +1228,67 @@ int test_gtidSetInvalidArg() {
     return 1;
 }
 
+/* lower bound of uuidSet memory: header spans all 32 levels, n intervals
+ * at least level 1. */
+#define UUID_SET_MIN_MEMORY(uuid_len,n) (sizeof(uuidSet) + (uuid_len) + 1 + \
+        sizeof(gtidIntervalSkipList) + sizeof(gtidIntervalNode) + \
+        32*sizeof(gtidIntervalNode*) + \
+        (n)*(sizeof(gtidIntervalNode) + sizeof(gtidIntervalNode*)))
+
 int test_gtidStat() {
-    gtidSet *gtid_set = gtidSetNew();
-    uuidSet *uuid_set;
-    gtidStat stat;
+    gtidSet *gtid_set = gtidSetNew(), *dup;
+    uuidSet *uuid_set, *empty;
+    gtidStat stat, dup_stat, empty_stat;
+    size_t used_memory;
 
     uuid_set = uuidSetDecode("A:1-2:7-8",9);
     assert(uuid_set != NULL);
     uuidSetGetStat(uuid_set, &stat);
-    assert(stat.uuid_count == 1 && stat.used_memory == 3*GTID_INTERVAL_MEMORY
-            && stat.gap_count == 2 && stat.gno_count == 4);
+    assert(stat.uuid_count == 1 && stat.gap_count == 2 && stat.gno_count == 4);
+    assert(stat.used_memory >= UUID_SET_MIN_MEMORY(1,2));
+    used_memory = stat.used_memory;
 
     gtidSetAppend(gtid_set, uuid_set);
     gtidSetGetStat(gtid_set, &stat);
-    assert(stat.uuid_count == 1 && stat.used_memory == 3*GTID_INTERVAL_MEMORY
-            && stat.gap_count == 2 && stat.gno_count == 4);
+    assert(stat.uuid_count == 1 && stat.gap_count == 2 && stat.gno_count == 4);
+    assert(stat.used_memory >= used_memory + sizeof(gtidSet));
 
     uuid_set = uuidSetDecode("B:3-4:10-11",11);
     uuidSetGetStat(uuid_set, &stat);
-    assert(stat.uuid_count == 1 && stat.used_memory == 3*GTID_INTERVAL_MEMORY
-            && stat.gap_count == 2 && stat.gno_count == 4);
+    assert(stat.uuid_count == 1 && stat.gap_count == 2 && stat.gno_count == 4);
+    assert(stat.used_memory >= UUID_SET_MIN_MEMORY(1,2));
+    used_memory += stat.used_memory;
 
     gtidSetAppend(gtid_set, uuid_set);
     gtidSetGetStat(gtid_set, &stat);
-    assert(stat.uuid_count == 2 && stat.used_memory == 6*GTID_INTERVAL_MEMORY
-            && stat.gap_count == 4 && stat.gno_count == 8);
+    assert(stat.uuid_count == 2 && stat.gap_count == 4 && stat.gno_count == 8);
+    assert(stat.used_memory >= used_memory + sizeof(gtidSet));
 
+    /* dup keeps node levels, so allocates exactly the same */
+    dup = gtidSetDup(gtid_set);
+    gtidSetGetStat(dup, &dup_stat);
+    assert(dup_stat.used_memory == stat.used_memory);
+
+    /* freed nodes are no longer accounted */
+    empty = uuidSetNew("A",1);
+    uuidSetGetStat(empty, &empty_stat);
+    assert(empty_stat.used_memory >= UUID_SET_MIN_MEMORY(1,0));
+    uuid_set = gtidSetFind(dup,"A",1);
+    uuidSetRemove(uuid_set,1,8);
+    uuidSetGetStat(uuid_set, &stat);
+    assert(stat.used_memory == empty_stat.used_memory);
+    uuidSetAdd(uuid_set,3,5);
+    uuidSetGetStat(uuid_set, &stat);
+    assert(stat.used_memory >= UUID_SET_MIN_MEMORY(1,1));
+    uuidSetRemove(uuid_set,4,4); /* split */
+    uuidSetGetStat(uuid_set, &stat);
+    assert(stat.used_memory >= UUID_SET_MIN_MEMORY(1,2));
+    uuidSetRemove(uuid_set,3,5);
+    uuidSetGetStat(uuid_set, &stat);
+    assert(stat.used_memory == empty_stat.used_memory);
+
+    uuidSetFree(empty);
+    gtidSetFree(dup);
     gtidSetFree(gtid_set);
     return 1;
 }
@@ -1293,6 +1326,101 @@ int test_gtidSetDiff() {
     return 1;
 }
 
+int test_gtidSetDiffCount() {
+    gtidSet *gtid_set = gtidSetNew(), *other = gtidSetNew(), *diff;
+
+    assert(gtidSetDiffCount(gtid_set,other) == 0);
+    assert(gtidSetDiffCount(gtid_set,NULL) == 0);
+
+    gtidSetAdd(gtid_set,"A",1,1,10);
+    gtidSetAdd(gtid_set,"A",1,20,30);
+    gtidSetAdd(gtid_set,"B",1,5,5);
+    assert(gtidSetDiffCount(gtid_set,other) == 22);
+    assert(gtidSetDiffCount(other,gtid_set) == 0);
+
+    gtidSetAdd(other,"A",1,5,25);
+    gtidSetAdd(other,"C",1,1,100);
+    assert(gtidSetDiffCount(gtid_set,other) == 4+5+1);
+    assert(gtidSetDiffCount(other,gtid_set) == 9+100);
+    assert(!gtidSetEqual(gtid_set,other));
+
+    /* compare against materialized diff */
+    for (int i = 0; i < 1000; i++) {
+        gno_t start = rand()%1000+1, end = start+rand()%10;
+        if (rand()%2) gtidSetAdd(gtid_set,"A",1,start,end);
+        else gtidSetAdd(other,"A",1,start,end);
+    }
+    diff = gtidSetDup(gtid_set);
+    gtidSetDiff(diff,other);
+    assert(gtidSetDiffCount(gtid_set,other) == gtidSetCount(diff));
+    gtidSetFree(diff);
+    diff = gtidSetDup(other);
+    gtidSetDiff(diff,gtid_set);
+    assert(gtidSetDiffCount(other,gtid_set) == gtidSetCount(diff));
+    gtidSetFree(diff);
+
+    diff = gtidSetDup(gtid_set);
+    assert(gtidSetEqual(diff,gtid_set));
+    gtidSetAdd(diff,"D",1,1,1);
+    assert(!gtidSetEqual(diff,gtid_set));
+    gtidSetFree(diff);
+
+    gtidSetFree(gtid_set);
+    gtidSetFree(other);
+    return 1;
+}
+
+int test_gtidSetVersion() {
+    gtidSet *gtid_set = gtidSetNew(), *other = gtidSetNew(), *dup;
+    unsigned long long version;
+
+    assert(gtid_set->version != other->version);
+
+    version = gtid_set->version;
+    gtidSetAdd(gtid_set,"A",1,1,10);
+    assert(gtid_set->version != version);
+
+    version = gtid_set->version;
+    assert(gtidSetAdd(gtid_set,"A",1,5,6) == 0);
+    assert(gtidSetRemove(gtid_set,"B",1,1,1) == 0);
+    assert(gtidSetContains(gtid_set,"A",1,5));
+    gtidSetCount(gtid_set);
+    assert(gtid_set->version == version);
+
+    gtidSetRemove(gtid_set,"A",1,5,6);
+    assert(gtid_set->version != version);
+
+    version = gtid_set->version;
+    gtidSetAdd(other,"A",1,5,5);
+    gtidSetMerge(gtid_set,other);
+    assert(gtid_set->version != version);
+
+    version = gtid_set->version;
+    gtidSetDiff(gtid_set,other);
+    assert(gtid_set->version != version);
+
+    version = gtid_set->version;
+    gtidSetCurrentUuidSetUpdate(gtid_set,"A",1);
+    assert(gtid_set->version != version);
+    version = gtid_set->version;
+    gtidSetCurrentUuidSetNext(gtid_set,0);
+    assert(gtid_set->version == version);
+    gtidSetCurrentUuidSetNext(gtid_set,1);
+    assert(gtid_set->version != version);
+
+    version = gtid_set->version;
+    gtidSetNext(gtid_set,"A",1,1);
+    assert(gtid_set->version != version);
+
+    dup = gtidSetDup(gtid_set);
+    assert(dup->version != gtid_set->version);
+    gtidSetFree(dup);
+
+    gtidSetFree(gtid_set);
+    gtidSetFree(other);
+    return 1;
+}
+
 int test_gtidSegment() {
     gtidSegment *seg = gtidSegmentNew();
     gtidSegmentReset(seg,"A",1,1,100);
@@ -1329,6 +1457,7 @@ int test_gtidSeqAppend() {
 
 int test_gtidSeqTrim() {
     gtidSeq *seq = gtidSeqCreate();
+    gtidSeqStat stat;
 
     gtidSeqAppend(seq,"A",1,1,100);
     gtidSeqAppend(seq,"A",1,2,200);
@@ -1353,14 +1482,20 @@ int test_gtidSeqTrim() {
     gtidSeqTrim(seq,200501);
     assert(seq->nsegment == 1 && seq->nfreeseg == 2);
 
-    gtidSeqAppend(seq,"B",1,10,300100);
+    gtidSeqAppend(seq,"B",1,10,370000);
     assert(seq->nsegment == 2 && seq->nfreeseg == 1); /* reuse and reset segment. */
-    gtidSeqAppend(seq,"D",1,1,300200);
+    gtidSeqAppend(seq,"D",1,1,440000);
     assert(seq->nsegment == 3 && seq->nfreeseg == 0); /* reuse segment without reset */
 
-    gtidSeqTrim(seq,400000);
+    gtidSeqTrim(seq,500000);
     assert(seq->nsegment == 0 && seq->nfreeseg == 1);
 
+    gtidSeqGetStat(seq,&stat);
+    assert(stat.segment_memory == 0);
+    assert(stat.freeseg_memory >= sizeof(gtidSegment) + 2 +
+            sizeof(segoff_t)*GTID_SEGMENT_NGNO_DEFAULT);
+    assert(stat.used_memory >= stat.freeseg_memory + sizeof(gtidSeq));
+
     gtidSeqDestroy(seq);
     return 1;
 }
@@ -1370,8 +1505,13 @@ int test_gtidSeqXsync() {
     size_t len;
     long long offset;
     gtidSet *req, *cont;
+    const char *uuid;
+    size_t uuid_len;
+    gno_t gno;
     gtidSeq *seq = gtidSeqCreate();
 
+    assert(gtidSeqFirst(seq,&uuid,&uuid_len,&gno,&offset) == 0);
+
     gtidSeqAppend(seq,"A",1,100,100000);
     gtidSeqAppend(seq,"A",1,101,100100);
 
@@ -1430,8 +1570,14 @@ int test_gtidSeqXsync() {
     gtidSetFree(cont);
     gtidSetFree(req);
 
+    assert(gtidSeqFirst(seq,&uuid,&uuid_len,&gno,&offset) == 1);
+    assert(uuid_len == 1 && !memcmp(uuid,"A",1) && gno == 100 && offset == 100000);
+
     gtidSeqTrim(seq,300200);
 
+    assert(gtidSeqFirst(seq,&uuid,&uuid_len,&gno,&offset) == 1);
+    assert(uuid_len == 1 && !memcmp(uuid,"B",1) && gno == 102 && offset == 300200);
+
     req = gtidSetNew();
     gtidSetAdd(req,"A",1,1,50);
     gtidSetAdd(req,"B",1,1,101);
@@ -1522,6 +1668,206 @@ int test_gtidSeqPsync() {
     return 1;
 }
 
+int test_gtidSeqMixed() {
+    char buf[128], uuid[8];
+    size_t len, uuid_len;
+    const char *puuid;
+    gno_t gno;
+    long long offset;
+    gtidSet *gtid_set, *req, *cont;
+    gtidSeqStat stat;
+    gtidSeq *seq = gtidSeqCreate();
+
+    /* interleaved uuids share one mixed segment */
+    gtidSeqAppend(seq,"A",1,1,100);
+    gtidSeqAppend(seq,"B",1,1,200);
+    gtidSeqAppend(seq,"A",1,2,300);
+    gtidSeqAppend(seq,"B",1,2,400);
+    gtidSeqAppend(seq,"A",1,5,500); /* gno gap */
+    gtidSeqAppend(seq,"C",1,1,600);
+    assert(seq->nsegment == 1 && seq->lastseg->mixed);
+    assert(seq->lastseg->ngno == 6 && seq->lastseg->nuuid == 3);
+
+    len = gtidSeqEncode(buf,sizeof(buf),seq);
+    assert(len == 50 && !strncmp(buf,
+                "[A:1=100,B:1=200,A:2=300,B:2=400,A:5=500,C:1=600,]",len));
+
+    assert(gtidSeqLookup(seq,"A",1,1) == 100);
+    assert(gtidSeqLookup(seq,"A",1,2) == 300);
+    assert(gtidSeqLookup(seq,"A",1,3) == -1);
+    assert(gtidSeqLookup(seq,"A",1,5) == 500);
+    assert(gtidSeqLookup(seq,"B",1,2) == 400);
+    assert(gtidSeqLookup(seq,"C",1,1) == 600);
+    assert(gtidSeqLookup(seq,"D",1,1) == -1);
+
+    gtid_set = gtidSeqPsync(seq,0);
+    len = gtidSetEncode(buf,sizeof(buf),gtid_set);
+    assert(len == 17 && !strncmp(buf,"A:1-2:5,B:1-2,C:1",len));
+    gtidSetFree(gtid_set);
+
+    gtid_set = gtidSeqPsync(seq,350);
+    len = gtidSetEncode(buf,sizeof(buf),gtid_set);
+    assert(len == 11 && !strncmp(buf,"B:2,A:5,C:1",len));
+    gtidSetFree(gtid_set);
+
+    req = gtidSetDecode("A:1-2,B:1",9);
+    offset = gtidSeqXsync(seq,req,&cont);
+    len = gtidSetEncode(buf,sizeof(buf),cont);
+    assert(offset == 400 && len == 11 && !strncmp(buf,"B:2,A:5,C:1",len));
+    gtidSetFree(cont), gtidSetFree(req);
+
+    req = gtidSetDecode("A:1-5,B:1-2,C:1",15);
+    offset = gtidSeqXsync(seq,req,&cont);
+    assert(offset == -1 && gtidSetCount(cont) == 0);
+    gtidSetFree(cont), gtidSetFree(req);
+
+    /* mixed segment continues with previous segment */
+    gtidSeqAppend(seq,"B",1,3,100000);
+    gtidSeqAppend(seq,"B",1,4,100100);
+    assert(seq->nsegment == 2 && !seq->lastseg->mixed);
+    req = gtidSetDecode("A:1",3);
+    offset = gtidSeqXsync(seq,req,&cont);
+    len = gtidSetEncode(buf,sizeof(buf),cont);
+    assert(offset == 200 && len == 15 && !strncmp(buf,"B:1-4,A:2:5,C:1",len));
+    gtidSetFree(cont), gtidSetFree(req);
+
+    gtidSeqTrim(seq,250);
+    assert(gtidSeqFirst(seq,&puuid,&uuid_len,&gno,&offset) == 1);
+    assert(uuid_len == 1 && !memcmp(puuid,"A",1) && gno == 2 && offset == 300);
+    assert(gtidSeqLookup(seq,"A",1,1) == -1);
+    assert(gtidSeqLookup(seq,"A",1,2) == 300);
+
+    gtidSeqGetStat(seq,&stat);
+    assert(stat.segment_memory == seq->nsegment_memory);
+    gtidSeqTrim(seq,200000);
+    assert(seq->nsegment == 0);
+    gtidSeqGetStat(seq,&stat);
+    assert(stat.segment_memory == 0);
+    gtidSeqDestroy(seq);
+
+    /* long run of single uuid switches segment instead of mixing */
+    seq = gtidSeqCreate();
+    for (int i = 1; i <= GTID_SEGMENT_MIX_NGNO; i++) {
+        gtidSeqAppend(seq,"A",1,i,i*10);
+    }
+    gtidSeqAppend(seq,"B",1,1,1000);
+    assert(seq->nsegment == 2 && !seq->lastseg->mixed);
+    gtidSeqDestroy(seq);
+
+    /* uuid table full switches segment */
+    seq = gtidSeqCreate();
+    for (int i = 0; i <= GTID_SEGMENT_NUUID_MAX; i++) {
+        len = snprintf(uuid,sizeof(uuid),"U%d",i);
+        gtidSeqAppend(seq,uuid,len,1,100+i);
+    }
+    assert(seq->nsegment == 2 && seq->firstseg->nuuid == GTID_SEGMENT_NUUID_MAX);
+    assert(gtidSeqLookup(seq,"U0",2,1) == 100);
+    assert(gtidSeqLookup(seq,"U256",4,1) == 100+GTID_SEGMENT_NUUID_MAX);
+    gtidSeqDestroy(seq);
+
+    return 1;
+}
+
+typedef struct seqScanStub {
+    long long base; /* gno g of uuid A located at base+g*10 */
+    gno_t ngno;
+    int calls;
+} seqScanStub;
+
+static long long seqScanStubProc(void *privdata, long long offset,
+        const char *uuid, size_t uuid_len, gno_t gno) {
+    seqScanStub *stub = privdata;
+    stub->calls++;
+    if (uuid_len != 1 || memcmp(uuid,"A",1) || gno > stub->ngno) return -1;
+    assert(offset < stub->base+gno*10);
+    return stub->base+gno*10;
+}
+
+int test_gtidSeqSample() {
+    char buf[64];
+    size_t len;
+    const char *uuid;
+    size_t uuid_len;
+    gno_t gno;
+    long long offset;
+    gtidSet *gtid_set, *req, *cont;
+    seqScanStub stub = {100, 100, 0};
+    gtidSeq *seq = gtidSeqCreate();
+
+    gtidSeqSetSample(seq,4);
+    for (gno_t i = 1; i <= 100; i++) {
+        gtidSeqAppend(seq,"A",1,i,100+i*10);
+    }
+    /* first GTID_SEGMENT_MIX_NGNO gnos, then one in every 4 gnos */
+    assert(seq->nsegment == 1 && seq->lastseg->ngno == 100);
+    assert(seq->lastseg->sample == 4 && seq->nsegment_deltas == 64);
+
+    /* sampled gno located without scan */
+    assert(gtidSeqLookup(seq,"A",1,1) == 110);
+    assert(gtidSeqLookup(seq,"A",1,32) == 420);
+    assert(gtidSeqLookup(seq,"A",1,37) == 470);
+    assert(gtidSeqLookup(seq,"A",1,40) == -1);
+
+    gtidSeqSetScanProc(seq,seqScanStubProc,&stub);
+    assert(gtidSeqLookup(seq,"A",1,40) == 500 && stub.calls == 1);
+    assert(gtidSeqLookup(seq,"A",1,100) == 1100 && stub.calls == 2);
+
+    req = gtidSetDecode("A:1-38",6);
+    offset = gtidSeqXsync(seq,req,&cont);
+    len = gtidSetEncode(buf,sizeof(buf),cont);
+    assert(offset == 490 && len == 8 && !strncmp(buf,"A:39-100",len));
+    gtidSetFree(cont);
+
+    /* can't locate: continue from sample before */
+    gtidSeqSetScanProc(seq,NULL,NULL);
+    offset = gtidSeqXsync(seq,req,&cont);
+    len = gtidSetEncode(buf,sizeof(buf),cont);
+    assert(offset == 470 && len == 8 && !strncmp(buf,"A:37-100",len));
+    gtidSetFree(cont), gtidSetFree(req);
+
+    /* can't tell gnos between samples: psync can't be converted */
+    assert(gtidSeqPsync(seq,485) == NULL);
+    gtid_set = gtidSeqPsync(seq,470);
+    len = gtidSetEncode(buf,sizeof(buf),gtid_set);
+    assert(len == 8 && !strncmp(buf,"A:37-100",len));
+    gtidSetFree(gtid_set);
+
+    gtidSeqSetScanProc(seq,seqScanStubProc,&stub);
+    stub.calls = 0;
+    gtid_set = gtidSeqPsync(seq,485);
+    len = gtidSetEncode(buf,sizeof(buf),gtid_set);
+    assert(len == 8 && !strncmp(buf,"A:39-100",len) && stub.calls == 2);
+    gtidSetFree(gtid_set);
+
+    char *ebuf = malloc(gtidSeqEstimatedEncodeBufferSize(seq));
+    len = gtidSeqEncode(ebuf,gtidSeqEstimatedEncodeBufferSize(seq),seq);
+    assert(!strncmp(ebuf,"A:[1=110,2=120,",15));
+    assert(!strncmp(ebuf+len-17,"93=1030,97=1070,]",17));
+    free(ebuf);
+
+    /* trim to the first sample at or after until */
+    gtidSeqTrim(seq,485);
+    assert(gtidSeqFirst(seq,&uuid,&uuid_len,&gno,&offset) == 1);
+    assert(gno == 41 && offset == 510);
+
+    /* gnos after last sample are trimmed along with it */
+    gtidSeqTrim(seq,1075);
+    assert(seq->nsegment == 0);
+    gtidSeqDestroy(seq);
+
+    /* sampled segment can still be mixed while short */
+    seq = gtidSeqCreate();
+    gtidSeqSetSample(seq,4);
+    gtidSeqAppend(seq,"A",1,1,100);
+    gtidSeqAppend(seq,"B",1,1,200);
+    gtidSeqAppend(seq,"A",1,2,300);
+    assert(seq->nsegment == 1 && seq->lastseg->mixed);
+    assert(gtidSeqLookup(seq,"A",1,2) == 300);
+    gtidSeqDestroy(seq);
+
+    return 1;
+}
+
 int test_uuidSetIteratorNext() {
     /* single interval */
     uuidSet *us1 = uuidSetNew("uuid-1", 6);
@@ -2608,6 +2954,10 @@ int test_api(void) {
             test_gtidStat() == 1);
         test_cond("gtidSetDiff function ",
             test_gtidSetDiff() == 1);
+        test_cond("gtidSetDiffCount function",
+            test_gtidSetDiffCount() == 1);
+        test_cond("gtidSet version",
+            test_gtidSetVersion() == 1);
         test_cond("gtidSegment",
             test_gtidSegment() == 1);
         test_cond("gtidSeqAppend function",
@@ -2618,6 +2968,10 @@ int test_api(void) {
             test_gtidSeqXsync() == 1);
         test_cond("gtidSeqPsync function",
             test_gtidSeqPsync() == 1);
+        test_cond("gtidSeq mixed segment",
+            test_gtidSeqMixed() == 1);
+        test_cond("gtidSeq sampled segment",
+            test_gtidSeqSample() == 1);
         test_cond("gtidSetIteratorNext function",
             test_gtidSetIteratorNext() == 1);
         test_cond("uuidSetIteratorNext function",
@@ -50,6 +50,7 @@ typedef struct gtidIntervalSkipList {
     struct gtidIntervalNode *tail;
     size_t node_count;
     gno_t gno_count;
+    size_t used_memory; /* allocated size of skiplist, header and nodes */
     int level;
 } gtidIntervalSkipList;
 
@@ -66,6 +67,10 @@ typedef struct uuidSetIterator {
 } uuidSetIterator;
 
 typedef struct gtidSet {
+    /* changed (from a process wide clock) whenever gtidSet api modifies the
+     * set, so two sets never share a version. Note that modifying uuidSets
+     * of gtidSet directly does not change version. */
+    unsigned long long version;
     /* next gno for current if > 0 */
     gno_t curnext;
     struct uuidSet *current;
@@ -102,6 +107,7 @@ gno_t uuidSetAdd(uuidSet* uuid_set, gno_t start, gno_t end);
 gno_t uuidSetRemove(uuidSet* uuid_set, gno_t start, gno_t end);
 gno_t uuidSetMerge(uuidSet* uuid_set, uuidSet* other);
 gno_t uuidSetDiff(uuidSet* uuid_set, uuidSet* other);
+gno_t uuidSetDiffCount(uuidSet* uuid_set, uuidSet* other);
 gno_t uuidSetNext(uuidSet* uuid_set, int update);
 gno_t uuidSetCount(uuidSet* uuid_set);
 int uuidSetContains(uuidSet* uuid_set, gno_t gno);
@@ -121,6 +127,7 @@ gno_t gtidSetAdd(gtidSet* gtid_set, const char* uuid, size_t uuid_len, gno_t sta
 gno_t gtidSetRemove(gtidSet *gtid_set, const char* uuid, size_t uuid_len, gno_t start, gno_t end);
 gno_t gtidSetMerge(gtidSet* gtid_set, gtidSet* other);
 gno_t gtidSetDiff(gtidSet* gtid_set, gtidSet* other);
+gno_t gtidSetDiffCount(gtidSet* gtid_set, gtidSet* other);
 gno_t gtidSetNext(gtidSet* gtid_set, const char* uuid, size_t uuid_len, int upate);
 gno_t gtidSetCount(gtidSet *gtid_set);
 int gtidSetEqual(gtidSet *set1, gtidSet *set2);
@@ -133,6 +140,7 @@ int gtidSetInitIterator(gtidSetIterator* iterator, gtidSet* gtid_set);
 void gtidSetDeinitIterator(gtidSetIterator* iterator);
 uuidSet* gtidSetIteratorNext(gtidSetIterator* iterator);
 int gtidSetIteratorSeek(gtidSetIterator* iterator, const char* uuid, size_t uuid_len);
+void gtidSetTouch(gtidSet *gtid_set);
 
 
 /* Cache current uuid set to skip uuid compare. Note that it would crash
@@ -147,12 +155,14 @@ static inline void gtidSetCurrentUuidSetSetNextGno(gtidSet *gtid_set, gno_t curn
 static inline gno_t gtidSetCurrentUuidSetNext(gtidSet *gtid_set, int update) {
   gtid_set->cached = gtid_set->current;
   if (gtid_set->curnext == 0) {
+    if (update) gtidSetTouch(gtid_set);
     return uuidSetNext(gtid_set->current, update);
   } else {
     gno_t curnext = gtid_set->curnext;
     if (update) {
       uuidSetAdd(gtid_set->current,curnext,curnext);
       gtid_set->curnext = 0;
+      gtidSetTouch(gtid_set);
     }
     return curnext;
   }
@@ -166,6 +176,31 @@ typedef uint16_t segoff_t;
 #define GTID_ESTIMATED_CMD_SIZE 1024
 #define GTID_SEGMENT_NGNO_DEFAULT (SEGMENT_SIZE/GTID_ESTIMATED_CMD_SIZE)
 
+/* Plain segment runs of fewer gnos than this are converted to mixed segment
+ * on uuid switch or gno gap, instead of switching to a new segment. */
+#define GTID_SEGMENT_MIX_NGNO 32
+#define GTID_SEGMENT_NUUID_MAX (UINT8_MAX+1)
+#define GTID_SEGMENT_NUUID_DEFAULT 4
+
+typedef uint8_t seguuid_t;
+typedef int32_t seggno_t;
+
+#define SEGGNO_MIN INT32_MIN
+#define SEGGNO_MAX INT32_MAX
+
+typedef struct gtidSegmentUuid {
+    char *uuid;
+    size_t uuid_len;
+    gno_t base_gno; /* gno deltas of this uuid are relative to base_gno */
+    gno_t start_gno; /* min gno of this uuid in segment (inclusive) */
+    gno_t end_gno; /* max gno of this uuid in segment (inclusive) */
+} gtidSegmentUuid;
+
+/* A plain segment indexes consecutive gnos of one uuid, a mixed segment
+ * indexes gtids of interleaved uuids (or gnos with gaps): each entry keeps
+ * uuid id and gno delta alongside offset delta. A sampled plain segment
+ * keeps offsets of the first GTID_SEGMENT_MIX_NGNO gnos (so that it can still
+ * be mixed) and then of one in every sample gnos only. */
 typedef struct gtidSegment {
     struct gtidSegment *next;
     struct gtidSegment *prev;
@@ -177,19 +212,42 @@ typedef struct gtidSegment {
     size_t ngno; /* gno count */
     size_t capacity; /* gno capacity */
     segoff_t *deltas;
+    int mixed;
+    size_t nuuid; /* uuid count of mixed segment */
+    size_t uuid_capacity;
+    gtidSegmentUuid *uuids; /* uuid table of mixed segment */
+    seguuid_t *uuid_ids; /* index of uuids, mixed segment only */
+    seggno_t *gno_deltas; /* gno - uuids[uuid_id].base_gno, mixed segment only */
+    size_t sample; /* deltas keep offset of one in every sample gnos */
 } gtidSegment;
 
 gtidSegment *gtidSegmentNew();
 void gtidSegmentReset(gtidSegment *seg, const char *uuid, size_t uuid_len, gno_t base_gno, long long base_offset);
 void gtidSegmentAppend(gtidSegment *seg, long long offset);
+void gtidSegmentMix(gtidSegment *seg);
+int gtidSegmentAppendMixed(gtidSegment *seg, const char *uuid, size_t uuid_len, gno_t gno, long long offset);
+void gtidSegmentGet(gtidSegment *seg, size_t idx, const char **uuid, size_t *uuid_len, gno_t *gno, long long *offset);
+void gtidSegmentAddToGtidSet(gtidSegment *seg, size_t from, gtidSet *gtid_set);
 void gtidSegmentFree(gtidSegment *seg);
 
+/* Locate offset of gtid uuid:gno by scanning forward from offset of a
+ * sampled gtid, returns -1 if not found. */
+typedef long long (*gtidSeqScanProc)(void *privdata, long long offset,
+        const char *uuid, size_t uuid_len, gno_t gno);
+
+#define GTID_SEQ_SAMPLE_DEFAULT 1
+
 typedef struct gtidSeq {
     size_t segment_size;
+    size_t sample; /* sample of new segments, 1 indexes every gno */
+    gtidSeqScanProc scan; /* refine offset between samples */
+    void *scan_privdata;
     size_t nsegment;
     size_t nfreeseg;
     size_t nsegment_deltas;
     size_t nfreeseg_deltas;
+    size_t nsegment_memory; /* allocated size of occupied segments */
+    size_t nfreeseg_memory; /* allocated size of vacant segments */
     struct gtidSegment *firstseg; /* head of occupied segment list */
     struct gtidSegment *lastseg; /* tail of occupied segment list */
     struct gtidSegment *freeseg; /* head of vacant segment list */
@@ -204,11 +262,14 @@ typedef struct gtidSeqStat {
 gtidSeq *gtidSeqCreate();
 void gtidSeqRebaseOffset(gtidSeq *seq, size_t offset);
 void gtidSeqDestroy(gtidSeq *seq);
+void gtidSeqSetSample(gtidSeq *seq, size_t sample);
+void gtidSeqSetScanProc(gtidSeq *seq, gtidSeqScanProc scan, void *privdata);
 void gtidSeqAppend(gtidSeq *seq, const char *uuid, size_t uuid_len, gno_t gno, long long offset);
 void gtidSeqTrim(gtidSeq *seq, long long until);
 size_t gtidSeqEstimatedEncodeBufferSize(gtidSeq* seq);
 ssize_t gtidSeqEncode(char *buf, size_t maxlen, gtidSeq* seq);
 long long gtidSeqLookup(gtidSeq *seq, char* uuid, size_t uuid_len, gno_t gno);
+int gtidSeqFirst(gtidSeq *seq, const char **uuid, size_t *uuid_len, gno_t *gno, long long *offset);
 long long gtidSeqXsync(gtidSeq *seq, gtidSet *req, gtidSet **pcont);
 gtidSet *gtidSeqPsync(gtidSeq *seq, long long offset);
 void gtidSeqGetStat(gtidSeq *seq, gtidSeqStat *stat);
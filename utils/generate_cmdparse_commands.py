@@ -24,6 +24,38 @@ def load_commands(commands_dir):
     return commands
 
 
+def generate_lookup(commands):
+    """Emit a case-insensitive lookup switching on name length and first
+    char, so that resolving a parser needs no hashing and no allocation."""
+    groups = {}
+    for idx, cmd in enumerate(commands):
+        name = cmd["name"].lower()
+        groups.setdefault(len(name), {}).setdefault(name[0], []).append((name, idx))
+
+    lines = [
+        "static cmdParseCommandDef *cmdParseLookupCommand(const char *name, size_t len) {",
+        "    switch (len) {",
+    ]
+    for length in sorted(groups):
+        lines.append("    case {0}:".format(length))
+        lines.append("        switch (tolower((unsigned char)name[0])) {")
+        for first in sorted(groups[length]):
+            lines.append("        case '{0}':".format(first))
+            for name, idx in groups[length][first]:
+                lines.append('            if (!strncasecmp(name, "{0}", {1})) return &cmd_parse_commands[{2}];'
+                             .format(name, length, idx))
+            lines.append("            break;")
+        lines.append("        }")
+        lines.append("        break;")
+    lines.extend([
+        "    }",
+        "    return NULL;",
+        "}",
+        "",
+    ])
+    return lines
+
+
 def generate_command_def(output_path, commands):
     lines = [
         "/* ================================================================",
@@ -42,6 +74,7 @@ def generate_command_def(output_path, commands):
         "};",
         "",
     ])
+    lines.extend(generate_lookup(commands))
 
     content = "\n".join(lines) + "\n"
 
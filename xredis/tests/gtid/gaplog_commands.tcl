@@ -369,4 +369,127 @@ start_server {tags {"gaplog"} overrides {gtid-enabled yes gtid-gaplog-enabled ye
             assert_equal [$S GTIDX GAPLOG DELETERANGE "NO_UUID" $mg [expr {$mg+4}]] 0
         }
     }
-}
\ No newline at end of file
+}
+start_server {tags {"gaplog"} overrides {gtid-enabled yes gtid-gaplog-enabled yes}} {
+    test "GAPLOG-KEY-001: GAPLOG KEY - empty gaplog returns empty array" {
+        r GTIDX GAPLOG CLEAR
+        assert_equal [r GTIDX GAPLOG KEY 0 "nokey"] {}
+    }
+
+    test "GAPLOG-KEY-002: GAPLOG KEY - invalid db and keyindex off" {
+        catch {r GTIDX GAPLOG KEY "abc" "k"} err
+        assert_match "*integer*" $err
+        catch {r GTIDX GAPLOG KEY -1 "k"} err
+        assert_match "*invalid db index*" $err
+        assert_equal [r GTIDX GAPLOG KEYINDEX OFF] "OK"
+        catch {r GTIDX GAPLOG KEY 0 "k"} err
+        assert_match "*key index disabled*" $err
+        assert_equal [r GTIDX GAPLOG KEYINDEX ON] "OK"
+        assert_equal [r GTIDX GAPLOG KEY 0 "k"] {}
+    }
+}
+
+start_server {tags {"gaplog"} overrides {gtid-enabled yes gtid-gaplog-enabled yes gtid-xsync-max-gap 10000}} {
+    start_server {overrides {gtid-enabled yes gtid-gaplog-enabled yes gtid-xsync-max-gap 10000}} {
+        set M [srv -1 client]; set Mh [srv -1 host]; set Mp [srv -1 port]; set S [srv 0 client]
+        test "GAPLOG-KEY-003: key index follows insert and deleterange" {
+            $S replicaof $Mh $Mp; wait_for_sync $S
+            $M set m_b m_v; wait_for_ofs_sync $S $M
+            $S replicaof no one; after 100
+            $S set hot v1; $S set cold v1; $S set hot v2
+            set su [get_uuid $S]; replicaof_xcontinue $S $Mh $Mp
+            set hot [$S GTIDX GAPLOG KEY 0 hot]
+            assert_equal [llength $hot] 2
+            assert_equal [lindex [lindex $hot 0] 0] $su
+            assert_equal [llength [$S GTIDX GAPLOG KEY 0 cold]] 1
+            assert_equal [$S GTIDX GAPLOG KEY 1 hot] {}
+
+            set g [lindex [lindex $hot 0] 1]
+            assert_equal [$S GTIDX GAPLOG DELETERANGE $su $g $g] 1
+            assert_equal [llength [$S GTIDX GAPLOG KEY 0 hot]] 1
+        }
+    }
+}
+
+start_server {tags {"gaplog"} overrides {gtid-enabled yes gtid-gaplog-enabled yes gtid-xsync-max-gap 100000}} {
+    start_server {overrides {gtid-enabled yes gtid-gaplog-enabled yes gtid-xsync-max-gap 100000}} {
+        set M [srv -1 client]; set Mh [srv -1 host]; set Mp [srv -1 port]; set S [srv 0 client]
+        test "GAPLOG-BUILD-001: large gap is built incrementally" {
+            $S config set repl-backlog-size 64mb
+            $S replicaof $Mh $Mp; wait_for_sync $S
+            $M set m_b m_v; wait_for_ofs_sync $S $M
+            $S replicaof no one; after 100
+            for {set i 1} {$i <= 50000} {incr i} { $S set "b_${i}" "v${i}" }
+            replicaof_xcontinue $S $Mh $Mp
+            assert_equal [gaploglen $S] 50000
+            set info [$S info gtid]
+            assert_match "*gtid_gaplog_build_progress:50000/50000*" $info
+            assert_match "*gtid_gaplog_state:ready*" $info
+            assert_match "*gtid_gaplog_build_missed:0*" $info
+            regexp {gtid_gaplog_build_slices:([0-9]+)} $info -> slices
+            assert {$slices > 1}
+        }
+    }
+}
+
+start_server {tags {"gaplog"} overrides {gtid-enabled yes gtid-gaplog-enabled yes gtid-xsync-max-gap 100000}} {
+    start_server {overrides {gtid-enabled yes gtid-gaplog-enabled yes gtid-xsync-max-gap 100000}} {
+        set M [srv -1 client]; set Mh [srv -1 host]; set Mp [srv -1 port]; set S [srv 0 client]
+        test "GAPLOG-BUILD-002: gnos trimmed from backlog degrade the build" {
+            $S config set repl-backlog-size 16kb
+            $S replicaof $Mh $Mp; wait_for_sync $S
+            $M set m_b m_v; wait_for_ofs_sync $S $M
+            $S replicaof no one; after 100
+            set val [string repeat x 100]
+            for {set i 1} {$i <= 2000} {incr i} { $S set "d_${i}" $val }
+            set o [get_xsync_continue_stat $S]
+            $S replicaof $Mh $Mp; wait_for_sync $S
+            wait_xsync_continue_stat $S $o
+            wait_for_condition 100 50 { [get_gaplog_state $S] ne "building" } else {
+                fail "gaplog build not finished"
+            }
+            set info [$S info gtid]
+            assert_match "*gtid_gaplog_state:degraded*" $info
+            regexp {gtid_gaplog_build_missed:([0-9]+)} $info -> missed
+            regexp {gtid_gaplog_build_progress:([0-9]+)/([0-9]+)} $info -> filled total
+            assert {$missed > 0}
+            assert_equal [expr {$filled + $missed}] $total
+            assert_error "*degraded*" {$S GTIDX GAPLOG RANGE [get_uuid $S] 1 10}
+
+            assert_equal [$S GTIDX GAPLOG CLEAR] OK
+            assert_equal [get_gaplog_state $S] ready
+        }
+    }
+}
+
+start_server {tags {"gaplog"} overrides {gtid-enabled yes gtid-gaplog-enabled yes gtid-xsync-max-gap 10000}} {
+    start_server {overrides {gtid-enabled yes gtid-gaplog-enabled yes gtid-xsync-max-gap 10000}} {
+        set M [srv -1 client]; set Mh [srv -1 host]; set Mp [srv -1 port]; set S [srv 0 client]
+        test "GAPLOG-EXTRA-001: range writes record touched sub-range" {
+            $S replicaof $Mh $Mp; wait_for_sync $S
+            $M set m_b m_v; wait_for_ofs_sync $S $M
+            $S replicaof no one; after 100
+            $S rpush l a b c d
+            $S ltrim l 1 -2
+            $S setbit bm 100 1
+            $S set s hello
+            $S setrange s 1 XY
+            set su [get_uuid $S]; replicaof_xcontinue $S $Mh $Mp
+
+            set extras {}
+            set types {}
+            foreach entry [$S GTIDX GAPLOG LIST 0 [gaploglen $S]] {
+                foreach k [lindex $entry 2] {
+                    if {[llength $k] == 5} { lappend extras [lindex $k 4] }
+                    dict set types [lindex $k 2] [lindex $k 1]
+                }
+            }
+            assert {[lsearch -exact $extras {range 1 -2 0 1}] >= 0}
+            assert {[lsearch -exact $extras {bitoff 100}] >= 0}
+            assert {[lsearch -exact $extras {bitrng 8 23}] >= 0}
+            assert_equal [dict get $types l] list
+            assert_equal [dict get $types bm] string
+            assert_equal [dict get $types s] string
+        }
+    }
+}
@@ -304,6 +304,68 @@ start_server {tags {"gtid"} overrides {gtid-enabled yes}} {
         assert_match "*gtid command already executed*" $reply
     }
 
+    test "gtid executed run flushed before read" {
+        set flushes [s gtid_executed_flushes]
+        r gtid B:1 $::target_db set k1 v1
+        r gtid B:2 $::target_db set k2 v2
+        r gtid B:3 $::target_db set k3 v3
+        catch {r gtid B:2 $::target_db set k2 v2} reply
+        assert_match "*gtid command already executed*" $reply
+        assert_match "*B:1-3*" [s gtid_executed]
+        assert {[s gtid_executed_flushes] > $flushes}
+    }
+
+    test "gtid info maxlen truncates gtid set reprs" {
+        for {set i 1} {$i <= 100} {incr i 2} {
+            r gtidx add executed C $i $i
+        }
+        set full [r gtidx list executed]
+        assert_match "*C:99*" [s gtid_executed]
+
+        r gtidx info maxlen 64
+        assert_equal 64 [r gtidx info maxlen]
+        set repr [s gtid_executed]
+        assert_match "*..." $repr
+        assert {[string length $repr] < [string length $full]}
+        assert_equal $full [r gtidx list executed]
+
+        r gtidx add executed C 200 200
+        assert_match "*..." [s gtid_executed]
+
+        r gtidx info maxlen 0
+        assert_match "*C:*:99:200*" [s gtid_executed]
+    }
+
+    test "gtidx latency tracks gtid command" {
+        assert_equal OK [r gtidx latency reset]
+        assert_match "calls=0,*" [s gtid_latency_gtid_command]
+        r gtid L:1 $::target_db set k1 v1
+        r gtid L:2 $::target_db set k2 v2
+        assert_match "calls=2,*" [s gtid_latency_gtid_command]
+        set found 0
+        foreach hist [r gtidx latency] {
+            if {[dict get $hist type] eq "gtid_command"} {
+                assert_equal 2 [dict get $hist calls]
+                set found 1
+            }
+        }
+        assert_equal 1 $found
+    }
+
+    test "gtid used memory accounts gtid state" {
+        set before [s gtid_executed_used_memory]
+        for {set i 1} {$i < 200} {incr i 2} {
+            r gtidx add executed M $i $i
+        }
+        assert {[s gtid_executed_used_memory] > $before}
+        set total [expr {[s gtid_executed_used_memory] + [s gtid_lost_used_memory] +
+                [s gtid_seq_used_memory] + [s gtid_gaplog_used_memory] +
+                [s gtid_cmdparse_used_memory]}]
+        assert_equal $total [s gtid_used_memory]
+        r gtidx remove executed M 1 200
+        assert_equal $before [s gtid_executed_used_memory]
+    }
+
 }
 
 start_server {tags {"gtid"} overrides} {
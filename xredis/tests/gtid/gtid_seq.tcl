@@ -88,3 +88,26 @@ start_server {tags {"gtid-seq"} overrides {gtid-enabled yes}} {
     }
 }
 }
+
+start_server {tags {"gtid-seq"} overrides {gtid-enabled yes gtid-seq-sample 8}} {
+    set master [srv 0 client]
+
+    test "sampled gtid seq locates gno between samples" {
+        for {set i 1} {$i <= 100} {incr i} {
+            $master GTID B:$i 0 SET key val$i
+        }
+        assert_match {*B:1-100*} [$master GTIDX seq gtid.set]
+
+        # B:50 is not sampled, located by scanning backlog from B:49
+        set reply [$master GTIDX seq locate B:1-49 64]
+        assert {[lindex $reply 0] >= 0}
+        assert_match {*B:50-100*} [lindex $reply 1]
+        assert_match {*B:50*} [lindex $reply 2]
+        assert_no_match {*B:49*} [lindex $reply 2]
+
+        # sampled B:41 located without scan
+        set reply [$master GTIDX seq locate B:1-40 64]
+        assert_match {*B:41-100*} [lindex $reply 1]
+        assert_match {*B:41*} [lindex $reply 2]
+    }
+}
@@ -206,3 +206,106 @@ start_server {overrides {gtid-enabled yes}} {
     }
 }
 }
+
+start_server {tags {"gtid replication"} overrides {gtid-enabled yes}} {
+    start_server {overrides {gtid-enabled yes}} {
+        set M [srv -1 client]
+        set M_host [srv -1 host]
+        set M_port [srv -1 port]
+        set S [srv 0 client]
+
+        $S replicaof $M_host $M_port
+        wait_for_sync $S
+
+        test "WAITGTID returns once replica executed gtid" {
+            $M set k v
+            set uuid [status $M gtid_uuid]
+            set gno [status $M gtid_executed_gno_count]
+            assert_equal 1 [$M waitgtid $uuid:$gno 1 5000]
+            assert_match "*uuid=$uuid,gno=$gno,lag=0*" [status $M gtid_replica0]
+        }
+
+        test "WAITGTID times out with replicas acked" {
+            set start [clock milliseconds]
+            assert_equal 0 [$M waitgtid [status $M gtid_uuid]:100000 1 200]
+            assert {[clock milliseconds] - $start >= 200}
+            assert_equal 1 [$M waitgtid [status $M gtid_uuid]:1 1 200]
+        }
+
+        test "WAITGTID not allowed on replica" {
+            assert_error "*replica*" {$S waitgtid [status $M gtid_uuid]:1 1 0}
+        }
+    }
+}
+
+start_server {tags {"gtid replication"} overrides {gtid-enabled yes}} {
+    start_server {overrides {gtid-enabled yes}} {
+        set M [srv -1 client]
+        set M_host [srv -1 host]
+        set M_port [srv -1 port]
+        set S [srv 0 client]
+
+        $S replicaof $M_host $M_port
+        wait_for_sync $S
+
+        test "GTIDX LAST returns gtid of latest write when tracking" {
+            assert_error "*tracking is off*" {$M gtidx last}
+            assert_equal OK [$M gtidx tracking on]
+            assert_equal {} [$M gtidx last]
+            $M set k v
+            set uuid [status $M gtid_uuid]
+            set gno [status $M gtid_executed_gno_count]
+            assert_equal $uuid:$gno [$M gtidx last]
+            $M get k
+            assert_equal $uuid:$gno [$M gtidx last]
+            $M multi
+            $M set k v1
+            $M incr n
+            $M exec
+            assert_equal $uuid:[expr $gno+1] [$M gtidx last]
+            assert_equal OK [$M gtidx tracking off]
+        }
+
+        test "GTIDX WAITFOR returns once gtid executed on replica" {
+            $M gtidx tracking on
+            $M set k v2
+            set gtid [$M gtidx last]
+            assert_equal 1 [$S gtidx waitfor $gtid 5000]
+            assert_equal v2 [$S get k]
+            assert_equal 0 [$S gtidx waitfor [status $M gtid_uuid]:100000 100]
+
+            set rd [redis_deferring_client]
+            $rd gtidx waitfor [status $M gtid_uuid]:[expr [lindex [split $gtid :] 1]+1] 0
+            wait_for_blocked_clients_count 1 100 10
+            $M set k v3
+            assert_equal 1 [$rd read]
+            $rd close
+        }
+
+        test "GTIDX WAITFOR unblocked by CLIENT UNBLOCK never replies later" {
+            set rd [redis_deferring_client]
+            $rd client id
+            set id [$rd read]
+            set gno [status $M gtid_executed_gno_count]
+            $rd gtidx waitfor [status $M gtid_uuid]:[expr $gno+1] 0
+            wait_for_blocked_clients_count 1 100 10
+            assert_equal 1 [$S client unblock $id]
+            assert_equal 0 [$rd read]
+
+            # blocked again by pipelined command, gtid executed must not
+            # reply (and unblock) it
+            $rd blpop gtid-waitfor-list 0
+            wait_for_blocked_clients_count 1 100 10
+            $M set k v4
+            wait_for_condition 50 100 {
+                [status $S gtid_executed_gno_count] > $gno
+            } else {
+                fail "gtid not executed on replica"
+            }
+            assert_equal 1 [s blocked_clients]
+            $M rpush gtid-waitfor-list a
+            assert_equal {gtid-waitfor-list a} [$rd read]
+            $rd close
+        }
+    }
+}
@@ -1634,4 +1634,98 @@ start_server {tags {"xsync"} overrides {gtid-enabled yes}} {
         }
         
     }
-}
\ No newline at end of file
+}
+
+start_server {tags {"xsync"} overrides {gtid-enabled yes appendonly yes appendfsync always}} {
+    start_server {overrides {gtid-enabled yes}} {
+        set M [srv -1 client]
+        set M_host [srv -1 host]
+        set M_port [srv -1 port]
+        set S [srv 0 client]
+
+        $S replicaof $M_host $M_port
+        wait_for_sync $S
+        wait_for_gtid_sync $M $S
+
+        test "xsync continues from aof when backlog exhausted" {
+            $M config set repl-backlog-size 16384
+            $M config set gtid-xsync-aof-max-bytes 1mb
+            $S replicaof 127.0.0.1 1
+
+            set val [string repeat x 100]
+            for {set i 0} {$i < 2000} {incr i} {
+                $M set key-$i $val
+            }
+
+            $S replicaof $M_host $M_port
+            wait_for_sync $S
+            wait_for_gtid_sync $M $S
+
+            assert_match {*transfers=1,*} [status $M gtid_aof_index]
+            assert_equal [$M dbsize] [$S dbsize]
+            assert_equal $val [$S get key-0]
+        }
+
+        test "xsync fullresync when aof exceeds gtid-xsync-aof-max-bytes" {
+            $S replicaof 127.0.0.1 1
+            set val [string repeat y 100]
+            for {set i 0} {$i < 2000} {incr i} {
+                $M set key-$i $val
+            }
+
+            $M config set gtid-xsync-aof-max-bytes 16384
+            set orig_sync_full [status $M sync_full]
+            $S replicaof $M_host $M_port
+            wait_for_sync $S
+            wait_for_gtid_sync $M $S
+
+            assert_equal [expr $orig_sync_full+1] [status $M sync_full]
+            assert_match {*transfers=1,*} [status $M gtid_aof_index]
+            assert_equal $val [$S get key-0]
+            $M config set gtid-xsync-aof-max-bytes 0
+        }
+    }
+}
+
+start_server {tags {"xsync"} overrides {gtid-enabled no repl-backlog-size 100mb}} {
+    start_server {overrides {gtid-enabled no}} {
+        set M [srv -1 client]
+        set M_host [srv -1 host]
+        set M_port [srv -1 port]
+        set S [srv 0 client]
+
+        # master: | (P) ~40mb | (X) |, slow client psync from start of (P)
+        test "limited continue in flight released with backlog" {
+            $S replicaof $M_host $M_port
+            wait_for_sync $S
+            wait_for_ofs_sync $M $S
+            $S replicaof no one
+
+            set replid [status $M master_replid]
+            set offset [expr {[status $M master_repl_offset]+1}]
+            set val [string repeat x 10240]
+            for {set i 0} {$i < 4000} {incr i} {
+                $M set key-$i $val
+            }
+            $M config set gtid-enabled yes
+            assert_equal [status $M gtid_repl_mode] xsync
+
+            # never read, so the limited range stays in flight
+            set orig_log_lines [count_log_lines -1]
+            set rd [redis_deferring_client -1]
+            $rd psync $replid $offset
+            wait_for_log_messages -1 {"*Sending * bytes of backlog starting from offset*"} $orig_log_lines 50 100
+
+            $M config set repl-backlog-ttl 1
+            wait_for_condition 50 100 {
+                [status $M repl_backlog_active] == 0
+            } else {
+                fail "backlog not freed"
+            }
+            assert_equal PONG [$M ping]
+            $rd close
+            $M config set repl-backlog-ttl 3600
+            $M config set gtid-enabled no
+        }
+    }
+}
@@ -145,9 +145,23 @@ proc wait_xsync_continue_stat {S o} {
         fail "xcontinue not inc"
     }
 }
+proc get_gaplog_state {client} {
+    set info [$client INFO gtid]
+    if {[regexp {gtid_gaplog_state:([a-z]+)} $info -> state]} {
+        return $state
+    }
+    return "ready"
+}
+
+proc wait_gaplog_ready {S} {
+    wait_for_condition 100 50 { [get_gaplog_state $S] eq "ready" } else {
+        fail "gaplog build not finished"
+    }
+}
 proc replicaof_xcontinue {S Mh Mp} {
     set o [get_xsync_continue_stat $S]; $S replicaof $Mh $Mp; wait_for_sync $S
     wait_xsync_continue_stat $S $o; after 200
+    wait_gaplog_ready $S
 }
 
 proc gaploglen {c} { return [$c GTIDX GAPLOG LEN] }
\ No newline at end of file
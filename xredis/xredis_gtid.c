@@ -76,10 +76,181 @@ sds gtidSetQuoteIfEmpty(sds gtid_repr) {
     else return gtid_repr;
 }
 
+/* Apply side accumulator of gtid_executed: replica streams are mostly
+ * consecutive gnos of one master uuid, so applied gnos are collected into a
+ * pending run and merged into gtid_executed by ctrip_beforeSleep, or before
+ * anyone reads gtid_executed (see serverGtidExecutedFlush). */
+static struct {
+    char uuid[CONFIG_RUN_ID_SIZE+1];
+    size_t uuid_len;
+    gno_t start, end; /* start == 0: no pending run */
+    long long flush_count;
+    long long batched_count;
+} gtid_executed_pending;
+
+void serverGtidExecutedFlush(void) {
+    if (gtid_executed_pending.start == 0) return;
+    serverAssert(gtidSetAdd(server.gtid_executed, gtid_executed_pending.uuid,
+                gtid_executed_pending.uuid_len, gtid_executed_pending.start,
+                gtid_executed_pending.end));
+    gtid_executed_pending.start = gtid_executed_pending.end = 0;
+    gtid_executed_pending.flush_count++;
+}
+
+static void serverGtidExecutedAdd(const char *uuid, size_t uuid_len, gno_t gno) {
+    if (gtid_executed_pending.start != 0 &&
+            gtid_executed_pending.uuid_len == uuid_len &&
+            gno == gtid_executed_pending.end+1 &&
+            memcmp(gtid_executed_pending.uuid, uuid, uuid_len) == 0) {
+        gtid_executed_pending.end = gno;
+        gtid_executed_pending.batched_count++;
+    } else {
+        serverGtidExecutedFlush();
+        if (uuid_len > CONFIG_RUN_ID_SIZE) {
+            serverAssert(gtidSetAdd(server.gtid_executed, uuid, uuid_len, gno, gno));
+        } else {
+            memcpy(gtid_executed_pending.uuid, uuid, uuid_len);
+            gtid_executed_pending.uuid_len = uuid_len;
+            gtid_executed_pending.start = gtid_executed_pending.end = gno;
+        }
+    }
+    gtidWaitersNotifyExecuted();
+}
+
+/* Called by host in beforeSleep. */
+void ctrip_beforeSleep(void) {
+    serverGtidExecutedFlush();
+    gtidWaitersBeforeSleep();
+}
+
+/* uuid of the latest executed gtid, falls back to master uuid. */
+const char *serverGtidExecutedLastUuid(size_t *puuid_len) {
+    if (gtid_executed_pending.uuid_len == 0) return getMasterUuid(puuid_len);
+    *puuid_len = gtid_executed_pending.uuid_len;
+    return gtid_executed_pending.uuid;
+}
+
+/* Highest gno of uuid that all gnos up to it are executed or lost, 0 if
+ * the very first gno is neither. */
+gno_t serverGtidSetWatermark(const char *uuid, size_t uuid_len) {
+    gtidSet *gtid_sets[2] = {server.gtid_executed, server.gtid_lost};
+    gno_t watermark = 0;
+    int extended = 1;
+
+    serverGtidExecutedFlush();
+    while (extended) {
+        extended = 0;
+        for (int i = 0; i < 2; i++) {
+            uuidSet *uuid_set = gtidSetFind(gtid_sets[i],uuid,uuid_len);
+            uuidSetIterator iter;
+            gtidIntervalNode *node;
+
+            if (uuid_set == NULL) continue;
+            uuidSetInitIterator(&iter,uuid_set);
+            if (uuidSetIteratorSeek(&iter,watermark+1) &&
+                    (node = uuidSetIteratorNext(&iter)) != NULL &&
+                    node->start <= watermark+1 && node->end > watermark) {
+                watermark = node->end;
+                extended = 1;
+            }
+            uuidSetDeinitIterator(&iter);
+        }
+    }
+    return watermark;
+}
+
+/* Session gtid tracking: clients opted in by GTIDX TRACKING ON are flagged
+ * CLIENT_GTID_TRACKING and remember gtid assigned to their latest write,
+ * which is returned by GTIDX LAST. Entries are keyed by client and dropped
+ * as soon as tracking is turned off or client is freed. */
+static uint64_t gtidTrackingHash(const void *key) {
+    return dictGenHashFunction(&key,sizeof(key));
+}
+
+static void gtidTrackingValDestructor(void *privdata, void *val) {
+    UNUSED(privdata);
+    sdsfree(val);
+}
+
+static dictType gtidTrackingDictType = {
+    .hashFunction = gtidTrackingHash,
+    .valDestructor = gtidTrackingValDestructor
+};
+
+static dict *gtid_tracking; /* client => last gtid repr, empty if none yet */
+
+void gtidTrackingRecord(const char *uuid, size_t uuid_len, gno_t gno) {
+    client *c = server.current_client;
+    dictEntry *de;
+    sds last;
+
+    if (c == NULL || !(c->flags & CLIENT_GTID_TRACKING)) return;
+    de = dictFind(gtid_tracking,c);
+    serverAssert(de != NULL);
+    last = sdscpylen(dictGetVal(de),uuid,uuid_len);
+    last = sdscatfmt(last,":%I",gno);
+    dictSetVal(gtid_tracking,de,last);
+}
+
+static void gtidTrackingOff(client *c) {
+    if (!(c->flags & CLIENT_GTID_TRACKING)) return;
+    c->flags &= ~CLIENT_GTID_TRACKING;
+    dictDelete(gtid_tracking,c);
+}
+
+/* Called by host right before client is freed. */
+void ctrip_freeClientGtid(client *c) {
+    gtidTrackingOff(c);
+}
+
+static void gtidTrackingCommand(client *c) {
+    if (!strcasecmp(c->argv[1]->ptr,"last")) {
+        sds last;
+        if (!(c->flags & CLIENT_GTID_TRACKING)) {
+            addReplyError(c,"gtid tracking is off, turn on by GTIDX TRACKING ON");
+            return;
+        }
+        last = dictFetchValue(gtid_tracking,c);
+        if (sdslen(last) == 0) {
+            addReplyNull(c);
+        } else {
+            addReplyBulkSds(c,sdsdup(last));
+        }
+    } else if (!strcasecmp(c->argv[2]->ptr,"on")) {
+        if (!(c->flags & CLIENT_GTID_TRACKING)) {
+            if (gtid_tracking == NULL)
+                gtid_tracking = gtidDictCreate(&gtidTrackingDictType);
+            dictAdd(gtid_tracking,c,sdsempty());
+            c->flags |= CLIENT_GTID_TRACKING;
+        }
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[2]->ptr,"off")) {
+        gtidTrackingOff(c);
+        addReply(c,shared.ok);
+    } else {
+        addReplyError(c,"Syntax error");
+    }
+}
+
+/* Bumped whenever gtid.executed, gtid.lost, gtid_seq or repl mode changes
+ * other than by executing commands, which move master_repl_offset anyway.
+ * Lets readers such as the xsync analysis cache tell whether derived results
+ * are stale. */
+static unsigned long long gtid_state_version;
+
+void serverGtidStateTouch(void) {
+    gtid_state_version++;
+}
+
+unsigned long long serverGtidStateVersion(void) {
+    return gtid_state_version;
+}
+
 gtidSet *serverGtidSetGet(char *log_prefix) {
+    serverGtidExecutedFlush();
     gtidSet *gtid_master = gtidSetDup(server.gtid_executed);
     gtidSetMerge(gtid_master,server.gtid_lost);
-    if (log_prefix != NULL) {
+    if (log_prefix != NULL && server.verbosity <= LL_NOTICE) {
         sds gtid_master_repr = gtidSetDump(gtid_master);
         sds gtid_executed_repr = gtidSetDump(server.gtid_executed);
         sds gtid_lost_repr = gtidSetDump(server.gtid_lost);
@@ -93,12 +264,19 @@ gtidSet *serverGtidSetGet(char *log_prefix) {
 }
 
 int serverGtidSetContains(char *uuid, size_t uuid_len, gno_t gno) {
+    if (gtid_executed_pending.start != 0 &&
+            gno >= gtid_executed_pending.start && gno <= gtid_executed_pending.end &&
+            gtid_executed_pending.uuid_len == uuid_len &&
+            memcmp(gtid_executed_pending.uuid, uuid, uuid_len) == 0) {
+        return 1;
+    }
     return gtidSetContains(server.gtid_executed,uuid,uuid_len,gno) ||
         gtidSetContains(server.gtid_lost,uuid,uuid_len,gno);
 }
 
 static void serverGtidSetCurrrentUuidSetUpdateNextGno() {
     gno_t curnext, lostnext;
+    serverGtidExecutedFlush();
     curnext = gtidSetCurrentUuidSetNext(server.gtid_executed,0);
     lostnext = gtidSetNext(server.gtid_lost,server.uuid,server.uuid_len,0);
     if (curnext < lostnext) {
@@ -110,8 +288,10 @@ static void serverGtidSetCurrrentUuidSetUpdateNextGno() {
 }
 
 void serverGtidSetResetExecuted(gtidSet *gtid_executed) {
+    serverGtidExecutedFlush();
     if (server.gtid_executed) gtidSetFree(server.gtid_executed);
     server.gtid_executed = gtid_executed;
+    serverGtidStateTouch();
     gtidSetCurrentUuidSetUpdate(server.gtid_executed,server.uuid,
             server.uuid_len);
     serverGtidSetCurrrentUuidSetUpdateNextGno();
@@ -120,16 +300,19 @@ void serverGtidSetResetExecuted(gtidSet *gtid_executed) {
 void serverGtidSetResetLost(gtidSet *gtid_lost) {
     if (server.gtid_lost) gtidSetFree(server.gtid_lost);
     server.gtid_lost = gtid_lost;
+    serverGtidStateTouch();
     serverGtidSetCurrrentUuidSetUpdateNextGno();
 }
 
 void serverGtidSetAddLost(gtidSet *delta_lost) {
     gtidSetMerge(server.gtid_lost,delta_lost);
+    serverGtidStateTouch();
     serverGtidSetCurrrentUuidSetUpdateNextGno();
 }
 
 void serverGtidSetRemoveLost(gtidSet *delta_lost) {
     gtidSetDiff(server.gtid_lost,delta_lost);
+    serverGtidStateTouch();
 }
 
 
@@ -139,7 +322,52 @@ void serverGtidSetRemoveLost(gtidSet *delta_lost) {
  *      2. gtid A:1 {db} exec
  *          a. fail (clean queue)
  */
+/* Inner command lookup cache: direct mapped by name length and first/last
+ * char, validated by name. Flushed when the command table changes. */
+#define GTID_INNER_CMD_CACHE_SIZE 64
+static struct {
+    sds name;
+    struct redisCommand *cmd;
+} gtid_inner_cmd_cache[GTID_INNER_CMD_CACHE_SIZE];
+static unsigned long gtid_inner_cmd_cache_ncmds;
+
+static struct redisCommand *gtidLookupInnerCommand(sds name) {
+    size_t len = sdslen(name);
+    if (len == 0) return NULL;
+    if (gtid_inner_cmd_cache_ncmds != dictSize(server.commands)) {
+        for (int i = 0; i < GTID_INNER_CMD_CACHE_SIZE; i++) {
+            sdsfree(gtid_inner_cmd_cache[i].name);
+            gtid_inner_cmd_cache[i].name = NULL;
+            gtid_inner_cmd_cache[i].cmd = NULL;
+        }
+        gtid_inner_cmd_cache_ncmds = dictSize(server.commands);
+    }
+    unsigned int slot = (len*31 + tolower((unsigned char)name[0])*7 +
+            tolower((unsigned char)name[len-1])) % GTID_INNER_CMD_CACHE_SIZE;
+    sds cached = gtid_inner_cmd_cache[slot].name;
+    if (cached && sdslen(cached) == len && !strcasecmp(cached, name))
+        return gtid_inner_cmd_cache[slot].cmd;
+
+    struct redisCommand *cmd = gtidLookupCommandBySds(name);
+    if (cmd) {
+        sdsfree(cached);
+        gtid_inner_cmd_cache[slot].name = sdsdup(name);
+        gtid_inner_cmd_cache[slot].cmd = cmd;
+    }
+    return cmd;
+}
+
+/* Inner argv of gtid command: the envelope is stripped into a reused buffer
+ * instead of a fresh argv per command. Refcounts are still taken because the
+ * inner command may rewrite (or replace) its arguments. */
+static struct {
+    robj **argv;
+    int cap;
+    int in_use;
+} gtid_inner_argv;
+
 void gtidCommand(client *c) {
+    GTID_LATENCY_START(latency);
     sds gtid = c->argv[1]->ptr;
     long long gno = 0;
     size_t uuid_len = 0;
@@ -175,19 +403,30 @@ void gtidCommand(client *c) {
         return;
     }
 
-    int orig_argc = c->argc;
-    c->argc -= GTID_COMMAN_ARGC;
+    int orig_argc = c->argc, orig_argv_len = gtidClientGetArgvLen(c);
+    int argc = c->argc - GTID_COMMAN_ARGC;
+    int pooled = !gtid_inner_argv.in_use; /* nested (e.g. exec) allocates */
+    robj **orig_argv = c->argv, **orig_original_argv = c->original_argv;
+    robj **newargv;
 
-    robj** orig_argv = c->argv;
-    robj** newargv = zmalloc(sizeof(struct robj*) * c->argc);
-    for(int i = 0; i < c->argc; i++) {
+    if (pooled) {
+        if (argc > gtid_inner_argv.cap) {
+            gtid_inner_argv.argv = zrealloc(gtid_inner_argv.argv, sizeof(robj*) * argc);
+            gtid_inner_argv.cap = argc;
+        }
+        gtid_inner_argv.in_use = 1;
+        newargv = gtid_inner_argv.argv;
+    } else {
+        newargv = zmalloc(sizeof(robj*) * argc);
+    }
+    for(int i = 0; i < argc; i++) {
         newargv[i] = c->argv[i + GTID_COMMAN_ARGC];
         incrRefCount(newargv[i]);
     }
-    c->argv = newargv;
+    gtidClientSetArgv(c, newargv, argc, pooled ? gtid_inner_argv.cap : argc);
 
     struct redisCommand* orig_cmd = c->cmd, *orig_lastcmd = c->lastcmd;
-    c->cmd = c->lastcmd = gtidLookupCommandBySds(c->argv[0]->ptr);
+    c->cmd = c->lastcmd = gtidLookupInnerCommand(c->argv[0]->ptr);
     if (!c->cmd) {
         sds args = sdsempty();
         int i;
@@ -208,19 +447,31 @@ void gtidCommand(client *c) {
         goto end;
     }
 
+    GTID_LATENCY_START(inner_latency);
     c->cmd->proc(c);
-    serverAssert(gtidSetAdd(server.gtid_executed, uuid, uuid_len, gno, gno));
+    GTID_LATENCY_EXCLUDE(latency,inner_latency);
+    serverGtidExecutedAdd(uuid, uuid_len, gno);
     server.gtid_executed_cmd_count++;
 
 end:
     for(int i = 0; i < c->argc; i++) {
         decrRefCount(c->argv[i]);
     }
-    zfree(c->argv);
-    c->argv = orig_argv;
-    c->argc = orig_argc;
+    if (pooled) {
+        /* A rewrite (always preceded by retaining the original argv) may
+         * have reallocated or replaced the buffer: adopt whatever is left. */
+        if (c->original_argv != orig_original_argv || orig_original_argv != NULL) {
+            gtid_inner_argv.argv = c->argv;
+            gtid_inner_argv.cap = c->argv ? c->argc : 0;
+        }
+        gtid_inner_argv.in_use = 0;
+    } else {
+        zfree(c->argv);
+    }
+    gtidClientSetArgv(c, orig_argv, orig_argc, orig_argv_len);
     c->cmd = orig_cmd;
     c->lastcmd = orig_lastcmd;
+    GTID_LATENCY_END(GTID_LATENCY_GTID_COMMAND,latency);
 }
 
 const char *getMasterUuid(size_t *puuid_len) {
@@ -323,22 +574,146 @@ void forceXsyncFullResyncIfNeeded() {
 }
 
 void xsyncReplicationCron() {
+    serverGtidExecutedFlush();
+    /* gtid-seq-sample applies to segments switched afterwards */
+    if (server.gtid_seq) gtidSeqSetSample(server.gtid_seq,server.gtid_seq_sample);
     forceXsyncFullResyncIfNeeded();
+    gtidGaplogFillCron();
+    gtidBacklogTransferCron();
+    gtidAofTransferCron();
+    gtidAckReplicasCron();
+    gtidAofLoadCron();
 }
 
-sds genGtidInfoString(sds info) {
+/* Dump gtid set, but stop appending intervals once repr exceeds maxlen
+ * (0 for unlimited) and mark the repr truncated with trailing "...". */
+static sds gtidSetDumpCapped(gtidSet *gtid_set, size_t maxlen) {
+    gtidSetIterator git;
+    uuidSetIterator uit;
+    uuidSet *uuid_set;
+    gtidIntervalNode *node;
+    sds repr;
+
+    if (maxlen == 0 || gtidSetEstimatedEncodeBufferSize(gtid_set) <= maxlen)
+        return gtidSetDump(gtid_set);
+
+    repr = sdsempty();
+    gtidSetInitIterator(&git,gtid_set);
+    while ((uuid_set = gtidSetIteratorNext(&git)) != NULL) {
+        if (uuidSetCount(uuid_set) == 0) continue;
+        if (sdslen(repr) >= maxlen) goto truncated;
+        if (sdslen(repr)) repr = sdscatlen(repr,",",1);
+        repr = sdscatlen(repr,uuid_set->uuid,uuid_set->uuid_len);
+        uuidSetInitIterator(&uit,uuid_set);
+        while ((node = uuidSetIteratorNext(&uit)) != NULL) {
+            if (sdslen(repr) >= maxlen) {
+                uuidSetDeinitIterator(&uit);
+                goto truncated;
+            }
+            if (node->start == node->end)
+                repr = sdscatfmt(repr,":%I",node->start);
+            else
+                repr = sdscatfmt(repr,":%I-%I",node->start,node->end);
+        }
+        uuidSetDeinitIterator(&uit);
+    }
+    gtidSetDeinitIterator(&git);
+    return repr;
+
+truncated:
+    gtidSetDeinitIterator(&git);
+    return sdscatlen(repr,"...",3);
+}
+
+/* Rendered reprs and stats of INFO gtid, re-rendered only when gtid.executed
+ * or gtid.lost version changes. Full sets are available with GTIDX LIST. */
+static struct {
+    size_t maxlen; /* repr cap, see GTIDX INFO MAXLEN */
+    size_t rendered_maxlen;
+    unsigned long long executed_version;
+    unsigned long long lost_version;
+    gtidStat executed_stat;
+    gtidStat lost_stat;
+    sds gtid_set_repr;
+    sds gtid_executed_repr;
+    sds gtid_lost_repr;
+} gtid_info_cache;
+
+static void gtidInfoCacheUpdate(void) {
     gtidSet *gtid_set;
-    gtidStat executed_stat, lost_stat;
 
-    gtidSetGetStat(server.gtid_executed, &executed_stat);
-    gtidSetGetStat(server.gtid_lost, &lost_stat);
+    if (gtid_info_cache.gtid_set_repr != NULL &&
+            gtid_info_cache.rendered_maxlen == gtid_info_cache.maxlen &&
+            gtid_info_cache.executed_version == server.gtid_executed->version &&
+            gtid_info_cache.lost_version == server.gtid_lost->version)
+        return;
+
+    sdsfree(gtid_info_cache.gtid_set_repr);
+    sdsfree(gtid_info_cache.gtid_executed_repr);
+    sdsfree(gtid_info_cache.gtid_lost_repr);
+
+    gtidSetGetStat(server.gtid_executed, &gtid_info_cache.executed_stat);
+    gtidSetGetStat(server.gtid_lost, &gtid_info_cache.lost_stat);
 
     gtid_set = serverGtidSetGet(NULL);
-    sds gtid_set_repr = gtidSetDump(gtid_set);
+    gtid_info_cache.gtid_set_repr = gtidSetDumpCapped(gtid_set,
+            gtid_info_cache.maxlen);
     gtidSetFree(gtid_set);
 
-    sds gtid_executed_repr = gtidSetDump(server.gtid_executed);
-    sds gtid_lost_repr = gtidSetDump(server.gtid_lost);
+    gtid_info_cache.gtid_executed_repr = gtidSetDumpCapped(
+            server.gtid_executed, gtid_info_cache.maxlen);
+    gtid_info_cache.gtid_lost_repr = gtidSetDumpCapped(server.gtid_lost,
+            gtid_info_cache.maxlen);
+
+    gtid_info_cache.rendered_maxlen = gtid_info_cache.maxlen;
+    gtid_info_cache.executed_version = server.gtid_executed->version;
+    gtid_info_cache.lost_version = server.gtid_lost->version;
+}
+
+/* Allocated size of gtid state, all allocated by zmalloc hence already
+ * included in used_memory (and maxmemory). */
+void gtidGetMemoryStat(gtidMemoryStat *stat) {
+    gtidStat set_stat;
+    gtidSeqStat seq_stat;
+
+    gtidSetGetStat(server.gtid_executed, &set_stat);
+    stat->executed = set_stat.used_memory;
+    gtidSetGetStat(server.gtid_lost, &set_stat);
+    stat->lost = set_stat.used_memory;
+    if (server.gtid_seq) {
+        gtidSeqGetStat(server.gtid_seq, &seq_stat);
+        stat->seq = seq_stat.used_memory;
+    } else {
+        stat->seq = 0;
+    }
+    stat->gaplog = server.gtid_gap_log ?
+        gtidGaplogUsedMemory(server.gtid_gap_log) : 0;
+    stat->cmdparse = cmdParseUsedMemory();
+    stat->aof_index = gtidAofIndexUsedMemory();
+    stat->total = stat->executed + stat->lost + stat->seq + stat->gaplog +
+        stat->cmdparse + stat->aof_index;
+}
+
+/* Counted as server overhead (getMemoryOverheadData) like other non-dataset
+ * structures. */
+size_t gtidMemoryOverhead(void) {
+    gtidMemoryStat stat;
+    gtidGetMemoryStat(&stat);
+    return stat.total;
+}
+
+sds genGtidInfoString(sds info) {
+    gtidMemoryStat mem_stat;
+
+    serverGtidExecutedFlush();
+    gtidInfoCacheUpdate();
+    gtidGetMemoryStat(&mem_stat);
+
+    gtidStat executed_stat = gtid_info_cache.executed_stat;
+    gtidStat lost_stat = gtid_info_cache.lost_stat;
+    sds gtid_set_repr = gtid_info_cache.gtid_set_repr;
+    sds gtid_executed_repr = gtid_info_cache.gtid_executed_repr;
+    sds gtid_lost_repr = gtid_info_cache.gtid_lost_repr;
 
     const char *master_uuid = getMasterUuid(NULL);
     info  = sdscatprintf(info,
@@ -362,7 +737,9 @@ sds genGtidInfoString(sds info) {
             "gtid_uuid_interested:%s\r\n"
             "gtid_xsync_fullresync_indicator:%lld\r\n"
             "gtid_executed_cmd_count:%lld\r\n"
-            "gtid_ignored_cmd_count:%lld\r\n",
+            "gtid_ignored_cmd_count:%lld\r\n"
+            "gtid_executed_flushes:%lld\r\n"
+            "gtid_executed_batched:%lld\r\n",
             server.uuid,
             master_uuid,
             gtid_set_repr,
@@ -383,11 +760,9 @@ sds genGtidInfoString(sds info) {
             server.gtid_uuid_interested,
             server.gtid_xsync_fullresync_indicator,
             server.gtid_executed_cmd_count,
-            server.gtid_ignored_cmd_count);
-
-    sdsfree(gtid_set_repr);
-    sdsfree(gtid_executed_repr);
-    sdsfree(gtid_lost_repr);
+            server.gtid_ignored_cmd_count,
+            gtid_executed_pending.flush_count,
+            gtid_executed_pending.batched_count);
 
     info = sdscatprintf(info,"gtid_sync_stat:");
     for (int i = 0; i < GTID_SYNC_TYPES; i++) {
@@ -398,17 +773,131 @@ sds genGtidInfoString(sds info) {
             info = sdscatprintf(info,",%s=%lld",gtidSyncTypeName(i),count);
         }
     }
+    info = xsyncAnaCacheCatStat(info);
     info = sdscatprintf(info,"\r\n");
 
+    info = sdscatprintf(info,
+            "gtid_seq_used_memory:%lu\r\n"
+            "gtid_gaplog_used_memory:%lu\r\n"
+            "gtid_cmdparse_used_memory:%lu\r\n"
+            "gtid_used_memory:%lu\r\n",
+            mem_stat.seq,
+            mem_stat.gaplog,
+            mem_stat.cmdparse,
+            mem_stat.total);
+
     if (server.gtid_gap_log != NULL) {
         info = sdscatprintf(info,
                 "gtid_gaplog_entries:%ld\r\n",
                 server.gtid_gap_log->size);
+        info = gtidGaplogCatFillInfo(info);
+    }
+
+    info = gtidAofIndexCatInfo(info);
+    info = gtidAckReplicasCatInfo(info);
+    info = genGtidLatencyInfoString(info);
+
+    return info;
+}
+
+#ifndef GTID_DISABLE_LATENCY
+/* Log2 histograms of gtid hot paths, bucket i counts latencies whose
+ * bit length is i (i.e. [2^(i-1), 2^i) ns). */
+gtidLatencyHist gtid_latency_hists[GTID_LATENCY_TYPES];
+
+static const char *gtid_latency_names[GTID_LATENCY_TYPES] = {
+    "propagate",
+    "gtid_command",
+    "seq_append",
+    "gaplog_insert",
+    "gaplog_fill",
+    "xsync_ana",
+    "rdb_save",
+    "rdb_load",
+};
+
+/* upper bound of the bucket where permille of calls fall */
+static long long gtidLatencyPercentile(gtidLatencyHist *hist, int permille) {
+    long long seen = 0, rank;
+    if (hist->count == 0) return 0;
+    rank = (hist->count*permille+999)/1000;
+    for (int i = 0; i < GTID_LATENCY_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            long long upper = i == 0 ? 0 : (1LL<<i)-1;
+            return upper < hist->max_ns ? upper : hist->max_ns;
+        }
     }
+    return hist->max_ns;
+}
 
+sds genGtidLatencyInfoString(sds info) {
+    for (int i = 0; i < GTID_LATENCY_TYPES; i++) {
+        gtidLatencyHist *hist = &gtid_latency_hists[i];
+        info = sdscatprintf(info,
+                "gtid_latency_%s:calls=%lld,avg_ns=%lld,p50_ns=%lld,"
+                "p99_ns=%lld,p999_ns=%lld,max_ns=%lld\r\n",
+                gtid_latency_names[i],
+                hist->count,
+                hist->count ? hist->sum_ns/hist->count : 0,
+                gtidLatencyPercentile(hist,500),
+                gtidLatencyPercentile(hist,990),
+                gtidLatencyPercentile(hist,999),
+                hist->max_ns);
+    }
+    return info;
+}
+
+/* GTIDX LATENCY [RESET] */
+void gtidLatencyCommand(client *c) {
+    if (c->argc == 3 && !strcasecmp(c->argv[2]->ptr,"reset")) {
+        memset(gtid_latency_hists,0,sizeof(gtid_latency_hists));
+        addReply(c,shared.ok);
+        return;
+    } else if (c->argc != 2) {
+        addReplySubcommandSyntaxError(c);
+        return;
+    }
+
+    addReplyArrayLen(c,GTID_LATENCY_TYPES);
+    for (int i = 0; i < GTID_LATENCY_TYPES; i++) {
+        gtidLatencyHist *hist = &gtid_latency_hists[i];
+        int nbuckets = 0;
+
+        for (int j = 0; j < GTID_LATENCY_BUCKETS; j++)
+            if (hist->buckets[j]) nbuckets++;
+
+        addReplyArrayLen(c,12);
+        addReplyBulkCString(c,"type");
+        addReplyBulkCString(c,gtid_latency_names[i]);
+        addReplyBulkCString(c,"calls");
+        addReplyLongLong(c,hist->count);
+        addReplyBulkCString(c,"sum_ns");
+        addReplyLongLong(c,hist->sum_ns);
+        addReplyBulkCString(c,"max_ns");
+        addReplyLongLong(c,hist->max_ns);
+        addReplyBulkCString(c,"p99_ns");
+        addReplyLongLong(c,gtidLatencyPercentile(hist,990));
+        /* non-empty buckets as [upper_bound_ns, calls] pairs */
+        addReplyBulkCString(c,"buckets");
+        addReplyArrayLen(c,nbuckets*2);
+        for (int j = 0; j < GTID_LATENCY_BUCKETS; j++) {
+            if (hist->buckets[j] == 0) continue;
+            addReplyLongLong(c,j == 0 ? 0 : (1LL<<j)-1);
+            addReplyLongLong(c,hist->buckets[j]);
+        }
+    }
+}
+#else
+sds genGtidLatencyInfoString(sds info) {
     return info;
 }
 
+void gtidLatencyCommand(client *c) {
+    addReplyError(c,"gtid latency tracking disabled at compile time");
+}
+#endif
+
 sds catGtidStatString(sds info, gtidStat *stat) {
     return sdscatprintf(info,
             "uuid_count:%ld,used_memory:%ld,gap_count:%ld,gno_count:%lld",
@@ -421,6 +910,7 @@ long long copyReplicationBacklogLimited(char *buf, long long offset, long long l
 static gtidSet *findGtidSetOrReply(client *c, int type_argc) {
     gtidSet *gtid_set = NULL;
     if (!strcasecmp(c->argv[type_argc]->ptr,"executed")) {
+        serverGtidExecutedFlush();
         gtid_set = server.gtid_executed;
     } else if (!strcasecmp(c->argv[type_argc]->ptr,"lost")) {
         gtid_set = server.gtid_lost;
@@ -457,9 +947,26 @@ void gtidxCommand(client *c) {
             "GAPLOG DELETERANGE <uuid> <start_gno> <end_gno>",
             "    Delete gaplog entries by uuid and gno range.",
             "GAPLOG LIST <start_index> <count>",
-            "    List gaplog entries by index.",
+            "    List gaplog entries by index. Keys touched by range writes carry",
+            "    a 5th field: [range|zscore|zlex|zrank|bitoff|bitrng, ...].",
             "GAPLOG CLEAR",
             "    Clear all gaplog entries.",
+            "GAPLOG KEY <db> <key>",
+            "    List uuid and gno of gaplog entries that touched key.",
+            "GAPLOG KEYINDEX ON|OFF",
+            "    Enable or disable gaplog key index.",
+            "INFO MAXLEN [<bytes>]",
+            "    Get or set max length of gtid set reprs in INFO (0: unlimited).",
+            "LATENCY [RESET]",
+            "    Show or reset latency histograms of gtid hot paths.",
+            "TRACKING ON|OFF",
+            "    Remember gtid assigned to latest write of current client.",
+            "LAST",
+            "    Get gtid assigned to latest write of current client.",
+            "WAITFOR <uuid:gno> <timeout>",
+            "    Block until gtid executed, returns 1 or 0 if timed out.",
+            "AOF",
+            "    List gtid index of incr aof files.",
             NULL
         };
         addReplyHelp(c, help);
@@ -527,6 +1034,7 @@ void gtidxCommand(client *c) {
         if (getLongLongFromObjectOrReply(c, c->argv[5], &end_gno, NULL)
                 != C_OK) return;
         added = gtidSetAdd(gtid_set,uuid,sdslen(uuid),start_gno,end_gno);
+        serverGtidStateTouch();
         serverGtidSetCurrrentUuidSetUpdateNextGno();
         sds gtid_repr = gtidSetDump(gtid_set);
         serverLog(LL_NOTICE,"Add gtid-%s %s %lld %lld result: %s",
@@ -544,6 +1052,7 @@ void gtidxCommand(client *c) {
         if (getLongLongFromObjectOrReply(c, c->argv[5], &end_gno, NULL)
                 != C_OK) return;
         removed = gtidSetRemove(gtid_set,uuid,sdslen(uuid),start_gno,end_gno);
+        serverGtidStateTouch();
         if (gtid_set == server.gtid_executed) {
             /* update current uuid set because it might be removed. */
             gtidSetCurrentUuidSetUpdate(server.gtid_executed,server.uuid,
@@ -600,8 +1109,7 @@ void gtidxCommand(client *c) {
                 gtidSet *gtid_set = gtidSetNew();
                 for (seg = server.gtid_seq->firstseg; seg != NULL;
                         seg = seg->next) {
-                    gtidSetAdd(gtid_set,seg->uuid,seg->uuid_len,
-                            seg->base_gno+seg->tgno,seg->base_gno+seg->ngno-1);
+                    gtidSegmentAddToGtidSet(seg,seg->tgno,gtid_set);
                 }
                 size_t maxlen = gtidSetEstimatedEncodeBufferSize(gtid_set);
                 char *buf = zmalloc(maxlen);
@@ -629,6 +1137,28 @@ void gtidxCommand(client *c) {
         } else {
             addReplyError(c,"Syntax error");
         }
+    } else if (!strcasecmp(c->argv[1]->ptr,"info") && c->argc >= 3 &&
+            !strcasecmp(c->argv[2]->ptr,"maxlen")) {
+        long maxlen;
+        if (c->argc == 3) {
+            addReplyLongLong(c,gtid_info_cache.maxlen);
+        } else if (c->argc == 4) {
+            if (getRangeLongFromObjectOrReply(c,c->argv[3],0,LONG_MAX,
+                        &maxlen,NULL) != C_OK) return;
+            gtid_info_cache.maxlen = maxlen;
+            addReply(c,shared.ok);
+        } else {
+            addReplySubcommandSyntaxError(c);
+        }
+    } else if ((!strcasecmp(c->argv[1]->ptr,"last") && c->argc == 2) ||
+            (!strcasecmp(c->argv[1]->ptr,"tracking") && c->argc == 3)) {
+        gtidTrackingCommand(c);
+    } else if (!strcasecmp(c->argv[1]->ptr,"waitfor") && c->argc == 4) {
+        gtidWaitforCommand(c);
+    } else if (!strcasecmp(c->argv[1]->ptr,"aof") && c->argc == 2) {
+        gtidAofIndexCommand(c);
+    } else if (!strcasecmp(c->argv[1]->ptr,"latency") && c->argc <= 3) {
+        gtidLatencyCommand(c);
     } else if (!strcasecmp(c->argv[1]->ptr,"gaplog") && c->argc >= 3) {
         if (!strcasecmp(c->argv[2]->ptr,"len") && c->argc == 3)  {
             addReplyLongLong(c, gtidGaplogSize(server.gtid_gap_log));
@@ -642,6 +1172,14 @@ void gtidxCommand(client *c) {
                 addReplyError(c, "start gno must be <= end gno");
                 return;
             }
+            if (gtidGaplogFillIsBuilding()) {
+                addReplyError(c, "gaplog is building");
+                return;
+            }
+            if (gtidGaplogFillIsDegraded()) {
+                addReplyError(c, "gaplog is degraded, clear or rebuild it");
+                return;
+            }
 
             QueryRangeContext qctx = {c, 0};
             void *arraylen = addReplyDeferredLen(c);
@@ -657,6 +1195,7 @@ void gtidxCommand(client *c) {
                 return;
             }
 
+            gtidGaplogFillCancelRange(uuid, start_gno, end_gno);
             long long deleted = gtidGaplogDeleteRange(server.gtid_gap_log, uuid, start_gno, end_gno);
 
             if (deleted > 100) {
@@ -677,6 +1216,14 @@ void gtidxCommand(client *c) {
                 addReplyErrorFormat(c, "count must be <= %d", GTID_GAPLOG_HISTORY_MAX_COUNT);
                 return;
             }
+            if (gtidGaplogFillIsBuilding()) {
+                addReplyError(c, "gaplog is building");
+                return;
+            }
+            if (gtidGaplogFillIsDegraded()) {
+                addReplyError(c, "gaplog is degraded, clear or rebuild it");
+                return;
+            }
 
             ListContext lctx = {c, 0};
             void *replylen = addReplyDeferredLen(c);
@@ -685,7 +1232,53 @@ void gtidxCommand(client *c) {
 
             setDeferredArrayLen(c, replylen, lctx.nreply);
         } else if (!strcasecmp(c->argv[2]->ptr,"clear") && c->argc == 3) {
+            gtidGaplogFillAbort();
             gtidGaplogReset(server.gtid_gap_log);
+            gtidGaplogFillResetDegraded();
+            addReply(c,shared.ok);
+        } else if (!strcasecmp(c->argv[2]->ptr,"key") && c->argc == 5) {
+            /* GTIDX GAPLOG KEY <db> <key> */
+            long long dbid;
+            sds key = c->argv[4]->ptr;
+            if (getLongLongFromObjectOrReply(c, c->argv[3], &dbid, NULL) != C_OK) return;
+            if (dbid < 0 || dbid >= server.dbnum) {
+                addReplyError(c, "invalid db index");
+                return;
+            }
+            if (!gtidGaplogKeyIndexEnabled(server.gtid_gap_log)) {
+                addReplyError(c, "gaplog key index disabled");
+                return;
+            }
+            if (gtidGaplogFillIsBuilding()) {
+                addReplyError(c, "gaplog is building");
+                return;
+            }
+            if (gtidGaplogFillIsDegraded()) {
+                addReplyError(c, "gaplog is degraded, clear or rebuild it");
+                return;
+            }
+
+            gtidGaplogKeyRefs *refs = gtidGaplogLookupKey(server.gtid_gap_log,
+                    dbid, key, sdslen(key));
+            if (refs == NULL) {
+                addReplyArrayLen(c, 0);
+                return;
+            }
+            addReplyArrayLen(c, refs->len);
+            for (size_t i = 0; i < refs->len; i++) {
+                addReplyArrayLen(c, 2);
+                addReplyBulkCBuffer(c, refs->refs[i].uuid, sdslen((sds)refs->refs[i].uuid));
+                addReplyLongLong(c, refs->refs[i].gno);
+            }
+        } else if (!strcasecmp(c->argv[2]->ptr,"keyindex") && c->argc == 4) {
+            if (!strcasecmp(c->argv[3]->ptr, "on")) {
+                gtidGaplogSetKeyIndex(server.gtid_gap_log, 1);
+            } else if (!strcasecmp(c->argv[3]->ptr, "off")) {
+                gtidGaplogSetKeyIndex(server.gtid_gap_log, 0);
+            } else {
+                addReplyError(c, "Syntax error");
+                return;
+            }
             addReply(c,shared.ok);
         } else {
             addReplySubcommandSyntaxError(c);
@@ -706,12 +1299,14 @@ int gtidTest(int argc, char **argv, int accurate) {
     server.proto_max_bulk_len = 512LL*1024*1024;
     server.maxmemory_policy = MAXMEMORY_FLAG_LFU;
     server.gtid_xsync_max_gap = 10000;
+    server.gtid_xsync_aof_max_bytes = 0;
     if (!server.logfile) server.logfile = zstrdup("");
     gtidInitTestEnv();
 
     error += replTest(argc, argv, accurate);
     error += gapLogTest(argc, argv, accurate);
     error += readBacklogIteratorTest(argc, argv, accurate);
+    error += rdbGtidTest(argc, argv, accurate);
 
     return error;
 }
@@ -47,6 +47,9 @@ sds gtidSetDump(gtidSet *gtid_set);
 sds gtidSetQuoteIfEmpty(sds gtid_repr);
 gtidSet *serverGtidSetGet(char *log_prefix);
 int serverGtidSetContains(char *uuid, size_t uuid_len, gno_t gno);
+void serverGtidExecutedFlush(void);
+void serverGtidStateTouch(void);
+unsigned long long serverGtidStateVersion(void);
 void serverGtidSetResetExecuted(gtidSet *gtid_executed);
 void serverGtidSetResetLost(gtidSet *gtid_lost);
 void serverGtidSetAddLost(gtidSet *delta_lost);
@@ -142,18 +145,21 @@ typedef struct propagateArgs {
     size_t uuid_len;
     gno_t gno;
     long long offset;
+    int pooled; /* argv borrowed from propagate pool */
 } propagateArgs;
 
 void propagateArgsInit(propagateArgs *pargs, struct redisCommand *cmd, int dbid, robj **argv, int argc);
 void propagateArgsPrepareToFeed(propagateArgs *pargs);
 void propagateArgsDeinit(propagateArgs *pargs);
 
+gtidSeq *serverGtidSeqCreate(void);
 void ctrip_createReplicationBacklog(void);
 void ctrip_resizeReplicationBacklog(long long newsize);
 void ctrip_freeReplicationBacklog(void);
 void ctrip_replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc, const char *uuid, size_t uuid_len, gno_t gno, long long offset);
 void ctrip_replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen, const char *uuid, size_t uuid_len, gno_t gno, long long offset);
 void ctrip_feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
+sds catAppendOnlyGtidCommand(sds dst, int argc, robj **argv);
 
 typedef struct gtidInitialInfo {
   gtidSet *gtid_lost;
@@ -184,6 +190,8 @@ typedef struct rdbSaveInfoGtid {
   int repl_mode;
   gtidSet *gtid_executed;
   gtidSet *gtid_lost;
+  int gtid_executed_invalid; /* some chunk invalid, set dropped */
+  int gtid_lost_invalid;
 } rdbSaveInfoGtid;
 
 rdbSaveInfoGtid *rdbSaveInfoGtidCreate();
@@ -229,9 +237,52 @@ static inline const char *gtidSyncTypeName(int type) {
 void xsyncUuidInterestedInit(void);
 void forceXsyncFullResync(void);
 void xsyncReplicationCron(void);
+sds xsyncAnaCacheCatStat(sds info);
+
+/* WAITGTID timeouts are checked every GTID_WAIT_TIMEOUT_RESOLUTION ms. */
+#define GTID_WAIT_TIMEOUT_RESOLUTION 10
+const char *serverGtidExecutedLastUuid(size_t *puuid_len);
+gno_t serverGtidSetWatermark(const char *uuid, size_t uuid_len);
+sds ctrip_replicationAckGtid(void);
+void ctrip_replconfAckGtid(client *c);
+void ctrip_unblockClientWaitingGtid(client *c);
+void waitgtidCommand(client *c);
+void gtidWaitforCommand(client *c);
+void gtidWaitersNotifyExecuted(void);
+void gtidWaitersBeforeSleep(void);
+void ctrip_beforeSleep(void);
+void gtidTrackingRecord(const char *uuid, size_t uuid_len, gno_t gno);
+void ctrip_freeClientGtid(client *c);
+long long ctrip_aofLoadLimit(sds file_name);
+void gtidAckReplicasCron(void);
+sds gtidAckReplicasCatInfo(sds info);
+
+/* Byte ranges of incremental aof files that precede backlog, streamed to
+ * slave ahead of backlog when xsync continues from aof. */
+typedef struct gtidAofRange {
+    int nfile;
+    sds *paths;
+    long long *starts;
+    long long *ends; /* exclusive */
+    long long bytes;
+} gtidAofRange;
+void gtidAofRangeFree(gtidAofRange *range);
+void masterAttachPartialSlave(client *c, long long offset);
 void resetServerReplMode(int mode, const char *log_prefix);
 void shiftServerReplMode(int mode, const char *log_prefix);
 sds genGtidInfoString(sds info);
+
+typedef struct gtidMemoryStat {
+    size_t executed;
+    size_t lost;
+    size_t seq;
+    size_t gaplog;
+    size_t cmdparse;
+    size_t aof_index;
+    size_t total;
+} gtidMemoryStat;
+void gtidGetMemoryStat(gtidMemoryStat *stat);
+size_t gtidMemoryOverhead(void);
 void gtidCommand(client *c);
 void gtidxCommand(client *c);
 char *ctrip_receiveSynchronousResponse(connection *conn);
@@ -268,13 +319,16 @@ typedef struct gtidGaplogKey {
   unsigned long long dbid:4;      /* max 16 db */
   unsigned long long key_type:8;  /* OBJ_STRING/OBJ_LIST/OBJ_SET/OBJ_ZSET/OBJ_HASH */
   unsigned long long subkeys_count:52;
-  sds key;                        /* key (sdsdup ) */
-  sds* subkeys;                   /* subkeys (sdsdup ) */
+  sds key;                        /* key (sdsdup, or view into objs[0]) */
+  sds* subkeys;                   /* subkeys (sdsdup, or views into objs[1..]) */
+  robj** objs;                    /* NULL, or referenced argv objects (key + subkeys) */
+  cmdParseKeyExtra* extra;        /* NULL, or touched sub-range of the key */
 } gtidGaplogKey;
 
 typedef struct gtidGaplogKeys {
     gtidGaplogKey** keys;
     size_t size;
+    size_t used_memory;   /* accounted when inserted into gaplog */
 } gtidGaplogKeys;
 
 #define GTID_GAPLOG_MAX_KEYS_BUFFER 256
@@ -293,10 +347,67 @@ void gtidGaplogKeysBuilderAddFromCmd(gtidGaplogKeysBuilder* builder, int dbid, r
 
 int cmdGetKeyType(struct redisCommand *cmd);
 
+/* Per-uuid gap log entries: gno-aligned chunks of keys slots, kept sorted by
+ * base gno. Gap gnos of one uuid are mostly dense, so append, lookup and
+ * range deletion touch one chunk (or splice whole chunks). */
+#define GTID_GAPLOG_CHUNK_SIZE 64
+typedef struct gtidGaplogChunk {
+  gno_t base;           /* multiple of GTID_GAPLOG_CHUNK_SIZE */
+  int count;
+  gtidGaplogKeys *slots[GTID_GAPLOG_CHUNK_SIZE];
+} gtidGaplogChunk;
+
+typedef struct gtidGaplogEntries {
+  gtidGaplogChunk **chunks;
+  size_t nchunks;
+  size_t cap;
+  size_t length;
+} gtidGaplogEntries;
+
+typedef void (gtidGaplogEntriesDeleteCallbackFn)(gno_t gno, gtidGaplogKeys* keys, void* ctx);
+gtidGaplogEntries *gtidGaplogEntriesNew(void);
+void gtidGaplogEntriesFree(gtidGaplogEntries *entries);
+int gtidGaplogEntriesInsert(gtidGaplogEntries *entries, gno_t gno, gtidGaplogKeys *keys);
+gtidGaplogKeys *gtidGaplogEntriesFind(gtidGaplogEntries *entries, gno_t gno);
+size_t gtidGaplogEntriesDeleteRange(gtidGaplogEntries *entries, gno_t start_gno, gno_t end_gno,
+                                    gtidGaplogEntriesDeleteCallbackFn callback, void *ctx);
+
+/* Inverted key index: gnos that touched a "dbid:key", oldest first. uuid
+ * refers to the key of gaplog->data, which outlives every ref to it. */
+typedef struct gtidGaplogKeyRef {
+  const char *uuid;
+  gno_t gno;
+} gtidGaplogKeyRef;
+
+typedef struct gtidGaplogKeyRefs {
+  gtidGaplogKeyRef *refs; /* first live ref, refs-head is the allocation */
+  size_t len;
+  size_t cap;
+  size_t head;            /* refs popped from the front of the allocation */
+} gtidGaplogKeyRefs;
+
+/* History ring record in insertion order. uuid refers to the key of
+ * gaplog->data and keys is owned by the per-uuid skiplist. */
+typedef struct gtidGaplogHistoryEntry {
+  const char *uuid;
+  gno_t gno;
+  gtidGaplogKeys *keys;
+} gtidGaplogHistoryEntry;
+
+typedef struct gtidGaplogHistory {
+  gtidGaplogHistoryEntry *entries;
+  size_t head;          /* position of the oldest entry */
+  size_t len;
+  size_t cap;           /* power of 2 */
+} gtidGaplogHistory;
+
 typedef struct gtidGaplog {
-  dict* data;           //dict<uuid, skiplist<gtidGaplogKey>>
-  list* history;   //list<uuidSet>
+  dict* data;           //dict<uuid, gtidGaplogEntries>
+  gtidGaplogHistory history;  //ring<gtidGaplogHistoryEntry>
+  dict* key_index;      //dict<"dbid:key", gtidGaplogKeyRefs>, NULL if disabled
   size_t size;  
+  size_t keys_memory;   /* allocated size of keys of all entries */
+  size_t key_index_memory; /* allocated size of key_index names and refs */
 } gtidGaplog;
 
 gtidGaplog* gtidGaplogNew();
@@ -310,16 +421,22 @@ typedef void (gtidGaplogQueryRangeCallbackFn)(gno_t gno, gtidGaplogKeys* keys, v
 int gtidGaplogQueryRange(gtidGaplog* gaplog, sds uuid, gno_t start_gno, gno_t end_gno,
                          gtidGaplogQueryRangeCallbackFn callback, void* ctx);
 size_t gtidGaplogSize(gtidGaplog* gaplog);
+size_t gtidGaplogUsedMemory(gtidGaplog* gaplog);
 typedef void (gtidGaplogListCallbackFn)(const char* uuid, size_t uuid_len, gno_t gno, 
                                     gtidGaplogKeys* keys, void* ctx);
 int gtidGaplogList(gtidGaplog* gaplog, long long start_idx, long long count,
                    gtidGaplogListCallbackFn callback, 
                    void* ctx);
+void gtidGaplogSetKeyIndex(gtidGaplog* gaplog, int enabled);
+int gtidGaplogKeyIndexEnabled(gtidGaplog* gaplog);
+gtidGaplogKeyRefs* gtidGaplogLookupKey(gtidGaplog* gaplog, int dbid, const char* key, size_t key_len);
 
 typedef struct gtidGaplogDataIterator {
-  skiplistIterator sl_iter;
+  gtidGaplogEntries *entries;
+  size_t chunk;         /* chunk of the next entry, nchunks if exhausted */
+  int slot;             /* slot of the next entry */
 } gtidGaplogDataIterator;
-void gtidGaplogDataInitIterator(gtidGaplogDataIterator *iter, skiplist *sl, gno_t start_gno);
+void gtidGaplogDataInitIterator(gtidGaplogDataIterator *iter, gtidGaplogEntries *entries, gno_t start_gno);
 void gtidGaplogDeinitDataIterator(gtidGaplogDataIterator *iter);
 void gtidGaplogDataIteratorSeek(gtidGaplogDataIterator *iter, gno_t gno);
 gno_t gtidGaplogDataGetGno(gtidGaplogDataIterator* iter);
@@ -327,16 +444,14 @@ gtidGaplogKeys* gtidGaplogDataNext(gtidGaplogDataIterator* iterator);
 
 
 typedef struct gtidGaplogHistoryIterator {
-    list* history;                /* gaplog->history list, for re-seek from head */
-    listNode* list_node;          /* current uuidSet node in history list */
-    gtidIntervalNode* interval_node;  /* current interval node within uuidSet */
-    gno_t next_gno;                   /* next gno to return */
-
+    gtidGaplogHistory* history;
+    size_t index;                 /* next index (0 = oldest) to return */
 } gtidGaplogHistoryIterator;
 void gtidGaplogInitHistoryIterator(gtidGaplogHistoryIterator* iter,
                                     gtidGaplog* gaplog, long long index);
 gno_t gtidGaplogHistoryNext(gtidGaplogHistoryIterator* iter,
-                             const char** uuid, size_t* uuid_len);
+                             const char** uuid, size_t* uuid_len,
+                             gtidGaplogKeys** keys);
 void gtidGaplogHistoryIteratorSeek(gtidGaplogHistoryIterator* iter, long long index);
 void gtidGaplogDeinitHistoryIterator(gtidGaplogHistoryIterator* iter);
 
@@ -350,23 +465,90 @@ void readBacklogIteratorDeinit(readBacklogIterator *it);
 void readBacklogIteratorSeekTo(readBacklogIterator *it, long long offset);
 ssize_t readBacklogIteratorParseNext(readBacklogIterator *it,
                                       robj ***out_argv, int *out_argc);
+long long readBacklogScanGtid(void *privdata, long long offset,
+        const char *uuid, size_t uuid_len, gno_t gno);
 void parseMultiCommand(gtidGaplogKeysBuilder *build,
                        readBacklogIterator *it,
                        long long select_dbid);
 int parseGtidCommand(gtidGaplogKeysBuilder *builder, robj **argv, int argc);
-void gtidGaplogFillFromGtidSet(gtidSet *mlost);
+void gtidGaplogFillStart(gtidSet *mlost);
+void gtidGaplogFillCron(void);
+void gtidGaplogFillAbort(void);
+void gtidGaplogFillCancelRange(sds uuid, gno_t start_gno, gno_t end_gno);
+int gtidGaplogFillIsBuilding(void);
+int gtidGaplogFillIsDegraded(void);
+void gtidGaplogFillResetDegraded(void);
+sds gtidGaplogCatFillInfo(sds info);
 void addReplyGtidGaplogKeys(client* c, gtidGaplogKeys* keys);
 void gtidGaplogKeysRelease(void* keys);
 gtidGaplogKey* gtidGaplogKeyNew(int dbid, int type, sds key, sds* subkeys, int subkeys_count);
+gtidGaplogKey* gtidGaplogKeyNewFromObjects(int dbid, int type, robj* key, robj** subkeys, int subkeys_count);
 void gtidGaplogKeyRelease(gtidGaplogKey* key);
 int processMultibulkBuffer(client* c);
 
+/* ================================================================
+ * latency histograms of gtid hot paths, compile with
+ * -DGTID_DISABLE_LATENCY to remove them entirely.
+ * ================================================================ */
+#define GTID_LATENCY_PROPAGATE      0
+#define GTID_LATENCY_GTID_COMMAND   1
+#define GTID_LATENCY_SEQ_APPEND     2
+#define GTID_LATENCY_GAPLOG_INSERT  3
+#define GTID_LATENCY_GAPLOG_FILL    4
+#define GTID_LATENCY_XSYNC_ANA      5
+#define GTID_LATENCY_RDB_SAVE       6
+#define GTID_LATENCY_RDB_LOAD       7
+#define GTID_LATENCY_TYPES          8
+
+/* bucket 0 counts 0ns samples, bucket i counts [2^(i-1),2^i) ns. */
+#define GTID_LATENCY_BUCKETS        48
+
+typedef struct gtidLatencyHist {
+    long long count;
+    long long sum_ns;
+    long long max_ns;
+    long long buckets[GTID_LATENCY_BUCKETS];
+} gtidLatencyHist;
+
+#ifndef GTID_DISABLE_LATENCY
+#include <time.h>
+
+extern gtidLatencyHist gtid_latency_hists[GTID_LATENCY_TYPES];
+
+static inline long long gtidLatencyNowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static inline void gtidLatencyAdd(int type, long long ns) {
+    gtidLatencyHist *hist = &gtid_latency_hists[type];
+    int bucket = ns <= 0 ? 0 : 64 - __builtin_clzll((unsigned long long)ns);
+    if (bucket >= GTID_LATENCY_BUCKETS) bucket = GTID_LATENCY_BUCKETS-1;
+    hist->count++;
+    hist->sum_ns += ns;
+    if (ns > hist->max_ns) hist->max_ns = ns;
+    hist->buckets[bucket]++;
+}
+
+#define GTID_LATENCY_START(var) long long var = gtidLatencyNowNs()
+/* leave time elapsed since from out of var */
+#define GTID_LATENCY_EXCLUDE(var,from) ((var) += gtidLatencyNowNs()-(from))
+#define GTID_LATENCY_END(type,var) gtidLatencyAdd(type,gtidLatencyNowNs()-(var))
+#else
+#define GTID_LATENCY_START(var)
+#define GTID_LATENCY_EXCLUDE(var,from)
+#define GTID_LATENCY_END(type,var)
+#endif
 
+sds genGtidLatencyInfoString(sds info);
+void gtidLatencyCommand(client *c);
 
 /* gtid test */
 int gtidTest(int argc, char **argv, int accurate);
 int replTest(int argc, char **argv, int accurate);
 int gapLogTest(int argc, char **argv, int accurate);
 int readBacklogIteratorTest(int argc, char **argv, int accurate);
+int rdbGtidTest(int argc, char **argv, int accurate);
 
 #endif
@@ -4,6 +4,7 @@
 
 /* dict */
 dict* gtidDictCreate(dictType *type);
+size_t gtidDictMemUsage(dict *d);
 
 /* command */
 struct redisCommand* gtidLookupCommandBySds(sds name);
@@ -28,9 +29,23 @@ void ctrip_feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv,
 typedef void (*consume_cb)(char *p, long long thislen, void *pd);
 long long consumeReplicationBacklogLimited(long long offset, long long limit,
         consume_cb cb, void *pd);
-void consumeReplicationBacklogLimitedAddReplyCb(char *p,
-        long long thislen, void *pd);
+long long gtidSendReplicationBacklogLimited(client *c, long long offset,
+        long long limit);
+void gtidBacklogTransferCron(void);
+void gtidReplTransfersAbort(void);
+
+/* aof */
+gtidAofRange *gtidAofXsync(gtidSet *req, const char *uuid, size_t uuid_len,
+        gno_t gno, long long maxbytes, gtidSet **pcont);
+void gtidSendAofRange(client *c, gtidAofRange *range, long long offset);
+void gtidAofTransferCron(void);
+size_t gtidAofIndexUsedMemory(void);
+sds gtidAofIndexCatInfo(sds info);
+void gtidAofIndexCommand(client *c);
+void gtidAofLoadCron(void);
 void gtidClearReplStartCmdStreamOnAck(client* c);
+void gtidBlockForReplication(client *c, long numreplicas);
+void gtidUnblockClient(client *c);
 void gtidFreeClientAsync(client *c);
 int gtidMasterTryPartialResynchronization(client* c, long long psync_offset) ;
 
@@ -48,6 +63,8 @@ void gtidMockClientInit(client* c);
 void gtidMockClientDeinit(client* c);
 void gtidMockClientCleanArgv(client* c);
 void gtidMockClientMoveClientArgv(client *c);
+int gtidClientGetArgvLen(client *c);
+void gtidClientSetArgv(client *c, robj **argv, int argc, int argv_len);
 void gtidAfterErrorReply(client *c, const char *s, size_t len, int flags);
 
 /* command */
@@ -91,10 +91,25 @@ void gtidMockClientMoveClientArgv(client *c) {
     c->argv = NULL;
 }
 
+int gtidClientGetArgvLen(client *c) {
+    return c->argc;
+}
+
+void gtidClientSetArgv(client *c, robj **argv, int argc, int argv_len) {
+    UNUSED(argv_len);
+    c->argv = argv;
+    c->argc = argc;
+}
+
 dict* gtidDictCreate(dictType *type) {
     return dictCreate(type, NULL);
 }
 
+size_t gtidDictMemUsage(dict *d) {
+    return zmalloc_size(d) + dictSize(d)*sizeof(dictEntry) +
+        dictSlots(d)*sizeof(dictEntry*);
+}
+
 int gtidGetKeysResultKeyIndex(getKeysResult* result, int index) {
     return result->keys[index];
 }
@@ -106,14 +121,19 @@ void ctrip_resizeReplicationBacklog(long long newsize) {
         /* realloc a new gtidSeq to keep gtid_seq sync with backlog, see
          * resizeReplicationBacklog for more details. */
         gtidSeqDestroy(server.gtid_seq);
-        server.gtid_seq = gtidSeqCreate();
+        server.gtid_seq = serverGtidSeqCreate();
+        serverGtidStateTouch();
     }
 }
 
 void ctrip_replicationFeedSlavesFromMasterStream(list *slaves, char *buf,
         size_t buflen, const char *uuid, size_t uuid_len, gno_t gno, long long offset) {
     int touch_index = uuid != NULL && gno >= GTID_GNO_INITIAL && server.gtid_seq;
-    if (touch_index) gtidSeqAppend(server.gtid_seq,uuid,uuid_len,gno,offset);
+    if (touch_index) {
+        GTID_LATENCY_START(latency);
+        gtidSeqAppend(server.gtid_seq,uuid,uuid_len,gno,offset);
+        GTID_LATENCY_END(GTID_LATENCY_SEQ_APPEND,latency);
+    }
     replicationFeedSlavesFromMasterStream(slaves,buf,buflen);
     if (touch_index) gtidSeqTrim(server.gtid_seq,server.repl_backlog_off);
 }
@@ -125,7 +145,11 @@ void ctrip_replicationFeedSlaves(list *slaves, int dictid, robj **argv,
 #ifdef ENABLE_SWAP
     touch_index = touch_index && server.swap_draining_master == NULL;
 #endif
-    if (touch_index) gtidSeqAppend(server.gtid_seq,uuid,uuid_len,gno,offset);
+    if (touch_index) {
+        GTID_LATENCY_START(latency);
+        gtidSeqAppend(server.gtid_seq,uuid,uuid_len,gno,offset);
+        GTID_LATENCY_END(GTID_LATENCY_SEQ_APPEND,latency);
+    }
     replicationFeedSlaves(slaves,dictid,argv,argc);
     if (touch_index) gtidSeqTrim(server.gtid_seq,server.repl_backlog_off);
 }
@@ -159,15 +183,88 @@ void gtidClearReplStartCmdStreamOnAck(client* c) {
     c->repl_put_online_on_ack = 0;
 }
 
+/* Blocked the way WAIT does, but never unblocked by acked offset (nor host
+ * timeout): WAITGTID waiters are unblocked by gtid watermarks. */
+void gtidBlockForReplication(client *c, long numreplicas) {
+    blockForReplication(c,0,LLONG_MAX,numreplicas);
+}
+
+void gtidUnblockClient(client *c) {
+    unblockClient(c);
+}
+
 void gtidFreeClientAsync(client* c) {
     c->flags |= CLIENT_CLOSE_AFTER_REPLY;
 }
 
-void consumeReplicationBacklogLimitedAddReplyCb(char *p,
+static void consumeReplicationBacklogLimitedAddReplyCb(char *p,
         long long thislen, void *pd) {
     addReplySds((client*)pd, sdsnewlen(p,thislen));
 }
 
+/* Backlog is a ring buffer that gets overwritten, so the limited range is
+ * copied into client reply buffers, which are written asynchronously. No
+ * more replies are accepted once close after reply is set. */
+long long gtidSendReplicationBacklogLimited(client *c, long long offset,
+        long long limit) {
+    long long sent = consumeReplicationBacklogLimited(offset,limit,
+            consumeReplicationBacklogLimitedAddReplyCb,c);
+    serverLog(LL_NOTICE,
+            "[gtid] Disconnect slave %s to notify repl mode switched.",
+            replicationGetSlaveName(c));
+    gtidFreeClientAsync(c);
+    return sent;
+}
+
+void gtidBacklogTransferCron(void) {
+}
+
+/* Limited range is copied into reply buffers, nothing pinned. */
+void gtidReplTransfersAbort(void) {
+}
+
+/* Multi part aof (incremental aof files) is not available before 7.0, xsync
+ * never continues from aof. */
+gtidAofRange *gtidAofXsync(gtidSet *req, const char *uuid, size_t uuid_len,
+        gno_t gno, long long maxbytes, gtidSet **pcont) {
+    UNUSED(req);
+    UNUSED(uuid);
+    UNUSED(uuid_len);
+    UNUSED(gno);
+    UNUSED(maxbytes);
+    UNUSED(pcont);
+    return NULL;
+}
+
+void gtidSendAofRange(client *c, gtidAofRange *range, long long offset) {
+    UNUSED(offset);
+    gtidAofRangeFree(range);
+    freeClientAsync(c);
+}
+
+void gtidAofTransferCron(void) {
+}
+
+size_t gtidAofIndexUsedMemory(void) {
+    return 0;
+}
+
+sds gtidAofIndexCatInfo(sds info) {
+    return info;
+}
+
+void gtidAofIndexCommand(client *c) {
+    addReplyArrayLen(c,0);
+}
+
+long long ctrip_aofLoadLimit(sds file_name) {
+    UNUSED(file_name);
+    return -1;
+}
+
+void gtidAofLoadCron(void) {
+}
+
 int gtidMasterTryPartialResynchronization(client* c, long long psync_offset) {
     UNUSED(psync_offset);
     return masterTryPartialResynchronization(c);
@@ -223,7 +320,7 @@ static sds catAppendOnlyGtidExpireAtCommand(sds buf, robj* gtid, robj* dbid,
     argv[index++] = key;
     time_index = index;
     argv[index++] = createStringObjectFromLongLong(when);
-    buf = catAppendOnlyGenericCommand(buf, index, argv);
+    buf = catAppendOnlyGtidCommand(buf, index, argv);
     decrRefCount(argv[time_index]);
     return buf;
 }
@@ -236,9 +333,18 @@ static sds catAppendOnlyGtidExpireAtCommand(sds buf, robj* gtid, robj* dbid,
  */
 void feedAppendOnlyFileGtid(struct redisCommand *_cmd, int dictid, robj **argv, int argc) {
     struct redisCommand *cmd;
-    sds buf = sdsempty();
+    int to_aof = server.aof_state == AOF_ON;
+    int to_rewrite = server.child_type == CHILD_TYPE_AOF;
 
     serverAssert(isGtidCommand(_cmd));
+    if (!to_aof && !to_rewrite) {
+        if (dictid >= 0) server.aof_selected_db = dictid;
+        return;
+    }
+
+    /* Append straight into aof_buf, the rewrite buffer gets the same bytes. */
+    sds buf = to_aof ? server.aof_buf : sdsempty();
+    size_t start = sdslen(buf);
 
     cmd = gtidLookupCommandBySds(argv[GTID_COMMAN_ARGC]->ptr);
 
@@ -273,22 +379,22 @@ void feedAppendOnlyFileGtid(struct redisCommand *_cmd, int dictid, robj **argv,
             }
             newargs[3 + GTID_COMMAN_ARGC] = shared.pxat;
             newargs[4 + GTID_COMMAN_ARGC] = createStringObjectFromLongLong(when);
-            buf = catAppendOnlyGenericCommand(buf,5 + GTID_COMMAN_ARGC,newargs);
+            buf = catAppendOnlyGtidCommand(buf,5 + GTID_COMMAN_ARGC,newargs);
             decrRefCount(newargs[4 + GTID_COMMAN_ARGC]);
         } else {
-            buf = catAppendOnlyGenericCommand(buf,argc,argv);
+            buf = catAppendOnlyGtidCommand(buf,argc,argv);
         }
     } else {
-        buf = catAppendOnlyGenericCommand(buf,argc,argv);
+        buf = catAppendOnlyGtidCommand(buf,argc,argv);
     }
 
-    if (server.aof_state == AOF_ON)
-        server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
+    if (to_rewrite)
+        aofRewriteBufferAppend((unsigned char*)buf+start,sdslen(buf)-start);
 
-    if (server.child_type == CHILD_TYPE_AOF)
-        aofRewriteBufferAppend((unsigned char*)buf,sdslen(buf));
-
-    sdsfree(buf);
+    if (to_aof)
+        server.aof_buf = buf;
+    else
+        sdsfree(buf);
 }
 
 void ctrip_feedAppendOnlyFile(struct redisCommand *cmd, int dictid,
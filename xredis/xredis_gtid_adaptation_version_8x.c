@@ -1,4 +1,6 @@
 #include "server.h"
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "xredis_gtid.h"
 #include "xredis_gtid_cmdparse.h"
 #include "xredis_gtid_adaptation_version.h"
@@ -9,6 +11,10 @@ dict* gtidDictCreate(dictType *type) {
     return dictCreate(type);
 }
 
+size_t gtidDictMemUsage(dict *d) {
+    return zmalloc_size(d) + dictMemUsage(d);
+}
+
 struct redisCommand* gtidLookupCommandBySds(sds name) {
     return lookupCommandBySds(name);
 }
@@ -65,7 +71,8 @@ void ctrip_resizeReplicationBacklog(long long newsize) {
         /* realloc a new gtidSeq to keep gtid_seq sync with backlog, see
          * resizeReplicationBacklog for more details. */
         gtidSeqDestroy(server.gtid_seq);
-        server.gtid_seq = gtidSeqCreate();
+        server.gtid_seq = serverGtidSeqCreate();
+        serverGtidStateTouch();
     }
 }
 
@@ -77,7 +84,11 @@ void ctrip_replicationFeedSlaves(list* saves,int dictid, robj **argv,
     touch_index = touch_index && server.swap_draining_master == NULL;
 #endif
    
-    if (touch_index) gtidSeqAppend(server.gtid_seq,uuid,uuid_len,gno,offset);
+    if (touch_index) {
+        GTID_LATENCY_START(latency);
+        gtidSeqAppend(server.gtid_seq,uuid,uuid_len,gno,offset);
+        GTID_LATENCY_END(GTID_LATENCY_SEQ_APPEND,latency);
+    }
     replicationFeedSlaves(saves, dictid,argv,argc);
 }
 
@@ -85,23 +96,16 @@ void ctrip_replicationFeedSlavesFromMasterStream(list *slaves, char *buf,
         size_t buflen, const char *uuid, size_t uuid_len, gno_t gno, long long offset) {
     UNUSED(slaves);
     int touch_index = uuid != NULL && gno >= GTID_GNO_INITIAL && server.gtid_seq;
-    if (touch_index) gtidSeqAppend(server.gtid_seq,uuid,uuid_len,gno,offset);
+    if (touch_index) {
+        GTID_LATENCY_START(latency);
+        gtidSeqAppend(server.gtid_seq,uuid,uuid_len,gno,offset);
+        GTID_LATENCY_END(GTID_LATENCY_SEQ_APPEND,latency);
+    }
     replicationFeedStreamFromMasterStream(buf,buflen);
 }
 
-long long consumeReplicationBacklogLimited(long long offset, long long limit,
-        consume_cb cb, void *pd) {
-    long long skip;
-    long long added = 0;
-    if (server.repl_backlog->histlen == 0) {
-        serverLog(LL_DEBUG, "[PSYNC] Backlog history len is zero");
-        return 0;
-    }
-    /* Compute the amount of bytes we need to discard. */
-    skip = offset - server.repl_backlog->offset;
-    long long len = server.repl_backlog->histlen - skip;
-    len = len < limit ? len: limit;
-    /* Iterate recorded blocks, quickly search the approximate node. */
+/* Find the repl buffer block containing offset. */
+static listNode *gtidBacklogSeekBlock(long long offset) {
     listNode *node = NULL;
     if (raxSize(server.repl_backlog->blocks_index) > 0) {
         uint64_t encoded_offset = htonu64(offset);
@@ -135,8 +139,24 @@ long long consumeReplicationBacklogLimited(long long offset, long long limit,
         node = listNextNode(node);
     }
     serverAssert(node != NULL);
+    return node;
+}
 
-    serverLog(LL_WARNING, "start copy backlog offset(%lld) len(%lld)", offset, len);
+long long consumeReplicationBacklogLimited(long long offset, long long limit,
+        consume_cb cb, void *pd) {
+    long long skip;
+    long long added = 0;
+    if (server.repl_backlog->histlen == 0) {
+        serverLog(LL_DEBUG, "[PSYNC] Backlog history len is zero");
+        return 0;
+    }
+    /* Compute the amount of bytes we need to discard. */
+    skip = offset - server.repl_backlog->offset;
+    long long len = server.repl_backlog->histlen - skip;
+    len = len < limit ? len: limit;
+    listNode *node = gtidBacklogSeekBlock(offset);
+
+    serverLog(LL_DEBUG, "start copy backlog offset(%lld) len(%lld)", offset, len);
     while (len) {
         replBufBlock *o = listNodeValue(node);
         int start = 0;
@@ -145,30 +165,1085 @@ long long consumeReplicationBacklogLimited(long long offset, long long limit,
         }
         long long thislen = o->used - start  < len?
                 o->used - start: len;
-        serverLog(LL_WARNING, "block start(%lld), offset(%lld) size(%lld)", o->repl_offset, start, thislen);
+        serverLog(LL_DEBUG, "block start(%lld), offset(%d) size(%lld)", o->repl_offset, start, thislen);
         cb(o->buf + start, thislen, pd);
         len -= thislen;
         start = 0;
         added += thislen;
         node = listNextNode(node);
     }
-    serverLog(LL_WARNING, "added=%lld", added);
+    serverLog(LL_DEBUG, "added=%lld", added);
     return added;
 }
 
-void consumeReplicationBacklogLimitedAddReplyCb(char *p,
-        long long thislen, void *pd) {
-    //can't use addReplySds send slave message, because client will be closed by underlying layer  
-    if (connWrite(((client*)pd)->conn,p,thislen) != thislen) {
-        serverLog(LL_WARNING, "[consumeReplicationBacklogLimitedAddReplyCb] send slave fail");
-        freeClientAsync((client*)pd);
+/* Limited backlog transfer: the range is followed by the stream of another
+ * repl mode, so it can't go through the replica output path, which streams
+ * up to the buffer tail. The range is written straight from the repl buffer
+ * blocks by our own write handler instead, blocks pinned by refcount just
+ * like replicas do, and the client is closed once the limit is flushed. */
+typedef struct gtidBacklogTransfer {
+    uint64_t client_id;
+    client *c;
+    listNode *node;     /* referenced repl buffer block */
+    size_t pos;         /* next byte to send in block */
+    long long remaining;
+} gtidBacklogTransfer;
+
+static list *gtid_backlog_transfers = NULL;
+
+static void gtidBacklogTransferDone(listNode *ln) {
+    gtidBacklogTransfer *t = listNodeValue(ln);
+    replBufBlock *o = listNodeValue(t->node);
+    o->refcount--;
+    listDelNode(gtid_backlog_transfers,ln);
+    zfree(t);
+    incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+static listNode *gtidBacklogTransferFind(client *c) {
+    listIter li;
+    listNode *ln;
+    if (gtid_backlog_transfers == NULL) return NULL;
+    listRewind(gtid_backlog_transfers,&li);
+    while ((ln = listNext(&li))) {
+        gtidBacklogTransfer *t = listNodeValue(ln);
+        if (t->c == c && t->client_id == c->id) return ln;
+    }
+    return NULL;
+}
+
+static void gtidBacklogTransferWriteHandler(connection *conn) {
+    client *c = connGetPrivateData(conn);
+    listNode *ln = gtidBacklogTransferFind(c);
+    gtidBacklogTransfer *t;
+    size_t totwritten = 0;
+
+    if (ln == NULL) {
+        connSetWriteHandler(conn,NULL);
+        return;
+    }
+    t = listNodeValue(ln);
+
+    while (t->remaining > 0) {
+        replBufBlock *o = listNodeValue(t->node);
+        if (t->pos == o->used) {
+            listNode *next = listNextNode(t->node);
+            serverAssert(next != NULL);
+            ((replBufBlock*)listNodeValue(next))->refcount++;
+            o->refcount--;
+            t->node = next, t->pos = 0;
+            incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+            continue;
+        }
+
+        size_t len = o->used - t->pos;
+        if ((long long)len > t->remaining) len = t->remaining;
+        ssize_t nwritten = connWrite(conn,o->buf+t->pos,len);
+        if (nwritten <= 0) {
+            if (connGetState(conn) != CONN_STATE_CONNECTED) {
+                serverLog(LL_WARNING, "[gtid] Failed to send limited backlog"
+                        " to %s: %s", replicationGetSlaveName(c),
+                        connGetLastError(conn));
+                connSetWriteHandler(conn,NULL);
+                gtidBacklogTransferDone(ln);
+                freeClientAsync(c);
+            }
+            return;
+        }
+        t->pos += nwritten;
+        t->remaining -= nwritten;
+        totwritten += nwritten;
+        server.stat_net_repl_output_bytes += nwritten;
+        if (totwritten > NET_MAX_WRITES_PER_EVENT) return;
+    }
+
+    serverLog(LL_NOTICE,
+            "[gtid] Disconnect slave %s to notify repl mode switched.",
+            replicationGetSlaveName(c));
+    connSetWriteHandler(conn,NULL);
+    gtidBacklogTransferDone(ln);
+    gtidFreeClientAsync(c);
+}
+
+long long gtidSendReplicationBacklogLimited(client *c, long long offset,
+        long long limit) {
+    gtidBacklogTransfer *t;
+    replBufBlock *o;
+    long long len;
+
+    len = server.repl_backlog->histlen - (offset - server.repl_backlog->offset);
+    len = len < limit ? len : limit;
+    if (len <= 0) {
+        serverLog(LL_NOTICE,
+                "[gtid] Disconnect slave %s to notify repl mode switched.",
+                replicationGetSlaveName(c));
+        gtidFreeClientAsync(c);
+        return 0;
+    }
+
+    t = zcalloc(sizeof(*t));
+    t->client_id = c->id;
+    t->c = c;
+    t->node = gtidBacklogSeekBlock(offset);
+    o = listNodeValue(t->node);
+    o->refcount++;
+    t->pos = offset > o->repl_offset ? offset - o->repl_offset : 0;
+    t->remaining = len;
+
+    if (gtid_backlog_transfers == NULL) gtid_backlog_transfers = listCreate();
+    listAddNodeTail(gtid_backlog_transfers,t);
+
+    if (connSetWriteHandler(c->conn,gtidBacklogTransferWriteHandler) == C_ERR) {
+        gtidBacklogTransferDone(listLast(gtid_backlog_transfers));
+        freeClientAsync(c);
+        return 0;
+    }
+    return len;
+}
+
+/* Clients might be freed by others (read error, CLIENT KILL...) while
+ * transfer is in flight, release blocks they pinned. */
+void gtidBacklogTransferCron(void) {
+    listIter li;
+    listNode *ln;
+    if (gtid_backlog_transfers == NULL) return;
+    listRewind(gtid_backlog_transfers,&li);
+    while ((ln = listNext(&li))) {
+        gtidBacklogTransfer *t = listNodeValue(ln);
+        if (lookupClientByID(t->client_id) == NULL) gtidBacklogTransferDone(ln);
+    }
+}
+
+static void gtidBacklogTransfersAbort(void) {
+    listIter li;
+    listNode *ln;
+    if (gtid_backlog_transfers == NULL) return;
+    listRewind(gtid_backlog_transfers,&li);
+    while ((ln = listNext(&li))) {
+        gtidBacklogTransfer *t = listNodeValue(ln);
+        if (lookupClientByID(t->client_id) != NULL) {
+            serverLog(LL_NOTICE, "[gtid] Abort limited backlog transfer to %s:"
+                    " backlog released.", replicationGetSlaveName(t->c));
+            connSetWriteHandler(t->c->conn,NULL);
+            freeClientAsync(t->c);
+        }
+        gtidBacklogTransferDone(ln);
+    }
+}
+
+/* Incremental aof files hold the same gtid commands as repl stream, so xsync
+ * could continue from them once gtids are trimmed from backlog. Each incr
+ * file gets a sparse index: runs of consecutive gnos of the same uuid, with
+ * first gno of each run and then one gno every GTID_AOF_INDEX_SAMPLE_BYTES
+ * sampled along with file offset of its transaction. Exact offset of a gtid
+ * is found by scanning commands forward from the nearest sample. Index of
+ * an incr file is saved to <incr file>.gtidx once the file is rotated.
+ * Interleaved uuids start a run per gtid, so runs of a file are capped at
+ * GTID_AOF_INDEX_MAX_RUN, beyond which the file is left unindexed. */
+#define GTID_AOF_INDEX_SAMPLE_BYTES (64*1024)
+#define GTID_AOF_INDEX_MAX_RUN 16384
+#define GTID_AOF_INDEX_SUFFIX ".gtidx"
+#define GTID_AOF_INDEX_MAX_UUID 256
+
+typedef struct gtidAofSample {
+    gno_t gno;
+    long long offset;
+} gtidAofSample;
+
+typedef struct gtidAofRun {
+    sds uuid;
+    gno_t start_gno;
+    gno_t end_gno; /* inclusive */
+    gtidAofSample *samples;
+    size_t nsample;
+    size_t capacity;
+} gtidAofRun;
+
+typedef struct gtidAofFileIndex {
+    sds file_name;
+    long long file_seq;
+    /* file offset index starts at, gtids before that (written before
+     * restart) are not indexed. -1 if file not indexed at all. */
+    long long indexed_from;
+    long long last_sample;
+    gtidAofRun *runs;
+    size_t nrun;
+    size_t capacity;
+    int saved;
+} gtidAofFileIndex;
+
+static struct {
+    list *files;            /* gtidAofFileIndex of incr files, oldest first */
+    long long multi_offset; /* offset of MULTI waiting for EXEC, -1 if none */
+    long long transfers;
+    long long transfer_bytes;
+    long long transfer_fails;
+} gtid_aof_index = {NULL, -1, 0, 0, 0};
+
+static int gtidAofIndexEnabled(void) {
+    /* timestamp annotations are not commands, slave can't take them. */
+    return server.aof_state == AOF_ON && server.aof_manifest != NULL &&
+        !server.aof_timestamp_enabled;
+}
+
+static long long gtidAofWriteOffset(void) {
+    return (long long)server.aof_last_incr_size + (long long)sdslen(server.aof_buf);
+}
+
+static sds gtidAofFilePath(const char *file_name) {
+    return sdscatfmt(sdsempty(),"%s/%s",server.aof_dirname,file_name);
+}
+
+static sds gtidAofIndexPath(const char *file_name) {
+    return sdscatfmt(sdsempty(),"%s/%s%s",server.aof_dirname,file_name,
+            GTID_AOF_INDEX_SUFFIX);
+}
+
+static gtidAofFileIndex *gtidAofFileIndexNew(aofInfo *ai,
+        long long indexed_from) {
+    gtidAofFileIndex *fi = zcalloc(sizeof(*fi));
+    fi->file_name = sdsdup(ai->file_name);
+    fi->file_seq = ai->file_seq;
+    fi->indexed_from = indexed_from;
+    fi->last_sample = -1;
+    return fi;
+}
+
+/* Drop index of file, gtids in it are not available for xsync any more. */
+static void gtidAofFileIndexDrop(gtidAofFileIndex *fi) {
+    for (size_t i = 0; i < fi->nrun; i++) {
+        sdsfree(fi->runs[i].uuid);
+        zfree(fi->runs[i].samples);
+    }
+    zfree(fi->runs);
+    fi->runs = NULL;
+    fi->nrun = fi->capacity = 0;
+    fi->indexed_from = -1;
+    fi->last_sample = -1;
+}
+
+static void gtidAofFileIndexFree(gtidAofFileIndex *fi) {
+    gtidAofFileIndexDrop(fi);
+    sdsfree(fi->file_name);
+    zfree(fi);
+}
+
+static gtidAofRun *gtidAofFileIndexAddRun(gtidAofFileIndex *fi,
+        const char *uuid, size_t uuid_len, gno_t gno) {
+    gtidAofRun *run;
+    if (fi->nrun == fi->capacity) {
+        fi->capacity = fi->capacity ? fi->capacity*2 : 4;
+        fi->runs = zrealloc(fi->runs,fi->capacity*sizeof(gtidAofRun));
+    }
+    run = &fi->runs[fi->nrun++];
+    memset(run,0,sizeof(*run));
+    run->uuid = sdsnewlen(uuid,uuid_len);
+    run->start_gno = run->end_gno = gno;
+    return run;
+}
+
+static void gtidAofRunAddSample(gtidAofRun *run, gno_t gno, long long offset) {
+    if (run->nsample == run->capacity) {
+        run->capacity = run->capacity ? run->capacity*2 : 4;
+        run->samples = zrealloc(run->samples,
+                run->capacity*sizeof(gtidAofSample));
+    }
+    run->samples[run->nsample].gno = gno;
+    run->samples[run->nsample].offset = offset;
+    run->nsample++;
+}
+
+static size_t gtidAofFileIndexMemory(gtidAofFileIndex *fi) {
+    size_t memory = zmalloc_size(fi) + sdsAllocSize(fi->file_name);
+    if (fi->runs) memory += zmalloc_size(fi->runs);
+    for (size_t i = 0; i < fi->nrun; i++) {
+        memory += sdsAllocSize(fi->runs[i].uuid);
+        if (fi->runs[i].samples) memory += zmalloc_size(fi->runs[i].samples);
+    }
+    return memory;
+}
+
+static int gtidAofFileIndexSave(gtidAofFileIndex *fi) {
+    sds path = gtidAofIndexPath(fi->file_name);
+    sds tmp = sdscat(sdsdup(path),".tmp");
+    FILE *fp = fopen(tmp,"w");
+    int ok = fp != NULL;
+
+    if (ok) ok = fprintf(fp,"gtidx %lld %lu\n",fi->indexed_from,
+            (unsigned long)fi->nrun) > 0;
+    for (size_t i = 0; ok && i < fi->nrun; i++) {
+        gtidAofRun *run = &fi->runs[i];
+        ok = fprintf(fp,"%s %lld %lld %lu\n",run->uuid,run->start_gno,
+                run->end_gno,(unsigned long)run->nsample) > 0;
+        for (size_t j = 0; ok && j < run->nsample; j++) {
+            ok = fprintf(fp,"%lld %lld\n",run->samples[j].gno,
+                    run->samples[j].offset) > 0;
+        }
+    }
+    if (fp && fclose(fp) == EOF) ok = 0;
+    if (ok && rename(tmp,path) == -1) ok = 0;
+    if (!ok) {
+        serverLog(LL_WARNING,"[gtid] Failed to save aof gtid index %s: %s",
+                path, strerror(errno));
+        unlink(tmp);
+    }
+    sdsfree(tmp);
+    sdsfree(path);
+    return ok ? C_OK : C_ERR;
+}
+
+/* Incr files without a valid saved index are left unindexed. */
+static gtidAofFileIndex *gtidAofFileIndexLoad(aofInfo *ai) {
+    gtidAofFileIndex *fi = gtidAofFileIndexNew(ai,-1);
+    sds path = gtidAofIndexPath(ai->file_name);
+    FILE *fp = fopen(path,"r");
+    char uuid[GTID_AOF_INDEX_MAX_UUID];
+    long long indexed_from;
+    unsigned long nrun, nsample;
+    gtidAofRun *run;
+    gno_t start_gno, end_gno, gno;
+    long long offset;
+
+    if (fp == NULL) goto end;
+    if (fscanf(fp,"gtidx %lld %lu\n",&indexed_from,&nrun) != 2) goto err;
+    for (unsigned long i = 0; i < nrun; i++) {
+        if (fscanf(fp,"%255s %lld %lld %lu\n",uuid,&start_gno,&end_gno,
+                    &nsample) != 4 || nsample == 0 || start_gno > end_gno)
+            goto err;
+        run = gtidAofFileIndexAddRun(fi,uuid,strlen(uuid),start_gno);
+        run->end_gno = end_gno;
+        for (unsigned long j = 0; j < nsample; j++) {
+            if (fscanf(fp,"%lld %lld\n",&gno,&offset) != 2) goto err;
+            gtidAofRunAddSample(run,gno,offset);
+        }
+    }
+    fi->indexed_from = indexed_from;
+    fi->saved = 1;
+    goto end;
+
+err:
+    serverLog(LL_WARNING,"[gtid] Ignored invalid aof gtid index %s.",path);
+    gtidAofFileIndexFree(fi);
+    fi = gtidAofFileIndexNew(ai,-1);
+end:
+    if (fp) fclose(fp);
+    sdsfree(path);
+    return fi;
+}
+
+/* Rebuild index list in the order of incr files in manifest: index of the
+ * file just rotated is saved, index of files gone (rewritten) is dropped
+ * along with the saved one, and the current file is indexed from current
+ * write offset. */
+static void gtidAofIndexSync(void) {
+    list *files = listCreate();
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.aof_manifest->incr_aof_list,&li);
+    while ((ln = listNext(&li))) {
+        aofInfo *ai = listNodeValue(ln);
+        gtidAofFileIndex *fi = NULL;
+        int current = ai->file_seq == server.aof_manifest->curr_incr_file_seq;
+
+        if (gtid_aof_index.files) {
+            listIter fli;
+            listNode *fln;
+            listRewind(gtid_aof_index.files,&fli);
+            while ((fln = listNext(&fli))) {
+                gtidAofFileIndex *f = listNodeValue(fln);
+                if (f->file_seq == ai->file_seq) {
+                    fi = f;
+                    listDelNode(gtid_aof_index.files,fln);
+                    break;
+                }
+            }
+        }
+
+        if (fi == NULL) {
+            fi = current ? gtidAofFileIndexNew(ai,gtidAofWriteOffset()) :
+                gtidAofFileIndexLoad(ai);
+        } else if (!current && !fi->saved && fi->indexed_from >= 0) {
+            fi->saved = gtidAofFileIndexSave(fi) == C_OK;
+        }
+        listAddNodeTail(files,fi);
+    }
+
+    if (gtid_aof_index.files) {
+        listRewind(gtid_aof_index.files,&li);
+        while ((ln = listNext(&li))) {
+            gtidAofFileIndex *fi = listNodeValue(ln);
+            sds path = gtidAofIndexPath(fi->file_name);
+            unlink(path);
+            sdsfree(path);
+            gtidAofFileIndexFree(fi);
+        }
+        listRelease(gtid_aof_index.files);
+    }
+    gtid_aof_index.files = files;
+}
+
+static gtidAofFileIndex *gtidAofIndexCurrent(void) {
+    gtidAofFileIndex *fi = NULL;
+
+    if (gtid_aof_index.files && listLength(gtid_aof_index.files))
+        fi = listNodeValue(listLast(gtid_aof_index.files));
+    if (fi == NULL || fi->file_seq != server.aof_manifest->curr_incr_file_seq) {
+        gtidAofIndexSync();
+        fi = listLength(gtid_aof_index.files) ?
+            listNodeValue(listLast(gtid_aof_index.files)) : NULL;
+    }
+    return fi;
+}
+
+static void gtidAofIndexFeed(robj **argv, long long offset) {
+    gtidAofFileIndex *fi;
+    gtidAofRun *run;
+    const char *uuid;
+    size_t uuid_len;
+    long long gno;
+
+    if (gtid_aof_index.multi_offset >= 0) {
+        offset = gtid_aof_index.multi_offset;
+        gtid_aof_index.multi_offset = -1;
+    }
+    if (!sdsEncodedObject(argv[1])) return;
+    uuid = uuidGnoDecode(argv[1]->ptr,sdslen(argv[1]->ptr),&gno,&uuid_len);
+    if (uuid == NULL || uuid_len >= GTID_AOF_INDEX_MAX_UUID) return;
+    if ((fi = gtidAofIndexCurrent()) == NULL || fi->indexed_from < 0) return;
+
+    run = fi->nrun ? &fi->runs[fi->nrun-1] : NULL;
+    if (run == NULL || gno != run->end_gno+1 ||
+            sdslen(run->uuid) != uuid_len ||
+            memcmp(run->uuid,uuid,uuid_len)) {
+        if (fi->nrun >= GTID_AOF_INDEX_MAX_RUN) {
+            serverLog(LL_WARNING,"[gtid] Aof gtid index of %s dropped: more"
+                    " than %d runs (interleaved uuids).", fi->file_name,
+                    GTID_AOF_INDEX_MAX_RUN);
+            gtidAofFileIndexDrop(fi);
+            return;
+        }
+        run = gtidAofFileIndexAddRun(fi,uuid,uuid_len,gno);
+        gtidAofRunAddSample(run,gno,offset);
+        fi->last_sample = offset;
+    } else {
+        run->end_gno = gno;
+        if (offset - fi->last_sample >= GTID_AOF_INDEX_SAMPLE_BYTES) {
+            gtidAofRunAddSample(run,gno,offset);
+            fi->last_sample = offset;
+        }
+    }
+}
+
+static int gtidAofReadLine(FILE *fp, char *buf, size_t size, char type,
+        long long *value, long long *pos) {
+    size_t len;
+    if (fgets(buf,size,fp) == NULL) return C_ERR;
+    len = strlen(buf);
+    if (len < 4 || buf[0] != type || buf[len-2] != '\r' ||
+            !string2ll(buf+1,len-3,value))
+        return C_ERR;
+    *pos += len;
+    return C_OK;
+}
+
+/* Scan commands from file offset, returns offset of the transaction (along
+ * with SELECT before it) of the first gtid of uuid with gno >= given gno,
+ * -1 if not found. */
+static long long gtidAofScan(FILE *fp, long long pos, const char *uuid,
+        size_t uuid_len, gno_t gno) {
+    char line[64], arg[GTID_AOF_INDEX_MAX_UUID+32];
+    long long txn_start = -1;
+    int in_multi = 0;
+
+    if (fseeko(fp,pos,SEEK_SET) == -1) return -1;
+    while (1) {
+        long long cmd_start = pos, argc, len, g;
+        int is_gtid = 0, matched = 0;
+        size_t ulen;
+
+        if (gtidAofReadLine(fp,line,sizeof(line),'*',&argc,&pos) == C_ERR ||
+                argc < 1)
+            return -1;
+        for (long long j = 0; j < argc; j++) {
+            if (gtidAofReadLine(fp,line,sizeof(line),'$',&len,&pos) == C_ERR)
+                return -1;
+            if (j <= 1 && len+2 <= (long long)sizeof(arg)) {
+                if (fread(arg,1,len+2,fp) != (size_t)len+2) return -1;
+                if (j == 0) {
+                    is_gtid = len == 4 && !strncasecmp(arg,"gtid",4);
+                    if (len == 5 && !strncasecmp(arg,"multi",5)) in_multi = 1;
+                    if (is_gtid || in_multi ||
+                            (len == 6 && !strncasecmp(arg,"select",6))) {
+                        if (txn_start < 0) txn_start = cmd_start;
+                    } else {
+                        txn_start = -1;
+                    }
+                } else if (is_gtid) {
+                    matched = uuidGnoDecode(arg,len,&g,&ulen) != NULL &&
+                        ulen == uuid_len && !memcmp(arg,uuid,ulen) && g >= gno;
+                }
+            } else if (fseeko(fp,len+2,SEEK_CUR) == -1) {
+                return -1;
+            }
+            pos += len+2;
+        }
+        if (is_gtid) {
+            if (matched) return txn_start;
+            txn_start = -1;
+            in_multi = 0;
+        }
+    }
+}
+
+/* Locate transaction offset of gno in run of file. */
+static long long gtidAofLocate(gtidAofFileIndex *fi, gtidAofRun *run,
+        gno_t gno) {
+    sds path = gtidAofFilePath(fi->file_name);
+    FILE *fp = fopen(path,"r");
+    long long offset = -1;
+    size_t i = 0;
+
+    if (fp != NULL) {
+        while (i+1 < run->nsample && run->samples[i+1].gno <= gno) i++;
+        offset = run->samples[i].gno == gno ? run->samples[i].offset :
+            gtidAofScan(fp,run->samples[i].offset,run->uuid,
+                    sdslen(run->uuid),gno);
+        fclose(fp);
+    }
+    sdsfree(path);
+    return offset;
+}
+
+static long long gtidAofFileSize(gtidAofFileIndex *fi) {
+    struct redis_stat sb;
+    sds path = gtidAofFilePath(fi->file_name);
+    long long size = redis_stat(path,&sb) == -1 ? -1 : (long long)sb.st_size;
+    sdsfree(path);
+    return size;
+}
+
+/* Locate xsync continue point in aof, walking back from gtid uuid:gno (the
+ * first gtid in backlog) the same way gtidSeqXsync does. Returns aof ranges
+ * from continue point up to uuid:gno and gtids in them, NULL if gtid not
+ * found in aof, nothing to continue or ranges exceed maxbytes. */
+gtidAofRange *gtidAofXsync(gtidSet *req, const char *uuid, size_t uuid_len,
+        gno_t gno, long long maxbytes, gtidSet **pcont) {
+    listNode *ln, *join_ln = NULL, *cont_ln = NULL;
+    gtidAofFileIndex *fi;
+    gtidAofRun *join_run = NULL, *cont_run = NULL;
+    gno_t cont_gno = 0;
+    long long join_offset, cont_offset;
+    gtidAofRange *range;
+    gtidSet *cont;
+    int nfile = 0, i;
+
+    if (!gtidAofIndexEnabled()) return NULL;
+    gtidAofIndexSync();
+
+    for (ln = listLast(gtid_aof_index.files); ln && !join_run;
+            ln = listPrevNode(ln)) {
+        fi = listNodeValue(ln);
+        for (size_t r = fi->nrun; r > 0; r--) {
+            gtidAofRun *run = &fi->runs[r-1];
+            if (sdslen(run->uuid) == uuid_len &&
+                    !memcmp(run->uuid,uuid,uuid_len) &&
+                    gno >= run->start_gno && gno <= run->end_gno) {
+                join_ln = ln, join_run = run;
+                break;
+            }
+        }
+    }
+    if (join_run == NULL) return NULL;
+
+    cont = gtidSetNew();
+    ln = join_ln;
+    fi = listNodeValue(ln);
+    for (gtidAofRun *run = join_run; run != NULL; ) {
+        gno_t end_gno = run == join_run ? gno-1 : run->end_gno;
+        gno_t next_gno = gtidSetNext(req,run->uuid,sdslen(run->uuid),0);
+
+        if (end_gno >= run->start_gno) {
+            if (next_gno > end_gno) break;
+            cont_ln = ln, cont_run = run;
+            if (next_gno > run->start_gno) {
+                cont_gno = next_gno;
+                gtidSetAdd(cont,run->uuid,sdslen(run->uuid),next_gno,end_gno);
+                break;
+            }
+            cont_gno = run->start_gno;
+            gtidSetAdd(cont,run->uuid,sdslen(run->uuid),run->start_gno,end_gno);
+        }
+
+        if (run != fi->runs) {
+            run--;
+            continue;
+        }
+        /* walk on to previous file unless gtids before are not indexed. */
+        run = NULL;
+        while (fi->indexed_from == 0 && (ln = listPrevNode(ln)) != NULL) {
+            fi = listNodeValue(ln);
+            if (fi->nrun) {
+                run = &fi->runs[fi->nrun-1];
+                break;
+            }
+        }
+    }
+
+    if (cont_run == NULL ||
+            (join_offset = gtidAofLocate(listNodeValue(join_ln),join_run,gno)) < 0 ||
+            (cont_offset = gtidAofLocate(listNodeValue(cont_ln),cont_run,cont_gno)) < 0) {
+        gtidSetFree(cont);
+        return NULL;
+    }
+
+    for (ln = cont_ln; ln != join_ln; ln = listNextNode(ln)) nfile++;
+    nfile++;
+
+    range = zcalloc(sizeof(*range));
+    range->nfile = nfile;
+    range->paths = zcalloc(nfile*sizeof(sds));
+    range->starts = zcalloc(nfile*sizeof(long long));
+    range->ends = zcalloc(nfile*sizeof(long long));
+    for (i = 0, ln = cont_ln; i < nfile; i++, ln = listNextNode(ln)) {
+        fi = listNodeValue(ln);
+        range->paths[i] = gtidAofFilePath(fi->file_name);
+        range->starts[i] = i == 0 ? cont_offset : 0;
+        range->ends[i] = ln == join_ln ? join_offset : gtidAofFileSize(fi);
+        if (range->ends[i] < range->starts[i]) range->bytes = -1;
+        if (range->bytes >= 0) range->bytes += range->ends[i]-range->starts[i];
+    }
+
+    if (range->bytes <= 0 || range->bytes > maxbytes) {
+        gtidAofRangeFree(range);
+        gtidSetFree(cont);
+        return NULL;
+    }
+
+    if (pcont) {
+        *pcont = cont;
+    } else {
+        gtidSetFree(cont);
+    }
+    return range;
+}
+
+/* Aof ranges are streamed by our own write handler like limited backlog
+ * transfer, backlog block of offset is pinned meanwhile so that slave could
+ * be attached right after ranges flushed. Short read means the range is not
+ * written to file yet (aof_buf not flushed), transfer is resumed by cron. */
+typedef struct gtidAofTransfer {
+    uint64_t client_id;
+    client *c;
+    gtidAofRange *range;
+    int *fds;
+    int cur;            /* file being sent */
+    long long pos;      /* next byte to read in current file */
+    char buf[PROTO_IOBUF_LEN];
+    size_t buflen;
+    size_t bufpos;
+    listNode *node;     /* referenced repl buffer block */
+    long long offset;   /* backlog offset slave attached at */
+    int stalled;
+} gtidAofTransfer;
+
+static list *gtid_aof_transfers = NULL;
+
+static void gtidAofTransferDone(listNode *ln) {
+    gtidAofTransfer *t = listNodeValue(ln);
+    replBufBlock *o = listNodeValue(t->node);
+    o->refcount--;
+    for (int i = 0; i < t->range->nfile; i++)
+        if (t->fds[i] != -1) close(t->fds[i]);
+    zfree(t->fds);
+    gtidAofRangeFree(t->range);
+    listDelNode(gtid_aof_transfers,ln);
+    zfree(t);
+    incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+static listNode *gtidAofTransferFind(client *c) {
+    listIter li;
+    listNode *ln;
+    if (gtid_aof_transfers == NULL) return NULL;
+    listRewind(gtid_aof_transfers,&li);
+    while ((ln = listNext(&li))) {
+        gtidAofTransfer *t = listNodeValue(ln);
+        if (t->c == c && t->client_id == c->id) return ln;
+    }
+    return NULL;
+}
+
+static void gtidAofTransferFail(listNode *ln, const char *err) {
+    gtidAofTransfer *t = listNodeValue(ln);
+    client *c = t->c;
+    serverLog(LL_WARNING, "[gtid] Failed to send aof to %s: %s",
+            replicationGetSlaveName(c), err);
+    connSetWriteHandler(c->conn,NULL);
+    gtidAofTransferDone(ln);
+    gtid_aof_index.transfer_fails++;
+    freeClientAsync(c);
+}
+
+static void gtidAofTransferWriteHandler(connection *conn) {
+    client *c = connGetPrivateData(conn);
+    listNode *ln = gtidAofTransferFind(c);
+    gtidAofTransfer *t;
+    gtidAofRange *range;
+    size_t totwritten = 0;
+
+    if (ln == NULL) {
+        connSetWriteHandler(conn,NULL);
+        return;
+    }
+    t = listNodeValue(ln);
+    range = t->range;
+
+    while (t->bufpos < t->buflen || t->cur < range->nfile) {
+        if (t->bufpos == t->buflen) {
+            long long len = range->ends[t->cur] - t->pos;
+            ssize_t nread;
+
+            if (len == 0) {
+                if (++t->cur < range->nfile) t->pos = range->starts[t->cur];
+                continue;
+            }
+            if (len > (long long)sizeof(t->buf)) len = sizeof(t->buf);
+            nread = pread(t->fds[t->cur],t->buf,len,t->pos);
+            if (nread < 0) {
+                gtidAofTransferFail(ln,strerror(errno));
+                return;
+            } else if (nread == 0) {
+                connSetWriteHandler(conn,NULL);
+                t->stalled = 1;
+                return;
+            }
+            t->pos += nread;
+            t->buflen = nread, t->bufpos = 0;
+        }
+
+        ssize_t nwritten = connWrite(conn,t->buf+t->bufpos,t->buflen-t->bufpos);
+        if (nwritten <= 0) {
+            if (connGetState(conn) != CONN_STATE_CONNECTED)
+                gtidAofTransferFail(ln,connGetLastError(conn));
+            return;
+        }
+        t->bufpos += nwritten;
+        totwritten += nwritten;
+        gtid_aof_index.transfer_bytes += nwritten;
+        server.stat_net_repl_output_bytes += nwritten;
+        if (totwritten > NET_MAX_WRITES_PER_EVENT) return;
+    }
+
+    serverLog(LL_NOTICE, "[gtid] Sent %lld bytes of aof to %s.",
+            range->bytes, replicationGetSlaveName(c));
+    connSetWriteHandler(conn,NULL);
+    /* attach before unpinning so that block of offset is not trimmed. */
+    masterAttachPartialSlave(c,t->offset);
+    gtidAofTransferDone(ln);
+}
+
+void gtidSendAofRange(client *c, gtidAofRange *range, long long offset) {
+    gtidAofTransfer *t;
+    replBufBlock *o;
+
+    t = zcalloc(sizeof(*t));
+    t->client_id = c->id;
+    t->c = c;
+    t->range = range;
+    t->fds = zmalloc(range->nfile*sizeof(int));
+    for (int i = 0; i < range->nfile; i++) t->fds[i] = -1;
+    t->pos = range->starts[0];
+    t->offset = offset;
+    t->node = gtidBacklogSeekBlock(offset);
+    o = listNodeValue(t->node);
+    o->refcount++;
+
+    if (gtid_aof_transfers == NULL) gtid_aof_transfers = listCreate();
+    listAddNodeTail(gtid_aof_transfers,t);
+    gtid_aof_index.transfers++;
+
+    /* Files are opened upfront, rewrite might remove them meanwhile. */
+    for (int i = 0; i < range->nfile; i++) {
+        if ((t->fds[i] = open(range->paths[i],O_RDONLY)) == -1) {
+            gtidAofTransferFail(listLast(gtid_aof_transfers),strerror(errno));
+            return;
+        }
+    }
+
+    if (connSetWriteHandler(c->conn,gtidAofTransferWriteHandler) == C_ERR)
+        gtidAofTransferFail(listLast(gtid_aof_transfers),"set write handler");
+}
+
+static void gtidAofTransfersAbort(void) {
+    listIter li;
+    listNode *ln;
+    if (gtid_aof_transfers == NULL) return;
+    listRewind(gtid_aof_transfers,&li);
+    while ((ln = listNext(&li))) {
+        gtidAofTransfer *t = listNodeValue(ln);
+        if (lookupClientByID(t->client_id) != NULL) {
+            gtidAofTransferFail(ln,"backlog released");
+        } else {
+            gtidAofTransferDone(ln);
+        }
+    }
+}
+
+/* Transfers are not in server.slaves but pin repl buffer blocks, so they
+ * must be closed before backlog (and repl buffer) is freed. */
+void gtidReplTransfersAbort(void) {
+    gtidBacklogTransfersAbort();
+    gtidAofTransfersAbort();
+}
+
+/* Release transfers of freed clients, resume stalled ones. */
+void gtidAofTransferCron(void) {
+    listIter li;
+    listNode *ln;
+    if (gtid_aof_transfers == NULL) return;
+    listRewind(gtid_aof_transfers,&li);
+    while ((ln = listNext(&li))) {
+        gtidAofTransfer *t = listNodeValue(ln);
+        if (lookupClientByID(t->client_id) == NULL) {
+            gtidAofTransferDone(ln);
+        } else if (t->stalled) {
+            t->stalled = 0;
+            if (connSetWriteHandler(t->c->conn,
+                        gtidAofTransferWriteHandler) == C_ERR)
+                gtidAofTransferFail(ln,"set write handler");
+        }
+    }
+}
+
+size_t gtidAofIndexUsedMemory(void) {
+    listIter li;
+    listNode *ln;
+    size_t memory = 0;
+    if (gtid_aof_index.files == NULL) return 0;
+    listRewind(gtid_aof_index.files,&li);
+    while ((ln = listNext(&li)))
+        memory += gtidAofFileIndexMemory(listNodeValue(ln));
+    return memory;
+}
+
+sds gtidAofIndexCatInfo(sds info) {
+    listIter li;
+    listNode *ln;
+    unsigned long nfile = 0, nrun = 0, nsample = 0;
+
+    if (gtid_aof_index.files) {
+        listRewind(gtid_aof_index.files,&li);
+        while ((ln = listNext(&li))) {
+            gtidAofFileIndex *fi = listNodeValue(ln);
+            if (fi->indexed_from < 0) continue;
+            nfile++;
+            nrun += fi->nrun;
+            for (size_t i = 0; i < fi->nrun; i++)
+                nsample += fi->runs[i].nsample;
+        }
+    }
+    return sdscatprintf(info,
+            "gtid_aof_index:files=%lu,runs=%lu,samples=%lu,used_memory=%lu,"
+            "transfers=%lld,transfer_bytes=%lld,transfer_fails=%lld\r\n",
+            nfile, nrun, nsample, gtidAofIndexUsedMemory(),
+            gtid_aof_index.transfers, gtid_aof_index.transfer_bytes,
+            gtid_aof_index.transfer_fails);
+}
+
+/* Reply index of incr aof files: file name, offset index starts at (-1 if
+ * not indexed) and gtid set of the indexed part. */
+void gtidAofIndexCommand(client *c) {
+    listIter li;
+    listNode *ln;
+
+    if (!gtidAofIndexEnabled()) {
+        addReplyArrayLen(c,0);
+        return;
+    }
+    gtidAofIndexSync();
+    addReplyArrayLen(c,listLength(gtid_aof_index.files));
+    listRewind(gtid_aof_index.files,&li);
+    while ((ln = listNext(&li))) {
+        gtidAofFileIndex *fi = listNodeValue(ln);
+        gtidSet *gtid_set = gtidSetNew();
+        for (size_t i = 0; i < fi->nrun; i++) {
+            gtidAofRun *run = &fi->runs[i];
+            gtidSetAdd(gtid_set,run->uuid,sdslen(run->uuid),run->start_gno,
+                    run->end_gno);
+        }
+        addReplyArrayLen(c,3);
+        addReplyBulkCBuffer(c,fi->file_name,sdslen(fi->file_name));
+        addReplyLongLong(c,fi->indexed_from);
+        addReplyBulkSds(c,gtidSetDump(gtid_set));
+        gtidSetFree(gtid_set);
+    }
+}
+
+/* aof-load-until-gtid: point-in-time recovery loads aof up to (excluding)
+ * the transaction of given gtid. Incr file containing it is located by its
+ * gtid index (scanned if not indexed) and loaded up to the transaction,
+ * files after it are skipped. Once reached, aof is rewritten so that later
+ * writes do not follow the skipped tail.
+ *
+ * It is one-shot: the config is cleared once the limit is reached, and
+ * after the rewrite the gtid is recorded in GTID_AOF_LOAD_DONE of aof dir,
+ * so that restarting with the same config does not cut the rewritten aof. */
+#define GTID_AOF_LOAD_DONE "aof-load-until-gtid.done"
+
+static struct {
+    int reached;
+    int rewrite_scheduled;
+    long long base_seq;     /* base file seq before rewrite */
+    sds until;              /* gtid reached */
+} gtid_aof_load;
+
+static long long gtidAofBaseSeq(void) {
+    return server.aof_manifest && server.aof_manifest->base_aof_info ?
+        server.aof_manifest->base_aof_info->file_seq : 0;
+}
+
+/* Gtid of the applied (and rewritten) aof-load-until-gtid, NULL if none. */
+static sds gtidAofLoadDoneGet(void) {
+    sds path = gtidAofFilePath(GTID_AOF_LOAD_DONE);
+    FILE *fp = fopen(path,"r");
+    char buf[GTID_AOF_INDEX_MAX_UUID+32];
+    sds done = NULL;
+
+    if (fp != NULL) {
+        if (fgets(buf,sizeof(buf),fp) != NULL)
+            done = sdstrim(sdsnew(buf),"\r\n");
+        fclose(fp);
+    }
+    sdsfree(path);
+    return done;
+}
+
+static void gtidAofLoadDoneSet(sds until) {
+    sds path = gtidAofFilePath(GTID_AOF_LOAD_DONE);
+    FILE *fp = fopen(path,"w");
+    int ok = fp != NULL && fprintf(fp,"%s\n",until) > 0;
+
+    if (fp && fclose(fp) == EOF) ok = 0;
+    if (!ok) {
+        serverLog(LL_WARNING,"[gtid] Failed to save %s: %s, restart with"
+                " aof-load-until-gtid %s would cut aof again.", path,
+                strerror(errno), until);
+    }
+    sdsfree(path);
+}
+
+/* Bytes of incr aof file to load, -1 for the whole file. */
+long long ctrip_aofLoadLimit(sds file_name) {
+    aofInfo ai = {0};
+    gtidAofFileIndex *fi;
+    char *until = server.gtid_aof_load_until, *uuid;
+    size_t uuid_len;
+    gno_t gno;
+    long long limit = -1;
+    int holds = 0;
+
+    if (until == NULL || until[0] == '\0') return -1;
+    if (gtid_aof_load.reached) return 0;
+    uuid = uuidGnoDecode(until,strlen(until),&gno,&uuid_len);
+    if (uuid == NULL || gno < GTID_GNO_INITIAL) {
+        serverLog(LL_WARNING,"[gtid] Invalid aof-load-until-gtid %s ignored.",
+                until);
+        return -1;
+    }
+
+    sds done = gtidAofLoadDoneGet();
+    if (done != NULL && !strcmp(done,until)) {
+        serverLog(LL_WARNING,"[gtid] aof-load-until-gtid %s already applied"
+                " and aof rewritten, ignored.", until);
+        sdsfree(done);
+        return -1;
+    }
+    sdsfree(done);
+
+    ai.file_name = file_name;
+    fi = gtidAofFileIndexLoad(&ai);
+    if (fi->indexed_from == 0) {
+        for (size_t i = 0; i < fi->nrun; i++) {
+            gtidAofRun *run = &fi->runs[i];
+            if (sdslen(run->uuid) != uuid_len ||
+                    memcmp(run->uuid,uuid,uuid_len) || run->end_gno < gno)
+                continue;
+            holds = 1;
+            limit = gtidAofLocate(fi,run,gno > run->start_gno ?
+                    gno : run->start_gno);
+            if (limit < 0) {
+                serverLog(LL_WARNING,"[gtid] Failed to locate %s in %s by"
+                        " index, scanning file.", until, file_name);
+            }
+            break;
+        }
+    }
+    if (limit < 0 && (fi->indexed_from != 0 || holds)) {
+        sds path = gtidAofFilePath(file_name);
+        FILE *fp = fopen(path,"r");
+        if (fp) {
+            limit = gtidAofScan(fp,0,uuid,uuid_len,gno);
+            fclose(fp);
+        }
+        sdsfree(path);
+    }
+    if (limit < 0 && holds) {
+        /* loading the whole file would go beyond the gtid requested. */
+        serverLog(LL_WARNING,"[gtid] Failed to locate %s in %s, which holds"
+                " gtids up to it, aof-load-until-gtid can't be applied.",
+                until, file_name);
+        exit(1);
+    }
+    gtidAofFileIndexFree(fi);
+
+    if (limit >= 0) {
+        gtid_aof_load.reached = 1;
+        gtid_aof_load.until = sdsnew(until);
+        serverLog(LL_NOTICE,"[gtid] Loading aof until gtid %s: stop at"
+                " offset %lld of %s, later incr files skipped.",
+                until, limit, file_name);
+    }
+    return limit;
+}
+
+/* Called by cron after loading. */
+void gtidAofLoadCron(void) {
+    if (!gtid_aof_load.reached) return;
+    if (!gtid_aof_load.rewrite_scheduled) {
+        if (server.aof_state != AOF_ON) return;
+        /* one-shot, later loads (e.g. DEBUG LOADAOF) load aof as is. */
+        zfree(server.gtid_aof_load_until);
+        server.gtid_aof_load_until = NULL;
+        gtid_aof_load.rewrite_scheduled = 1;
+        gtid_aof_load.base_seq = gtidAofBaseSeq();
+        server.aof_rewrite_scheduled = 1;
+        serverLog(LL_NOTICE,"[gtid] Aof loaded until gtid %s, rewrite"
+                " scheduled to drop the tail not loaded.", gtid_aof_load.until);
+        return;
     }
+    if (gtidAofBaseSeq() == gtid_aof_load.base_seq) return;
+    gtidAofLoadDoneSet(gtid_aof_load.until);
+    serverLog(LL_NOTICE,"[gtid] Aof rewritten after loading until gtid %s.",
+            gtid_aof_load.until);
+    sdsfree(gtid_aof_load.until);
+    memset(&gtid_aof_load,0,sizeof(gtid_aof_load));
 }
 
 void gtidClearReplStartCmdStreamOnAck(client* c) {
     c->repl_start_cmd_stream_on_ack = 0;
 }
 
+/* Blocked the way WAIT does, but never unblocked by acked offset (nor host
+ * timeout): WAITGTID waiters are unblocked by gtid watermarks. */
+void gtidBlockForReplication(client *c, long numreplicas) {
+    blockForReplication(c,0,LLONG_MAX,numreplicas);
+}
+
+void gtidUnblockClient(client *c) {
+    unblockClient(c,1);
+}
+
 void gtidFreeClientAsync(client* c) {
     serverLog(LL_WARNING, "add CLIENT_CLOSE_AFTER_REPLY is CLIENT_CLOSE_ASAP %d", c->flags & CLIENT_CLOSE_ASAP);
     freeClientAsync(c);
@@ -192,37 +1267,41 @@ void gtidAfterErrorReply(client *c, const char *s, size_t len, int flags) {
 }
 
 void feedAppendOnlyFileGtid(struct redisCommand* cmd, int dictid, robj **argv, int argc) {
-    sds buf = sdsempty();
-
     if(cmd == NULL) cmd = lookupCommandByCString(argv[GTID_COMMAN_ARGC]->ptr);
     serverAssert(cmd != NULL);
 
+    int to_aof = server.aof_state == AOF_ON ||
+        (server.aof_state == AOF_WAIT_REWRITE && server.child_type == CHILD_TYPE_AOF);
+
+    if (gtidAofIndexEnabled()) gtidAofIndexFeed(argv,gtidAofWriteOffset());
+
+    /* Append straight into aof_buf, no intermediate buffer. */
     if (dictid != -1 && dictid != server.aof_selected_db) {
-        char seldb[64];
+        if (to_aof) {
+            char seldb[64];
 
-        snprintf(seldb,sizeof(seldb),"%d",dictid);
-        buf = sdscatprintf(buf,"*2\r\n$6\r\nSELECT\r\n$%lu\r\n%s\r\n",
-            (unsigned long)strlen(seldb),seldb);
+            snprintf(seldb,sizeof(seldb),"%d",dictid);
+            server.aof_buf = sdscatprintf(server.aof_buf,"*2\r\n$6\r\nSELECT\r\n$%lu\r\n%s\r\n",
+                (unsigned long)strlen(seldb),seldb);
+        }
         server.aof_selected_db = dictid;
     }
 
     /* All commands should be propagated the same way in AOF as in replication.
      * No need for AOF-specific translation. */
-    buf = catAppendOnlyGenericCommand(buf,argc,argv);
-
-    if (server.aof_state == AOF_ON ||
-        (server.aof_state == AOF_WAIT_REWRITE && server.child_type == CHILD_TYPE_AOF))
-        server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
-
-    sdsfree(buf);
+    if (to_aof) server.aof_buf = catAppendOnlyGtidCommand(server.aof_buf,argc,argv);
 }
 
 void ctrip_feedAppendOnlyFile(struct redisCommand *cmd, int dictid,
         robj **argv, int argc) {
-    if (isGtidCommand(cmd)) 
+    if (isGtidCommand(cmd)) {
         feedAppendOnlyFileGtid(cmd,dictid,argv,argc);
-    else
+    } else {
+        /* gtid of transaction is indexed at MULTI (and SELECT before). */
+        if (gtidAofIndexEnabled() && !strcasecmp(argv[0]->ptr,"multi"))
+            gtid_aof_index.multi_offset = gtidAofWriteOffset();
         feedAppendOnlyFile(dictid,argv,argc);
+    }
 }
 
 struct redisCommand* gtidGetGtidCommand() {
@@ -276,6 +1355,16 @@ void gtidMockClientMoveClientArgv(client* c) {
     c->argv_len = 0;
 }
 
+int gtidClientGetArgvLen(client *c) {
+    return c->argv_len;
+}
+
+void gtidClientSetArgv(client *c, robj **argv, int argc, int argv_len) {
+    c->argv = argv;
+    c->argc = argc;
+    c->argv_len = argv_len;
+}
+
 
 long long gtidBacklogAppendToSds(long long offset, sds *dst, size_t size) {
     if (server.repl_backlog == NULL || server.repl_backlog->histlen == 0)
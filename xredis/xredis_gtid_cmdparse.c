@@ -1,6 +1,12 @@
 #include "xredis_gtid_cmdparse.h"
 #include "xredis_gtid_adaptation_version.h"
 #include "server.h"
+#include <ctype.h>
+
+/* Option match without strcasecmp on every candidate: length first. */
+static inline int cmdParseIsOption(sds arg, const char *opt, size_t optlen) {
+    return sdslen(arg) == optlen && !strncasecmp(arg, opt, optlen);
+}
 
 /* --- hset / hmset：one key + subkeys（field）, step 2, from argv[2] start  --- */
 static void cmdParseHset(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
@@ -30,9 +36,9 @@ static void cmdParseZadd(int dbid, struct redisCommand *cmd, robj **argv, int ar
     int i = 2;
     while (i < argc) {
         sds arg = (sds)argv[i]->ptr;
-        if (!strcasecmp(arg, "nx") || !strcasecmp(arg, "xx") ||
-            !strcasecmp(arg, "ch") || !strcasecmp(arg, "incr") ||
-            !strcasecmp(arg, "gt") || !strcasecmp(arg, "lt")) {
+        if (cmdParseIsOption(arg, "nx", 2) || cmdParseIsOption(arg, "xx", 2) ||
+            cmdParseIsOption(arg, "ch", 2) || cmdParseIsOption(arg, "incr", 4) ||
+            cmdParseIsOption(arg, "gt", 2) || cmdParseIsOption(arg, "lt", 2)) {
             i++;
         } else {
             break;
@@ -56,7 +62,8 @@ static void cmdParseGeoAdd(int dbid, struct redisCommand *cmd, robj **argv, int
     int i = 2;
     while (i < argc) {
         sds arg = (sds)argv[i]->ptr;
-        if (!strcasecmp(arg, "nx") || !strcasecmp(arg, "xx") || !strcasecmp(arg, "ch")) {
+        if (cmdParseIsOption(arg, "nx", 2) || cmdParseIsOption(arg, "xx", 2) ||
+            cmdParseIsOption(arg, "ch", 2)) {
             i++;
         } else {
             break;
@@ -75,39 +82,248 @@ static void cmdParseGeoDist(int dbid, struct redisCommand *cmd, robj **argv, int
 
 
 
+/* ---- range style writes: one key + cmdParseKeyExtra ---- */
+
+/* lpop/rpop key [count] */
+static void cmdParsePop(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
+    long long count = 1;
+    if (argc >= 3 && (getLongLongFromObject(argv[2], &count) != C_OK || count <= 0)) {
+        on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, NULL);
+        return;
+    }
+    cmdParseKeyExtra extra = {.extra_type = CMDPARSE_EXTRA_RANGE};
+    sds name = argv[0]->ptr;
+    if (tolower((unsigned char)name[0]) == 'r') {
+        extra.range.start = -count;
+        extra.range.end = -1;
+    } else {
+        extra.range.start = 0;
+        extra.range.end = count - 1;
+    }
+    on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, &extra);
+}
+
+/* ltrim key start stop: everything outside [start,stop] is removed */
+static void cmdParseLtrim(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
+    serverAssert(argc >= 4);
+    cmdParseKeyExtra extra = {.extra_type = CMDPARSE_EXTRA_RANGE};
+    if (getLongLongFromObject(argv[2], &extra.range.start) != C_OK ||
+        getLongLongFromObject(argv[3], &extra.range.end) != C_OK) {
+        on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, NULL);
+        return;
+    }
+    extra.range.invert = 1;
+    on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, &extra);
+}
+
+/* lset key index element */
+static void cmdParseLset(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
+    serverAssert(argc >= 4);
+    cmdParseKeyExtra extra = {.extra_type = CMDPARSE_EXTRA_RANGE};
+    if (getLongLongFromObject(argv[2], &extra.range.start) != C_OK) {
+        on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, NULL);
+        return;
+    }
+    extra.range.end = extra.range.start;
+    on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, &extra);
+}
+
+/* lrem key count element: positions depend on content, so the removed
+ * element is recorded as subkey instead of a range. */
+static void cmdParseLrem(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
+    serverAssert(argc >= 4);
+    on_key(ctx, dbid, cmd, argv, argc, 1, 1, 3, 1, NULL, NULL);
+}
+
+static int cmdParseScoreBound(sds arg, double *score, int *ex) {
+    char *eptr;
+    *ex = 0;
+    if (arg[0] == '(') {
+        *ex = 1;
+        arg++;
+    }
+    *score = strtod(arg, &eptr);
+    if (eptr[0] != '\0' || isnan(*score)) return C_ERR;
+    return C_OK;
+}
+
+static int cmdParseLexBound(sds arg, int *ex) {
+    *ex = 0;
+    if ((arg[0] == '-' || arg[0] == '+') && arg[1] == '\0') return C_OK;
+    if (arg[0] == '(') *ex = 1;
+    else if (arg[0] != '[') return C_ERR;
+    return C_OK;
+}
+
+/* zremrangebyscore key min max */
+static void cmdParseZremrangeByScore(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
+    serverAssert(argc >= 4);
+    cmdParseKeyExtra extra = {.extra_type = CMDPARSE_EXTRA_ZSCORE};
+    if (cmdParseScoreBound(argv[2]->ptr, &extra.zscore.min, &extra.zscore.minex) != C_OK ||
+        cmdParseScoreBound(argv[3]->ptr, &extra.zscore.max, &extra.zscore.maxex) != C_OK) {
+        on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, NULL);
+        return;
+    }
+    on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, &extra);
+}
+
+/* zremrangebylex key min max */
+static void cmdParseZremrangeByLex(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
+    serverAssert(argc >= 4);
+    cmdParseKeyExtra extra = {.extra_type = CMDPARSE_EXTRA_ZLEX};
+    if (cmdParseLexBound(argv[2]->ptr, &extra.zlex.minex) != C_OK ||
+        cmdParseLexBound(argv[3]->ptr, &extra.zlex.maxex) != C_OK) {
+        on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, NULL);
+        return;
+    }
+    extra.zlex.min = argv[2];
+    extra.zlex.max = argv[3];
+    on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, &extra);
+}
+
+/* zremrangebyrank key start stop */
+static void cmdParseZremrangeByRank(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
+    serverAssert(argc >= 4);
+    cmdParseKeyExtra extra = {.extra_type = CMDPARSE_EXTRA_ZRANK};
+    if (getLongLongFromObject(argv[2], &extra.zrank.start) != C_OK ||
+        getLongLongFromObject(argv[3], &extra.zrank.end) != C_OK) {
+        on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, NULL);
+        return;
+    }
+    on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, &extra);
+}
+
+/* setbit key offset value */
+static void cmdParseSetbit(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
+    serverAssert(argc >= 4);
+    cmdParseKeyExtra extra = {.extra_type = CMDPARSE_EXTRA_BITOFF};
+    if (getLongLongFromObject(argv[2], &extra.bitoff.offset) != C_OK || extra.bitoff.offset < 0) {
+        on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, NULL);
+        return;
+    }
+    on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, &extra);
+}
+
+/* setrange key offset value: byte range converted to bits */
+static void cmdParseSetrange(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
+    serverAssert(argc >= 4);
+    long long offset;
+    size_t len = sdslen(argv[3]->ptr);
+    if (getLongLongFromObject(argv[2], &offset) != C_OK || offset < 0 || len == 0 ||
+        offset > (LLONG_MAX >> 3) - (long long)len) {
+        on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, NULL);
+        return;
+    }
+    cmdParseKeyExtra extra = {.extra_type = CMDPARSE_EXTRA_BITRNG};
+    extra.bitrng.start = offset << 3;
+    extra.bitrng.end = ((offset + (long long)len) << 3) - 1;
+    on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, &extra);
+}
+
+/* bitfield key [GET type offset] [SET type offset value]
+ * [INCRBY type offset increment] [OVERFLOW WRAP|SAT|FAIL] ...
+ * Records the bit range covered by all SET/INCRBY operations. */
+static void cmdParseBitfield(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
+    long long start = LLONG_MAX, end = -1;
+    int i = 2;
+    while (i < argc) {
+        sds op = argv[i]->ptr;
+        if (cmdParseIsOption(op, "overflow", 8)) {
+            i += 2;
+            continue;
+        }
+        int write = cmdParseIsOption(op, "set", 3) || cmdParseIsOption(op, "incrby", 6);
+        if (!write && !cmdParseIsOption(op, "get", 3)) goto whole_key;
+        if (i + (write ? 3 : 2) >= argc) goto whole_key;
+
+        sds type = argv[i+1]->ptr;
+        sds off = argv[i+2]->ptr;
+        long long bits, offset;
+        if ((tolower((unsigned char)type[0]) != 'i' && tolower((unsigned char)type[0]) != 'u') ||
+            !string2ll(type + 1, sdslen(type) - 1, &bits) || bits < 1 || bits > 64) {
+            goto whole_key;
+        }
+        int usehash = off[0] == '#';
+        if (!string2ll(off + usehash, sdslen(off) - usehash, &offset) || offset < 0) goto whole_key;
+        if (usehash) {
+            if (offset > (LLONG_MAX - 64) / bits) goto whole_key;
+            offset *= bits;
+        }
+        if (write) {
+            if (offset < start) start = offset;
+            if (offset + bits - 1 > end) end = offset + bits - 1;
+        }
+        i += write ? 4 : 3;
+    }
+    if (end >= 0) {
+        cmdParseKeyExtra extra = {.extra_type = CMDPARSE_EXTRA_BITRNG};
+        extra.bitrng.start = start;
+        extra.bitrng.end = end;
+        on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, &extra);
+        return;
+    }
+whole_key:
+    on_key(ctx, dbid, cmd, argv, argc, 1, 0, 0, 0, NULL, NULL);
+}
+
 #define cmdParseZrevrange cmdParseZrange
 
 #include "xredis_commands.def"
 
-dictType cmd_parse_command_dict_type = {
-    dictSdsHash,
-    NULL,
-    NULL,
-    dictSdsKeyCompare,
-    dictSdsDestructor,
-    NULL,
-};
+/* Parser resolved per redisCommand, indexed by cmd->id. Slots are NULL
+ * until resolved, and point to cmd_parse_none if command has no parser. */
+static cmdParseCommandDef cmd_parse_none = {NULL, NULL, NULL};
+static cmdParseCommandDef **cmd_parse_by_id = NULL;
+static int cmd_parse_by_id_size = 0;
 
-dict* createCmdParseCommandDict() {
-    dict* cmd_parse_command_dict = gtidDictCreate(&cmd_parse_command_dict_type);
-    for (int i = 0; cmd_parse_commands[i].name != NULL; i++) {
-        dictAdd(cmd_parse_command_dict, sdsnew(cmd_parse_commands[i].name), &cmd_parse_commands[i]);
+static cmdParseCommandDef *cmdParseLookupByCommand(struct redisCommand *cmd) {
+    if (cmd->id < 0) return NULL;
+    if (cmd->id >= cmd_parse_by_id_size) {
+        int size = cmd_parse_by_id_size ? cmd_parse_by_id_size : 256;
+        while (size <= cmd->id) size *= 2;
+        cmd_parse_by_id = zrealloc(cmd_parse_by_id, sizeof(cmdParseCommandDef*) * size);
+        memset(cmd_parse_by_id + cmd_parse_by_id_size, 0,
+               sizeof(cmdParseCommandDef*) * (size - cmd_parse_by_id_size));
+        cmd_parse_by_id_size = size;
+    }
+    cmdParseCommandDef *parsecmd = cmd_parse_by_id[cmd->id];
+    if (parsecmd == NULL) {
+        char *name = gtidGetCmdName(cmd);
+        parsecmd = cmdParseLookupCommand(name, strlen(name));
+        cmd_parse_by_id[cmd->id] = parsecmd ? parsecmd : &cmd_parse_none;
     }
-    return cmd_parse_command_dict;
+    return parsecmd == &cmd_parse_none ? NULL : parsecmd;
 }
+
+/* Parser definitions are static, only the per-id table is allocated. */
+size_t cmdParseUsedMemory(void) {
+    return cmd_parse_by_id ? zmalloc_size(cmd_parse_by_id) : 0;
+}
+
 void cmdParseKeys(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key) {
-    static dict* cmd_parse_command_dict = NULL;
-    if (cmd_parse_command_dict == NULL) {
-        cmd_parse_command_dict = createCmdParseCommandDict();
-    }
     if (argc < 1) return;
-    cmdParseCommandDef* parsecmd = dictFetchValue(cmd_parse_command_dict,argv[0]->ptr);
+    cmdParseCommandDef *parsecmd;
+    if (cmd != NULL) {
+        parsecmd = cmdParseLookupByCommand(cmd);
+    } else {
+        sds name = argv[0]->ptr;
+        parsecmd = cmdParseLookupCommand(name, sdslen(name));
+        /* Parsers report key type from cmd, callers such as gap log filled
+         * from backlog only have argv: command is looked up once per parser
+         * and cached, commands without parser are looked up as before. */
+        if (parsecmd != NULL) {
+            if (parsecmd->cmd == NULL)
+                parsecmd->cmd = gtidLookupCommandBySds(name);
+            cmd = parsecmd->cmd;
+        } else {
+            cmd = gtidLookupCommandBySds(name);
+        }
+        serverAssert(cmd != NULL);
+    }
     if (parsecmd != NULL) {
         parsecmd->parse(dbid, cmd, argv, argc, ctx, on_key);
         return;
     }
-    if (cmd == NULL) cmd = gtidLookupCommandBySds(argv[0]->ptr);
-    serverAssert(cmd != NULL);
     getKeysResult keys = GETKEYS_RESULT_INIT;
     int numkeys = getKeysFromCommand(cmd, argv, argc, &keys);
     for (int i = 0; i < numkeys; i++) {
@@ -5,15 +5,18 @@ typedef struct redisObject robj;
 
 typedef enum {
     CMDPARSE_EXTRA_NONE = 0,
-    CMDPARSE_EXTRA_RANGE,     /* list range: start/end/reverse */
+    CMDPARSE_EXTRA_RANGE,     /* list range: start/end/reverse/invert */
     CMDPARSE_EXTRA_ZSCORE,    /* zset score range: min/max/minex/maxex/reverse */
-    CMDPARSE_EXTRA_ZLEX,      /* zset lex range: min_arg_idx/max_arg_idx/minex/maxex */
+    CMDPARSE_EXTRA_ZLEX,      /* zset lex range: min/max/minex/maxex */
     CMDPARSE_EXTRA_ZRANK,     /* zset rank range: start/end */
     CMDPARSE_EXTRA_BITOFF,    /* bitmap offset */
     CMDPARSE_EXTRA_BITRNG,    /* bitmap range: start/end */
 } cmdParseExtraType;
 
-/* TODO */
+/* Which part of the key a write touched. Without extra (NULL) the whole key
+ * (or the listed subkeys) is considered touched. Indexes follow the redis
+ * convention of the command: negative list/rank indexes count from the tail.
+ * Bit offsets are in bits, SETRANGE byte ranges are converted to bits. */
 typedef struct cmdParseKeyExtra {
     cmdParseExtraType extra_type;
     union {
@@ -21,24 +24,32 @@ typedef struct cmdParseKeyExtra {
             long long start;
             long long end;
             int reverse;
-        } range; /* unuse，swap list need arg_rewrite0, arg_rewrite1*/
+            int invert;     /* elements outside [start,end] touched (ltrim) */
+        } range;
         struct {
             double min;
             double max;
             int minex;
             int maxex;
             int reverse;
-        } zscore; /* unuse */
+        } zscore;
         struct {
-            int min_arg_idx;
-            int max_arg_idx;
+            robj *min;      /* raw bound argument ("[a", "(a", "-", "+") */
+            robj *max;
             int minex;
             int maxex;
-        } zlex; /* unuse (need swap zset all) */
+        } zlex;
         struct {
             long long start;
             long long end;
-        } zrank; /* unuse (need swap zset all) */
+        } zrank;
+        struct {
+            long long offset;
+        } bitoff;
+        struct {
+            long long start;
+            long long end;
+        } bitrng;
     };
 } cmdParseKeyExtra;
 
@@ -51,7 +62,9 @@ typedef void (*cmdParseOnKeyFn)(void *ctx, int dbid, struct redisCommand* cmd, r
 typedef struct cmdParseCommandDef {
     const char *name;
     void (*parse)(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key);
+    struct redisCommand *cmd; /* resolved by name on first parse */
 } cmdParseCommandDef;
 
 void cmdParseKeys(int dbid, struct redisCommand *cmd, robj **argv, int argc, void *ctx, cmdParseOnKeyFn on_key);
+size_t cmdParseUsedMemory(void);
 #endif
@@ -2,47 +2,194 @@
 #include "xredis_gtid_adaptation_version.h"
 #include <gtid.h>
 #include <ctype.h>
-static void uuidSetFreeWrapper(void *ptr) {
-    uuidSet *us = (uuidSet*)ptr;
-    if (us) {
-        uuidSetFree(us);
-    }
+void gtidGaplogEntriesDestructor(void *privdata, void *val) {
+    UNUSED(privdata);
+    gtidGaplogEntriesFree((gtidGaplogEntries*)val);
 }
 
-void gtidGaplogSkiplistDestructor(void *privdata, void *val) {
+static dictType gtidGaplogDictType = {
+    .hashFunction = dictSdsHash,
+    .keyCompare = dictSdsKeyCompare,
+    .keyDestructor = dictSdsDestructor,
+    .valDestructor = gtidGaplogEntriesDestructor
+};
+
+void gtidGaplogKeyRefsDestructor(void *privdata, void *val) {
     UNUSED(privdata);
-    skiplist *sl = (skiplist*)val;
-    if (sl) {
-        skiplistFree(sl);
+    gtidGaplogKeyRefs *refs = (gtidGaplogKeyRefs*)val;
+    if (refs) {
+        if (refs->refs) zfree(refs->refs - refs->head);
+        zfree(refs);
     }
 }
 
-static dictType gtidGaplogDictType = {
+static dictType gtidGaplogKeyIndexDictType = {
     .hashFunction = dictSdsHash,
     .keyCompare = dictSdsKeyCompare,
     .keyDestructor = dictSdsDestructor,
-    .valDestructor = gtidGaplogSkiplistDestructor
+    .valDestructor = gtidGaplogKeyRefsDestructor
 };
 
 gtidGaplog* gtidGaplogNew() {
     gtidGaplog* gaplog =  zmalloc(sizeof(gtidGaplog));
     gaplog->data = gtidDictCreate(&gtidGaplogDictType);
     gaplog->size = 0;
-    gaplog->history = listCreate();
-    listSetFreeMethod(gaplog->history, uuidSetFreeWrapper);
+    gaplog->keys_memory = 0;
+    gaplog->key_index_memory = 0;
+    memset(&gaplog->history, 0, sizeof(gaplog->history));
+    gaplog->key_index = gtidDictCreate(&gtidGaplogKeyIndexDictType);
     return gaplog;
 }
 
 void gtidGaplogReset(gtidGaplog* gaplog) {
     dictEmpty(gaplog->data, NULL);
     gaplog->size = 0;
-    listEmpty(gaplog->history);
+    gaplog->keys_memory = 0;
+    zfree(gaplog->history.entries);
+    memset(&gaplog->history, 0, sizeof(gaplog->history));
+    if (gaplog->key_index) dictEmpty(gaplog->key_index, NULL);
+    gaplog->key_index_memory = 0;
 }
 
 void gtidGaplogRelease(gtidGaplog* gaplog) {
     dictRelease(gaplog->data);
-    listRelease(gaplog->history);
+    zfree(gaplog->history.entries);
+    memset(&gaplog->history, 0, sizeof(gaplog->history));
+    if (gaplog->key_index) {
+        dictRelease(gaplog->key_index);
+        gaplog->key_index = NULL;
+    }
     gaplog->size = 0;
+    gaplog->keys_memory = 0;
+    gaplog->key_index_memory = 0;
+}
+
+/* ========== gtidGaplog key index ========== */
+static sds gtidGaplogKeyIndexName(int dbid, const char *key, size_t key_len) {
+    sds name = sdsfromlonglong(dbid);
+    name = sdscatlen(name, ":", 1);
+    return sdscatlen(name, key, key_len);
+}
+
+static void gtidGaplogKeyIndexAdd(gtidGaplog* gaplog, const char *uuid,
+                                  gno_t gno, gtidGaplogKeys* keys) {
+    if (gaplog->key_index == NULL) return;
+    for (size_t i = 0; i < keys->size; i++) {
+        gtidGaplogKey *k = keys->keys[i];
+        sds name = gtidGaplogKeyIndexName(k->dbid, k->key, sdslen(k->key));
+        gtidGaplogKeyRefs *refs;
+        dictEntry *de = dictFind(gaplog->key_index, name);
+        if (de == NULL) {
+            refs = zcalloc(sizeof(gtidGaplogKeyRefs));
+            dictAdd(gaplog->key_index, name, refs);
+            gaplog->key_index_memory += sdsZmallocSize(name) + zmalloc_size(refs);
+        } else {
+            refs = dictGetVal(de);
+            sdsfree(name);
+        }
+        /* same key touched several times by one gno (e.g. multi) */
+        if (refs->len && refs->refs[refs->len-1].uuid == uuid &&
+                refs->refs[refs->len-1].gno == gno) {
+            continue;
+        }
+        if (refs->head + refs->len == refs->cap) {
+            gtidGaplogKeyRef *alloc = refs->refs ? refs->refs - refs->head : NULL;
+            if (refs->head >= refs->cap / 2) {
+                /* reclaim refs popped from the front */
+                memmove(alloc, refs->refs, sizeof(gtidGaplogKeyRef) * refs->len);
+            } else {
+                if (alloc) gaplog->key_index_memory -= zmalloc_size(alloc);
+                refs->cap = refs->cap ? refs->cap * 2 : 2;
+                alloc = zrealloc(alloc, sizeof(gtidGaplogKeyRef) * refs->cap);
+                gaplog->key_index_memory += zmalloc_size(alloc);
+                /* live refs still start at head of the reallocated array */
+                if (refs->head) memmove(alloc, alloc + refs->head,
+                        sizeof(gtidGaplogKeyRef) * refs->len);
+            }
+            refs->refs = alloc;
+            refs->head = 0;
+        }
+        refs->refs[refs->len].uuid = uuid;
+        refs->refs[refs->len].gno = gno;
+        refs->len++;
+    }
+}
+
+/* Entries are mostly evicted oldest first, so the ref is usually found at
+ * the head of the refs array: it is popped by advancing head, refs before
+ * it (if any) are shifted by one, so removal costs the distance from head
+ * rather than the length of refs. */
+static void gtidGaplogKeyIndexRemove(gtidGaplog* gaplog, const char *uuid,
+                                     gno_t gno, gtidGaplogKeys* keys) {
+    if (gaplog->key_index == NULL) return;
+    for (size_t i = 0; i < keys->size; i++) {
+        gtidGaplogKey *k = keys->keys[i];
+        sds name = gtidGaplogKeyIndexName(k->dbid, k->key, sdslen(k->key));
+        dictEntry *de = dictFind(gaplog->key_index, name);
+        if (de != NULL) {
+            gtidGaplogKeyRefs *refs = dictGetVal(de);
+            for (size_t j = 0; j < refs->len; j++) {
+                if (refs->refs[j].uuid != uuid || refs->refs[j].gno != gno)
+                    continue;
+                if (j) memmove(refs->refs + 1, refs->refs,
+                        sizeof(gtidGaplogKeyRef) * j);
+                refs->refs++;
+                refs->head++;
+                refs->len--;
+                break;
+            }
+            if (refs->len == 0) {
+                gaplog->key_index_memory -= sdsZmallocSize(dictGetKey(de)) +
+                    zmalloc_size(refs) + zmalloc_size(refs->refs - refs->head);
+                dictDelete(gaplog->key_index, name);
+            }
+        }
+        sdsfree(name);
+    }
+}
+
+/* Enable or disable the key index. Enabling rebuilds the index from the
+ * entries currently in the gap log. */
+void gtidGaplogSetKeyIndex(gtidGaplog* gaplog, int enabled) {
+    if (!enabled) {
+        if (gaplog->key_index) dictRelease(gaplog->key_index);
+        gaplog->key_index = NULL;
+        gaplog->key_index_memory = 0;
+        return;
+    }
+    if (gaplog->key_index) return;
+
+    gaplog->key_index = gtidDictCreate(&gtidGaplogKeyIndexDictType);
+    dictIterator *di = dictGetIterator(gaplog->data);
+    dictEntry *de;
+    while ((de = dictNext(di)) != NULL) {
+        const char *uuid = dictGetKey(de);
+        gtidGaplogDataIterator iter;
+        gtidGaplogKeys *keys;
+        gno_t gno;
+        gtidGaplogDataInitIterator(&iter, dictGetVal(de), 0);
+        while ((gno = gtidGaplogDataGetGno(&iter)) != -1) {
+            keys = gtidGaplogDataNext(&iter);
+            gtidGaplogKeyIndexAdd(gaplog, uuid, gno, keys);
+        }
+        gtidGaplogDeinitDataIterator(&iter);
+    }
+    dictReleaseIterator(di);
+}
+
+int gtidGaplogKeyIndexEnabled(gtidGaplog* gaplog) {
+    return gaplog->key_index != NULL;
+}
+
+/* Return refs of gnos that touched dbid:key (oldest first), or NULL if key
+ * not found or index disabled. */
+gtidGaplogKeyRefs* gtidGaplogLookupKey(gtidGaplog* gaplog, int dbid,
+                                       const char* key, size_t key_len) {
+    if (gaplog->key_index == NULL) return NULL;
+    sds name = gtidGaplogKeyIndexName(dbid, key, key_len);
+    dictEntry *de = dictFind(gaplog->key_index, name);
+    sdsfree(name);
+    return de ? dictGetVal(de) : NULL;
 }
 
 void gtidGaplogKeysRelease(void *data) {
@@ -66,8 +213,58 @@ gtidGaplogKey* gtidGaplogKeyNew(int dbid, int type, sds key, sds* subkeys, int s
     return ki;
 }
 
+/* Capture mode: key and subkeys reference the argument objects instead of
+ * copying them. References to key and subkeys are moved from the caller; the
+ * objects must be sds encoded. objs and the subkeys views share one block. */
+gtidGaplogKey* gtidGaplogKeyNewFromObjects(int dbid, int type, robj* key, robj** subkeys, int subkeys_count) {
+    gtidGaplogKey *ki = zcalloc(sizeof(gtidGaplogKey));
+    ki->dbid = dbid;
+    ki->key_type = type;
+    ki->objs = zmalloc(sizeof(robj*) * (1 + subkeys_count) + sizeof(sds) * subkeys_count);
+    ki->objs[0] = key;
+    ki->key = key->ptr;
+    if (subkeys_count > 0) {
+        ki->subkeys = (sds*)(ki->objs + 1 + subkeys_count);
+        for (int i = 0; i < subkeys_count; i++) {
+            ki->objs[1 + i] = subkeys[i];
+            ki->subkeys[i] = subkeys[i]->ptr;
+        }
+    }
+    ki->subkeys_count = subkeys_count;
+    return ki;
+}
+
+static cmdParseKeyExtra *gtidGaplogKeyExtraDup(const cmdParseKeyExtra *extra) {
+    if (extra == NULL || extra->extra_type == CMDPARSE_EXTRA_NONE) return NULL;
+    cmdParseKeyExtra *dup = zmalloc(sizeof(cmdParseKeyExtra));
+    *dup = *extra;
+    if (dup->extra_type == CMDPARSE_EXTRA_ZLEX) {
+        dup->zlex.min = getDecodedObject(extra->zlex.min);
+        dup->zlex.max = getDecodedObject(extra->zlex.max);
+    }
+    return dup;
+}
+
+static void gtidGaplogKeyExtraFree(cmdParseKeyExtra *extra) {
+    if (extra == NULL) return;
+    if (extra->extra_type == CMDPARSE_EXTRA_ZLEX) {
+        decrRefCount(extra->zlex.min);
+        decrRefCount(extra->zlex.max);
+    }
+    zfree(extra);
+}
+
 void gtidGaplogKeyRelease(gtidGaplogKey* ki) {
     if (ki == NULL) return;
+    gtidGaplogKeyExtraFree(ki->extra);
+    if (ki->objs) {
+        for (size_t i = 0; i <= ki->subkeys_count; i++) {
+            decrRefCount(ki->objs[i]);
+        }
+        zfree(ki->objs);
+        zfree(ki);
+        return;
+    }
     sdsfree(ki->key);
     for (size_t i = 0; i < ki->subkeys_count; i++) {
         sdsfree(ki->subkeys[i]);
@@ -111,6 +308,7 @@ void gtidGaplogDeinitKeysBuilder(gtidGaplogKeysBuilder* builer) {
 gtidGaplogKeys* gtidGaplogKeysBuild(gtidGaplogKeysBuilder* builder) {
     gtidGaplogKeys* keys = zmalloc(sizeof(gtidGaplogKeys));
     keys->size = builder->numkeys;
+    keys->used_memory = 0;
     /*move keys*/
     keys->keys =zmalloc(sizeof(gtidGaplogKey*) * keys->size);
     for(int i = 0; i < builder->numkeys; i++) {
@@ -121,69 +319,253 @@ gtidGaplogKeys* gtidGaplogKeysBuild(gtidGaplogKeysBuilder* builder) {
     return keys;
 }
 
+/* ========== gtidGaplog Entries ========== */
+#define GTID_GAPLOG_CHUNK_BASE(gno) ((gno) - ((gno) % GTID_GAPLOG_CHUNK_SIZE))
+
+gtidGaplogEntries *gtidGaplogEntriesNew(void) {
+    return zcalloc(sizeof(gtidGaplogEntries));
+}
+
+void gtidGaplogEntriesFree(gtidGaplogEntries *entries) {
+    if (entries == NULL) return;
+    for (size_t i = 0; i < entries->nchunks; i++) {
+        gtidGaplogChunk *chunk = entries->chunks[i];
+        for (int j = 0; j < GTID_GAPLOG_CHUNK_SIZE; j++) {
+            if (chunk->slots[j]) gtidGaplogKeysRelease(chunk->slots[j]);
+        }
+        zfree(chunk);
+    }
+    zfree(entries->chunks);
+    zfree(entries);
+}
+
+/* Return position of the first chunk whose base >= base. Dense gnos make
+ * chunks contiguous, so the tail and the computed position are tried before
+ * falling back to binary search. */
+static size_t gtidGaplogEntriesChunkPos(gtidGaplogEntries *entries, gno_t base) {
+    size_t n = entries->nchunks;
+    if (n == 0 || entries->chunks[n-1]->base < base) return n;
+    if (entries->chunks[n-1]->base == base) return n-1;
+    gno_t first = entries->chunks[0]->base;
+    if (base <= first) return 0;
+
+    size_t guess = (base - first) / GTID_GAPLOG_CHUNK_SIZE;
+    if (guess < n && entries->chunks[guess]->base == base) return guess;
+
+    size_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries->chunks[mid]->base < base) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Insert keys at gno, return 0 if gno already exists. */
+int gtidGaplogEntriesInsert(gtidGaplogEntries *entries, gno_t gno,
+                            gtidGaplogKeys *keys) {
+    gno_t base = GTID_GAPLOG_CHUNK_BASE(gno);
+    size_t pos = gtidGaplogEntriesChunkPos(entries, base);
+    gtidGaplogChunk *chunk;
+
+    if (pos < entries->nchunks && entries->chunks[pos]->base == base) {
+        chunk = entries->chunks[pos];
+    } else {
+        if (entries->nchunks == entries->cap) {
+            entries->cap = entries->cap ? entries->cap * 2 : 4;
+            entries->chunks = zrealloc(entries->chunks,
+                    sizeof(gtidGaplogChunk*) * entries->cap);
+        }
+        memmove(entries->chunks + pos + 1, entries->chunks + pos,
+                sizeof(gtidGaplogChunk*) * (entries->nchunks - pos));
+        chunk = zcalloc(sizeof(gtidGaplogChunk));
+        chunk->base = base;
+        entries->chunks[pos] = chunk;
+        entries->nchunks++;
+    }
+
+    if (chunk->slots[gno - base]) return 0;
+    chunk->slots[gno - base] = keys;
+    chunk->count++;
+    entries->length++;
+    return 1;
+}
+
+gtidGaplogKeys *gtidGaplogEntriesFind(gtidGaplogEntries *entries, gno_t gno) {
+    gno_t base = GTID_GAPLOG_CHUNK_BASE(gno);
+    size_t pos = gtidGaplogEntriesChunkPos(entries, base);
+    if (pos == entries->nchunks || entries->chunks[pos]->base != base)
+        return NULL;
+    return entries->chunks[pos]->slots[gno - base];
+}
+
+/* Delete entries within [start_gno, end_gno], callback (if any) is invoked
+ * before keys of each entry are released. Emptied chunks are spliced out
+ * together. Returns number of entries deleted. */
+size_t gtidGaplogEntriesDeleteRange(gtidGaplogEntries *entries,
+        gno_t start_gno, gno_t end_gno,
+        gtidGaplogEntriesDeleteCallbackFn callback, void *ctx) {
+    size_t deleted = 0;
+    size_t first = gtidGaplogEntriesChunkPos(entries,
+            GTID_GAPLOG_CHUNK_BASE(start_gno));
+    size_t pos = first, kept = first;
+
+    for (; pos < entries->nchunks && entries->chunks[pos]->base <= end_gno; pos++) {
+        gtidGaplogChunk *chunk = entries->chunks[pos];
+        gno_t from = start_gno > chunk->base ? start_gno - chunk->base : 0;
+        gno_t to = end_gno - chunk->base < GTID_GAPLOG_CHUNK_SIZE - 1 ?
+            end_gno - chunk->base : GTID_GAPLOG_CHUNK_SIZE - 1;
+        for (gno_t slot = from; slot <= to && chunk->count; slot++) {
+            gtidGaplogKeys *keys = chunk->slots[slot];
+            if (keys == NULL) continue;
+            if (callback) callback(chunk->base + slot, keys, ctx);
+            gtidGaplogKeysRelease(keys);
+            chunk->slots[slot] = NULL;
+            chunk->count--;
+            deleted++;
+        }
+        if (chunk->count == 0) {
+            zfree(chunk);
+        } else {
+            entries->chunks[kept++] = chunk;
+        }
+    }
+
+    if (kept != pos) {
+        memmove(entries->chunks + kept, entries->chunks + pos,
+                sizeof(gtidGaplogChunk*) * (entries->nchunks - pos));
+        entries->nchunks -= pos - kept;
+    }
+    entries->length -= deleted;
+    return deleted;
+}
+
 /* ========== gtidGaplog Data iterator ========== */
-void gtidGaplogDataInitIterator(gtidGaplogDataIterator *iter, skiplist *sl, gno_t start_gno) {
-    skiplistInitIterator(&iter->sl_iter, sl);
-    skiplistIteratorSeek(&iter->sl_iter, start_gno);
+/* Move iterator to the first live slot at or after current position. */
+static void gtidGaplogDataIteratorSkipEmpty(gtidGaplogDataIterator *iter) {
+    gtidGaplogEntries *entries = iter->entries;
+    while (iter->chunk < entries->nchunks) {
+        gtidGaplogChunk *chunk = entries->chunks[iter->chunk];
+        while (iter->slot < GTID_GAPLOG_CHUNK_SIZE) {
+            if (chunk->slots[iter->slot]) return;
+            iter->slot++;
+        }
+        iter->chunk++;
+        iter->slot = 0;
+    }
+}
+
+void gtidGaplogDataInitIterator(gtidGaplogDataIterator *iter,
+                                gtidGaplogEntries *entries, gno_t start_gno) {
+    iter->entries = entries;
+    gtidGaplogDataIteratorSeek(iter, start_gno);
 }
 
 void gtidGaplogDeinitDataIterator(gtidGaplogDataIterator *iter) {
-    skiplistDeinitIterator(&iter->sl_iter);
+    UNUSED(iter);
 }
 
 void gtidGaplogDataIteratorSeek(gtidGaplogDataIterator *iter, gno_t gno) {
-    skiplistIteratorSeek(&iter->sl_iter, gno);
+    if (gno < 0) gno = 0;
+    gno_t base = GTID_GAPLOG_CHUNK_BASE(gno);
+    iter->chunk = gtidGaplogEntriesChunkPos(iter->entries, base);
+    iter->slot = 0;
+    if (iter->chunk < iter->entries->nchunks &&
+            iter->entries->chunks[iter->chunk]->base == base) {
+        iter->slot = gno - base;
+    }
+    gtidGaplogDataIteratorSkipEmpty(iter);
 }
 
 gno_t gtidGaplogDataGetGno(gtidGaplogDataIterator* iter) {
-    skiplistNode *node = iter->sl_iter.next;
-    if (node == NULL) return -1;
-    return (gno_t)node->score;
+    if (iter->chunk >= iter->entries->nchunks) return -1;
+    return iter->entries->chunks[iter->chunk]->base + iter->slot;
 }
 
 gtidGaplogKeys* gtidGaplogDataNext(gtidGaplogDataIterator* iter) {
-    skiplistNode *node = skiplistIteratorNext(&iter->sl_iter);
-    if (node == NULL) return NULL;
-    return (gtidGaplogKeys*)node->value;
+    if (iter->chunk >= iter->entries->nchunks) return NULL;
+    gtidGaplogKeys *keys = iter->entries->chunks[iter->chunk]->slots[iter->slot];
+    iter->slot++;
+    gtidGaplogDataIteratorSkipEmpty(iter);
+    return keys;
+}
+
+/* ========== gtidGaplog History ring ========== */
+#define GTID_GAPLOG_HISTORY_INIT_CAP 16
+
+static inline gtidGaplogHistoryEntry *gtidGaplogHistoryAt(
+        gtidGaplogHistory *history, size_t index) {
+    return &history->entries[(history->head + index) & (history->cap - 1)];
+}
+
+static void gtidGaplogHistoryPush(gtidGaplogHistory *history,
+        const char *uuid, gno_t gno, gtidGaplogKeys *keys) {
+    if (history->len == history->cap) {
+        size_t cap = history->cap ? history->cap * 2 : GTID_GAPLOG_HISTORY_INIT_CAP;
+        gtidGaplogHistoryEntry *entries = zmalloc(sizeof(gtidGaplogHistoryEntry) * cap);
+        for (size_t i = 0; i < history->len; i++) {
+            entries[i] = *gtidGaplogHistoryAt(history, i);
+        }
+        zfree(history->entries);
+        history->entries = entries;
+        history->cap = cap;
+        history->head = 0;
+    }
+    gtidGaplogHistoryEntry *entry = gtidGaplogHistoryAt(history, history->len);
+    entry->uuid = uuid;
+    entry->gno = gno;
+    entry->keys = keys;
+    history->len++;
+}
+
+static void gtidGaplogHistoryPopFirst(gtidGaplogHistory *history) {
+    serverAssert(history->len > 0);
+    history->head = (history->head + 1) & (history->cap - 1);
+    history->len--;
+}
+
+/* Drop entries of uuid within [start_gno, end_gno], keeping the order of the
+ * rest. Returns the number of entries removed. */
+static size_t gtidGaplogHistoryRemoveRange(gtidGaplogHistory *history,
+        const char *uuid, gno_t start_gno, gno_t end_gno) {
+    size_t kept = 0;
+    for (size_t i = 0; i < history->len; i++) {
+        gtidGaplogHistoryEntry *entry = gtidGaplogHistoryAt(history, i);
+        if (entry->uuid == uuid && entry->gno >= start_gno &&
+                entry->gno <= end_gno) {
+            continue;
+        }
+        if (kept != i) *gtidGaplogHistoryAt(history, kept) = *entry;
+        kept++;
+    }
+    size_t removed = history->len - kept;
+    history->len = kept;
+    return removed;
 }
 
-/* ========== gtidGaplog History iterator ========== */
 void gtidGaplogInitHistoryIterator(gtidGaplogHistoryIterator* iter,
                                     gtidGaplog* gaplog, long long index) {
-    iter->history = gaplog->history;
+    iter->history = &gaplog->history;
     gtidGaplogHistoryIteratorSeek(iter, index);
 }
 
+/* Return gno of the next history entry and fill uuid/keys, or 0 (with uuid
+ * set to NULL) if exhausted. keys is optional. */
 gno_t gtidGaplogHistoryNext(gtidGaplogHistoryIterator* iter,
-                             const char** uuid, size_t* uuid_len) {
-    if (iter->list_node == NULL) {
+                             const char** uuid, size_t* uuid_len,
+                             gtidGaplogKeys** keys) {
+    if (iter->index >= iter->history->len) {
         *uuid = NULL;
         *uuid_len = 0;
+        if (keys) *keys = NULL;
         return 0;
     }
 
-    uuidSet *us = listNodeValue(iter->list_node);
-    *uuid = us->uuid;
-    *uuid_len = us->uuid_len;
-
-    gno_t result = iter->next_gno;
-
-    iter->next_gno++;
-
-    if (iter->next_gno > iter->interval_node->end) {
-        iter->interval_node = iter->interval_node->forwards[0];
-        if (iter->interval_node) {
-            iter->next_gno = iter->interval_node->start;
-        } else {
-            iter->list_node = listNextNode(iter->list_node);
-            if (iter->list_node) {
-                us = listNodeValue(iter->list_node);
-                iter->interval_node = us->intervals->header->forwards[0];
-                iter->next_gno = iter->interval_node->start;
-            }
-        }
-    }
-    return result;
+    gtidGaplogHistoryEntry *entry = gtidGaplogHistoryAt(iter->history, iter->index++);
+    *uuid = entry->uuid;
+    *uuid_len = sdslen((sds)entry->uuid);
+    if (keys) *keys = entry->keys;
+    return entry->gno;
 }
 
 void gtidGaplogDeinitHistoryIterator(gtidGaplogHistoryIterator* iter) {
@@ -192,48 +574,56 @@ void gtidGaplogDeinitHistoryIterator(gtidGaplogHistoryIterator* iter) {
 
 /* Reposition the history iterator so the next call to
  * gtidGaplogHistoryNext returns the entry at the given `index` (0-based
- * position within the gap log's gno sequence). Walks across uuidSets and
- * their intervals, skipping `index` entries. Always resets from the head
- * of the history list, so multiple calls work correctly. If `index` is
- * past the end, leave the iterator in the exhausted state (list_node = NULL). */
+ * position within the gap log's insertion order). If `index` is past the
+ * end, the iterator is exhausted. */
 void gtidGaplogHistoryIteratorSeek(gtidGaplogHistoryIterator* iter, long long index) {
-    /* Always reset from the head of the history list */
-    iter->list_node = listFirst(iter->history);
-    iter->interval_node = NULL;
-    iter->next_gno = 0;
-    if (iter->list_node == NULL) return;
-    uuidSet *us = listNodeValue(iter->list_node);
-    iter->interval_node = us->intervals->header->forwards[0];
-    long long remaining = index;
-    while (iter->list_node && remaining > 0) {
-        us = listNodeValue(iter->list_node);
-        gno_t us_count = uuidSetCount(us);
-        if (remaining >= us_count) {
-            remaining -= us_count;
-            iter->list_node = listNextNode(iter->list_node);
-            if (iter->list_node) {
-                us = listNodeValue(iter->list_node);
-                iter->interval_node = us->intervals->header->forwards[0];
-            }
-            continue;
-        }
-        break;
-    }
+    iter->index = index < 0 ? 0 : (size_t)index;
+}
 
-    while (iter->interval_node && remaining > 0) {
-        gno_t interval_len = iter->interval_node->end - iter->interval_node->start + 1;
-        if (remaining >= interval_len) {
-            remaining -= interval_len;
-            iter->interval_node = iter->interval_node->forwards[0];
-            continue;
-        }
+/* [name, ...] describing the touched sub-range of a key. */
+static void addReplyGtidGaplogKeyExtra(client* c, cmdParseKeyExtra* extra) {
+    switch (extra->extra_type) {
+    case CMDPARSE_EXTRA_RANGE:
+        addReplyArrayLen(c, 5);
+        addReplyBulkCString(c, "range");
+        addReplyBulkLongLong(c, extra->range.start);
+        addReplyBulkLongLong(c, extra->range.end);
+        addReplyBulkLongLong(c, extra->range.reverse);
+        addReplyBulkLongLong(c, extra->range.invert);
         break;
-    }
-
-    if (iter->list_node && iter->interval_node) {
-        iter->next_gno = iter->interval_node->start + remaining;
-    } else {
-        iter->list_node = NULL;
+    case CMDPARSE_EXTRA_ZSCORE:
+        addReplyArrayLen(c, 5);
+        addReplyBulkCString(c, "zscore");
+        addReplyDouble(c, extra->zscore.min);
+        addReplyDouble(c, extra->zscore.max);
+        addReplyBulkLongLong(c, extra->zscore.minex);
+        addReplyBulkLongLong(c, extra->zscore.maxex);
+        break;
+    case CMDPARSE_EXTRA_ZLEX:
+        addReplyArrayLen(c, 3);
+        addReplyBulkCString(c, "zlex");
+        addReplyBulk(c, extra->zlex.min);
+        addReplyBulk(c, extra->zlex.max);
+        break;
+    case CMDPARSE_EXTRA_ZRANK:
+        addReplyArrayLen(c, 3);
+        addReplyBulkCString(c, "zrank");
+        addReplyBulkLongLong(c, extra->zrank.start);
+        addReplyBulkLongLong(c, extra->zrank.end);
+        break;
+    case CMDPARSE_EXTRA_BITOFF:
+        addReplyArrayLen(c, 2);
+        addReplyBulkCString(c, "bitoff");
+        addReplyBulkLongLong(c, extra->bitoff.offset);
+        break;
+    case CMDPARSE_EXTRA_BITRNG:
+        addReplyArrayLen(c, 3);
+        addReplyBulkCString(c, "bitrng");
+        addReplyBulkLongLong(c, extra->bitrng.start);
+        addReplyBulkLongLong(c, extra->bitrng.end);
+        break;
+    default:
+        serverPanic("unknown gaplog key extra type");
     }
 }
 
@@ -241,7 +631,7 @@ void addReplyGtidGaplogKeys(client* c, gtidGaplogKeys* keys) {
     addReplyArrayLen(c, keys->size);
     for (size_t i = 0; i < keys->size; i++) {
         gtidGaplogKey *k = keys->keys[i];
-        addReplyArrayLen(c, 4);
+        addReplyArrayLen(c, k->extra ? 5 : 4);
         addReplyBulkLongLong(c, k->dbid);
         addReplyBulkCBuffer(c, k->key, sdslen(k->key));
         addReplyBulkCString(c, gtidGetTypeName(k->key_type));
@@ -249,100 +639,110 @@ void addReplyGtidGaplogKeys(client* c, gtidGaplogKeys* keys) {
         for (size_t j = 0; j < k->subkeys_count; j++) {
             addReplyBulkCBuffer(c, k->subkeys[j], sdslen(k->subkeys[j]));
         }
+        if (k->extra) addReplyGtidGaplogKeyExtra(c, k->extra);
     }
 }
 
 int gtidGaplogTrim(gtidGaplog* gap_log ,size_t size) {
     size_t count = 0;
-    while (count < size) {
-        listNode *first_ln = listFirst(gap_log->history);
-        if (first_ln == NULL) return count;
-
-        uuidSet *first_uuid_set = (uuidSet*)listNodeValue(first_ln);
-
-        gno_t min_gno = 0;
-        gtidIntervalNode *first_node = first_uuid_set->intervals->header->forwards[0];
-        if (first_node == NULL) {
-            listDelNode(gap_log->history, first_ln);
-            continue;
+    while (count < size && gap_log->history.len > 0) {
+        gtidGaplogHistoryEntry entry = *gtidGaplogHistoryAt(&gap_log->history, 0);
+        gtidGaplogHistoryPopFirst(&gap_log->history);
+
+        dictEntry *de = dictFind(gap_log->data, entry.uuid);
+        if (de == NULL) serverPanic("not find keysinfo in gtid_gap_log");
+        gtidGaplogEntries *entries = dictGetVal(de);
+        gtidGaplogKeyIndexRemove(gap_log, entry.uuid, entry.gno, entry.keys);
+        gap_log->keys_memory -= entry.keys->used_memory;
+        serverAssert(gtidGaplogEntriesDeleteRange(entries, entry.gno,
+                    entry.gno, NULL, NULL) == 1);
+        if (entries->length == 0) {
+            dictDelete(gap_log->data, entry.uuid);
         }
-        min_gno = first_node->start;
+        gap_log->size--;
+        count++;
+    }
+    return count;
+}
 
-        sds evict_uuid_sds = sdsnewlen(first_uuid_set->uuid, first_uuid_set->uuid_len);
-        dictEntry *de = dictFind(gap_log->data, evict_uuid_sds);
-        if (de != NULL) {
-            skiplist *sl = dictGetVal(de);
-            serverAssert(skiplistDelete(sl, min_gno));
-            if (sl->length == 0) {
-                dictDelete(gap_log->data, evict_uuid_sds);
+/* Allocated size of keys, argument objects referenced in capture mode
+ * included. */
+static size_t gtidGaplogKeysMemory(gtidGaplogKeys *keys) {
+    size_t memory = zmalloc_size(keys);
+    if (keys->keys) memory += zmalloc_size(keys->keys);
+    for (size_t i = 0; i < keys->size; i++) {
+        gtidGaplogKey *ki = keys->keys[i];
+        memory += zmalloc_size(ki);
+        if (ki->extra) memory += zmalloc_size(ki->extra);
+        if (ki->objs) {
+            memory += zmalloc_size(ki->objs);
+            for (size_t j = 0; j <= ki->subkeys_count; j++) {
+                robj *o = ki->objs[j];
+                memory += zmalloc_size(o);
+                if (o->encoding == OBJ_ENCODING_RAW)
+                    memory += sdsZmallocSize(o->ptr);
             }
         } else {
-            serverPanic("not find keysinfo in gtid_gap_log");
+            memory += sdsZmallocSize(ki->key);
+            if (ki->subkeys) memory += zmalloc_size(ki->subkeys);
+            for (size_t j = 0; j < ki->subkeys_count; j++)
+                memory += sdsZmallocSize(ki->subkeys[j]);
         }
-        sdsfree(evict_uuid_sds);
-        serverAssert((uuidSetRemove(first_uuid_set, min_gno, min_gno) > 0));
-        if (uuidSetCount(first_uuid_set) == 0) {
-            listDelNode(gap_log->history, first_ln);
-        }
-        gap_log->size--;
-        count++;
-        
     }
-    return count;
+    return memory;
 }
 
-skipType gtid_skip_type = {
-    .freeValue = gtidGaplogKeysRelease
-};
+/* Allocated size of gaplog: entries and key index structures are summed
+ * per uuid / dict, keys are tracked as they are inserted and deleted. */
+size_t gtidGaplogUsedMemory(gtidGaplog* gaplog) {
+    size_t memory = zmalloc_size(gaplog) + gtidDictMemUsage(gaplog->data);
+    if (gaplog->history.entries)
+        memory += zmalloc_size(gaplog->history.entries);
+
+    dictIterator *di = dictGetIterator(gaplog->data);
+    dictEntry *de;
+    while ((de = dictNext(di)) != NULL) {
+        gtidGaplogEntries *entries = dictGetVal(de);
+        memory += sdsZmallocSize(dictGetKey(de)) + zmalloc_size(entries);
+        if (entries->chunks) memory += zmalloc_size(entries->chunks);
+        for (size_t i = 0; i < entries->nchunks; i++)
+            memory += zmalloc_size(entries->chunks[i]);
+    }
+    dictReleaseIterator(di);
+
+    memory += gaplog->keys_memory;
+    if (gaplog->key_index) {
+        memory += gtidDictMemUsage(gaplog->key_index) +
+            gaplog->key_index_memory;
+    }
+    return memory;
+}
 
-static inline skiplist* gtidGaplogFindSkiplist(gtidGaplog* gaplog, sds uuid) {
+static inline gtidGaplogEntries* gtidGaplogFindEntries(gtidGaplog* gaplog, sds uuid) {
     dictEntry *de = dictFind(gaplog->data, uuid);
     return de ? dictGetVal(de) : NULL;
 }
 
-static skiplist* gtidGaplogFindOrCreateSkiplist(gtidGaplog* gaplog, sds uuid) {
+static dictEntry* gtidGaplogFindOrCreateEntries(gtidGaplog* gaplog, sds uuid) {
     dictEntry *de = dictFind(gaplog->data, uuid);
     if (de == NULL) {
-        skiplist *sl = skiplistCreate(&gtid_skip_type);
         sds uuid_key = sdsdup(uuid);
-        dictAdd(gaplog->data, uuid_key, sl);
-        return sl;
+        dictAdd(gaplog->data, uuid_key, gtidGaplogEntriesNew());
+        de = dictFind(gaplog->data, uuid_key);
     }
-    return dictGetVal(de);
-}
-
-static skiplist* gtidGaplogFindSkiplistWithUUID(gtidGaplog* gaplog, 
-                                                 const char* uuid, size_t uuid_len) {
-    sds key = sdsnewlen(uuid, uuid_len);
-    dictEntry *de = dictFind(gaplog->data, key);
-    sdsfree(key);
-    serverAssert(de != NULL);
-    return dictGetVal(de);
+    return de;
 }
 
 int gtidGaplogInsert(gtidGaplog* gaplog, sds uuid, gno_t gno, gtidGaplogKeys* keys) {
+    GTID_LATENCY_START(latency);
+    dictEntry *de = gtidGaplogFindOrCreateEntries(gaplog, uuid);
+    gtidGaplogEntries *entries = dictGetVal(de);
 
-    skiplist *sl = gtidGaplogFindOrCreateSkiplist(gaplog, uuid);
-
-    serverAssert(skiplistInsert(sl, gno, keys, 1) != 0);
-
-    uuidSet *last_uuid_set = NULL;
-    listNode *tail_ln = listLast(gaplog->history);
-    if (tail_ln != NULL) {
-        last_uuid_set = (uuidSet*)listNodeValue(tail_ln);
-        if (last_uuid_set->uuid_len != sdslen(uuid) ||
-            memcmp(last_uuid_set->uuid, uuid, sdslen(uuid)) != 0) {
-            last_uuid_set = NULL;
-        }
-    }
-
-    if (last_uuid_set != NULL) {
-        uuidSetAdd(last_uuid_set, gno, gno);
-    } else {
-        uuidSet *new_uuid_set = uuidSetNew(uuid, sdslen(uuid));
-        uuidSetAdd(new_uuid_set, gno, gno);
-        listAddNodeTail(gaplog->history, new_uuid_set);
-    }
+    serverAssert(gtidGaplogEntriesInsert(entries, gno, keys) != 0);
+    keys->used_memory = gtidGaplogKeysMemory(keys);
+    gaplog->keys_memory += keys->used_memory;
+    gtidGaplogKeyIndexAdd(gaplog, dictGetKey(de), gno, keys);
+    gtidGaplogHistoryPush(&gaplog->history, dictGetKey(de), gno, keys);
 
     gaplog->size++;
     
@@ -352,45 +752,38 @@ int gtidGaplogInsert(gtidGaplog* gaplog, sds uuid, gno_t gno, gtidGaplogKeys* ke
                         gaplog->size -
                         server.gtid_xsync_max_gap);
     }
+    GTID_LATENCY_END(GTID_LATENCY_GAPLOG_INSERT,latency);
     return 1;
 }
 
+typedef struct {
+    gtidGaplog *gaplog;
+    const char *uuid;
+} gtidGaplogDeleteRangeContext;
+
+static void gtidGaplogDeleteRangeCallback(gno_t gno, gtidGaplogKeys* keys, void* ctx) {
+    gtidGaplogDeleteRangeContext *dctx = ctx;
+    gtidGaplogKeyIndexRemove(dctx->gaplog, dctx->uuid, gno, keys);
+    dctx->gaplog->keys_memory -= keys->used_memory;
+}
+
 int gtidGaplogDeleteRange(gtidGaplog* gaplog, sds uuid, gno_t start_gno, gno_t end_gno) {
     serverAssert(start_gno <= end_gno);
 
-    long long deleted = 0;
-    skiplist *sl = gtidGaplogFindSkiplist(gaplog, uuid);
-    if (sl != NULL) {
-
-        gtidGaplogDataIterator iter;
-        gtidGaplogDataInitIterator(&iter, sl, start_gno);
-        gno_t gno = -1;
-        while ((gno = gtidGaplogDataGetGno(&iter)) != -1 && gno <= end_gno) {
-            gtidGaplogDataNext(&iter);
-            if (skiplistDelete(sl, gno)) {
-                deleted++;
-            }
-        }
-        gtidGaplogDeinitDataIterator(&iter);
-        if (sl->length == 0) {
-            dictDelete(gaplog->data, uuid);
-        }
-        gaplog->size -= deleted;
-    }
-
-    gno_t history_removed = 0;
-    listNode *ln = listFirst(gaplog->history);
-    while (ln) {
-        uuidSet *us = listNodeValue(ln);
-        listNode *next_ln = listNextNode(ln);
-        if (us->uuid_len == sdslen(uuid) &&
-            memcmp(us->uuid, uuid, sdslen(uuid)) == 0) {
-            history_removed += uuidSetRemove(us, start_gno, end_gno);
-            if (uuidSetCount(us) == 0) {
-                listDelNode(gaplog->history, ln);
-            }
-        }
-        ln = next_ln;
+    dictEntry *de = dictFind(gaplog->data, uuid);
+    if (de == NULL) return 0;
+
+    const char *uuid_key = dictGetKey(de);
+    size_t history_removed = gtidGaplogHistoryRemoveRange(&gaplog->history,
+            uuid_key, start_gno, end_gno);
+
+    gtidGaplogEntries *entries = dictGetVal(de);
+    gtidGaplogDeleteRangeContext dctx = {gaplog, uuid_key};
+    size_t deleted = gtidGaplogEntriesDeleteRange(entries, start_gno, end_gno,
+            gtidGaplogDeleteRangeCallback, &dctx);
+    gaplog->size -= deleted;
+    if (entries->length == 0) {
+        dictDelete(gaplog->data, uuid);
     }
 
     serverAssert(history_removed == deleted);
@@ -400,15 +793,15 @@ int gtidGaplogDeleteRange(gtidGaplog* gaplog, sds uuid, gno_t start_gno, gno_t e
 int gtidGaplogQueryRange(gtidGaplog* gaplog, sds uuid, gno_t start_gno, gno_t end_gno,
                          gtidGaplogQueryRangeCallbackFn callback, void* ctx) {
     serverAssert(start_gno <= end_gno);
-    skiplist *sl = gtidGaplogFindSkiplist(gaplog, uuid);
-    if (sl == NULL) {
+    gtidGaplogEntries *entries = gtidGaplogFindEntries(gaplog, uuid);
+    if (entries == NULL) {
         return 0;
     }
 
     long long count = 0;
 
     gtidGaplogDataIterator iter;
-    gtidGaplogDataInitIterator(&iter, sl, start_gno);
+    gtidGaplogDataInitIterator(&iter, entries, start_gno);
 
     gno_t gno;
     while ((gno = gtidGaplogDataGetGno(&iter)) != -1 && gno <= end_gno) {
@@ -429,29 +822,30 @@ size_t gtidGaplogSize(gtidGaplog* gaplog) {
     return gaplog->size;
 }
 
-void gtidGaplogKeysBuilderAdd(gtidGaplogKeysBuilder *builder, int dbid, int type, sds key,
-                       sds *subkeys, int subkeys_count)
-{
-    gtidGaplogKeysPrepareBuilder(builder, 1);
-    gtidGaplogKey *key_result = gtidGaplogKeyNew(dbid, type, key, subkeys, subkeys_count);
-    builder->keys_infos[builder->numkeys++] = key_result;
-}
-
+#define GTID_GAPLOG_CAPTURE_SUBKEYS_BUFFER 16
 static void gtidOnKey(void *ctx, int dbid, struct redisCommand* cmd, robj** argv, int argc,  int key_arg_idx,
                       int subkeys_count, int subkeys_start,
                       int subkeys_step, const int *subkey_arg_idxs,
                       const cmdParseKeyExtra *extra)
 {
-    UNUSED(extra);
     UNUSED(argc);
     gtidGaplogKeysBuilder *builder = ctx;
-    sds key = sdsdup((sds)argv[key_arg_idx]->ptr);
-    sds *subkeys = subkeys_count > 0 ? zmalloc(sizeof(sds) * subkeys_count) : NULL;
+    /* Take references on the argv objects rather than copying them: the
+     * parsed command list drops its own references afterwards, so the
+     * gap log ends up owning the arguments without a second copy. */
+    robj *subkeys_buf[GTID_GAPLOG_CAPTURE_SUBKEYS_BUFFER];
+    robj **subkeys = subkeys_count > GTID_GAPLOG_CAPTURE_SUBKEYS_BUFFER ?
+                     zmalloc(sizeof(robj*) * subkeys_count) : subkeys_buf;
     for (int i = 0; i < subkeys_count; i++) {
         int subkey_idx = subkey_arg_idxs ? subkey_arg_idxs[i] : (subkeys_start + i * subkeys_step);
-        subkeys[i] = sdsdup((sds)argv[subkey_idx]->ptr);
+        subkeys[i] = getDecodedObject(argv[subkey_idx]);
     }
-    gtidGaplogKeysBuilderAdd(builder, dbid, gitdCmdGetKeyType(cmd), key, subkeys, subkeys_count);
+    gtidGaplogKey *ki = gtidGaplogKeyNewFromObjects(dbid, gitdCmdGetKeyType(cmd),
+        getDecodedObject(argv[key_arg_idx]), subkeys, subkeys_count);
+    ki->extra = gtidGaplogKeyExtraDup(extra);
+    gtidGaplogKeysPrepareBuilder(builder, 1);
+    builder->keys_infos[builder->numkeys++] = ki;
+    if (subkeys != subkeys_buf) zfree(subkeys);
 }
 
 void gtidGaplogKeysBuilderAddFromCmd(gtidGaplogKeysBuilder *builder, int dbid, robj **args, int argc) {
@@ -467,34 +861,17 @@ int gtidGaplogList(gtidGaplog* gaplog, long long start_idx, long long count,
     gtidGaplogHistoryIterator hist_iter;
     gtidGaplogInitHistoryIterator(&hist_iter, gaplog, start_idx);
 
-    gtidGaplogDataIterator data_iter;
-    const char *last_uuid = NULL;
-    skiplist *sl = NULL;
     int nreply = 0;
-
     while (nreply < count) {
         const char *uuid;
         size_t uuid_len;
-        gno_t gno = gtidGaplogHistoryNext(&hist_iter, &uuid, &uuid_len);
+        gtidGaplogKeys *keys;
+        gno_t gno = gtidGaplogHistoryNext(&hist_iter, &uuid, &uuid_len, &keys);
         if (gno == 0) break;
 
-        if (last_uuid != uuid) {
-            sl = gtidGaplogFindSkiplistWithUUID(gaplog, uuid, uuid_len);
-            gtidGaplogDeinitDataIterator(&data_iter);
-            gtidGaplogDataInitIterator(&data_iter, sl, gno);
-            last_uuid = uuid;
-        } else if (gtidGaplogDataGetGno(&data_iter) != gno) {
-            gtidGaplogDeinitDataIterator(&data_iter);
-            gtidGaplogDataInitIterator(&data_iter, sl, gno);
-        }
-
-        serverAssert(gtidGaplogDataGetGno(&data_iter) == gno);
-        gtidGaplogKeys *keys = gtidGaplogDataNext(&data_iter);
-
         callback(uuid, uuid_len, gno, keys, ctx);
         nreply++;
     }
-    gtidGaplogDeinitDataIterator(&data_iter);
     gtidGaplogDeinitHistoryIterator(&hist_iter);
     return nreply;
 }
@@ -594,6 +971,57 @@ ssize_t readBacklogIteratorParseNext(readBacklogIterator *it,
         it->backlog += nread;
     }
 }
+
+/* gtidSeqScanProc of server.gtid_seq: scan commands from backlog offset of a
+ * sampled gtid, returns offset of the transaction (along with SELECT before
+ * it) of gtid uuid:gno, -1 if not found. */
+long long readBacklogScanGtid(void *privdata, long long offset,
+        const char *uuid, size_t uuid_len, gno_t gno) {
+    readBacklogIterator it;
+    long long pos = offset, txn_start = -1, found = -1;
+    int in_multi = 0;
+    UNUSED(privdata);
+
+    readBacklogIteratorInit(&it);
+    readBacklogIteratorSeekTo(&it, offset);
+    while (1) {
+        robj **argv;
+        int argc;
+        long long cmd_start = pos;
+        ssize_t consumed = readBacklogIteratorParseNext(&it, &argv, &argc);
+        if (consumed <= 0 || argc < 1) break;
+        pos += consumed;
+
+        sds cmd_name = (sds)argv[0]->ptr;
+        if (!strcasecmp(cmd_name, "gtid")) {
+            const char *u;
+            size_t ulen;
+            gno_t g;
+            if (txn_start < 0) txn_start = cmd_start;
+            if (argc >= 2 && (u = uuidGnoDecode(argv[1]->ptr,
+                            sdslen(argv[1]->ptr), &g, &ulen)) != NULL &&
+                    ulen == uuid_len && !memcmp(u, uuid, ulen)) {
+                if (g == gno) {
+                    found = txn_start;
+                    break;
+                }
+                if (g > gno) break;
+            }
+            txn_start = -1;
+            in_multi = 0;
+        } else if (!strcasecmp(cmd_name, "multi")) {
+            in_multi = 1;
+            if (txn_start < 0) txn_start = cmd_start;
+        } else if (!strcasecmp(cmd_name, "select")) {
+            if (txn_start < 0) txn_start = cmd_start;
+        } else if (!in_multi) {
+            txn_start = -1;
+        }
+    }
+    readBacklogIteratorDeinit(&it);
+
+    return found;
+}
 typedef struct {
     robj **argv;
     int argc;
@@ -700,66 +1128,225 @@ int parseGtidCommand(gtidGaplogKeysBuilder *builder, robj **argv, int argc) {
 
 
 
-void gtidGaplogFillFromGtidSet(gtidSet *mlost) {
-    readBacklogIterator it;
-    readBacklogIteratorInit(&it);
+/* Parse commands of uuid:gno from backlog and insert their keys into gap log.
+ * Returns 0 if gno can't be located in (or parsed from) backlog. */
+static int gtidGaplogFillGno(readBacklogIterator *it, sds uuid, gno_t gno) {
+    int parsed = 0;
+    long long offset = gtidSeqLookup(server.gtid_seq, uuid, sdslen(uuid), gno);
+    if (offset < 0) {
+        serverLog(LL_VERBOSE, "[gaplog] fill missed %s:%lld: not in backlog",
+                uuid, gno);
+        return 0;
+    }
 
-    gtidSetIterator gs_iterator;
-    gtidSetInitIterator(&gs_iterator, mlost);
-    uuidSet *us = NULL;
-    while ((us = gtidSetIteratorNext(&gs_iterator)) != NULL) {
-        uuidSetIterator us_iterator;
-        uuidSetInitIterator(&us_iterator, us);
-
-        gtidIntervalNode *node = NULL;
-        while ((node = uuidSetIteratorNext(&us_iterator)) != NULL) {
-            sds uuid = sdsnewlen(us->uuid, us->uuid_len);
-            for (gno_t gno = node->start; gno <= node->end; gno++) {
-                long long offset = gtidSeqLookup(server.gtid_seq, uuid,
-                                                  sdslen(uuid), gno);
-                if (offset < 0) continue;
-
-                readBacklogIteratorSeekTo(&it, offset);
-
-                long long dbid_from_select = -1;
-                gtidGaplogKeysBuilder builder = GTID_GAPLOG_KEYS_BUILDER_INIT;
-
-                while (1) {
-                    robj **argv;
-                    int argc;
-                    ssize_t consumed = readBacklogIteratorParseNext(&it, &argv, &argc);
-                    if (consumed <= 0) break;
-
-                    sds cmd_name = (sds)argv[0]->ptr;
-
-                    if (!strcasecmp(cmd_name, "select") && argc >= 2) {
-                        getLongLongFromObject(argv[1], &dbid_from_select);
-                        continue;
-                    }
-                    if (!strcasecmp(cmd_name, "multi")) {
-                        parseMultiCommand(&builder, &it, dbid_from_select);
-                        break;
-                    }
-                    if (!strcasecmp(cmd_name, "gtid")) {
-                        parseGtidCommand(&builder, argv, argc);
-                        break;
-                    }
-                    serverLog(LL_WARNING, "[gaplog] gtidGaplogFillFromGtidSet unexpected command %s", cmd_name);
-                }
+    readBacklogIteratorSeekTo(it, offset);
 
-                if (builder.numkeys > 0) {
-                    gtidGaplogInsert(server.gtid_gap_log, uuid, gno, gtidGaplogKeysBuild(&builder));
-                }
-                gtidGaplogDeinitKeysBuilder(&builder);
+    long long dbid_from_select = -1;
+    gtidGaplogKeysBuilder builder = GTID_GAPLOG_KEYS_BUILDER_INIT;
 
-            }
-            sdsfree(uuid);
+    while (1) {
+        robj **argv;
+        int argc;
+        ssize_t consumed = readBacklogIteratorParseNext(it, &argv, &argc);
+        if (consumed <= 0) break;
+
+        sds cmd_name = (sds)argv[0]->ptr;
+
+        if (!strcasecmp(cmd_name, "select") && argc >= 2) {
+            getLongLongFromObject(argv[1], &dbid_from_select);
+            continue;
+        }
+        if (!strcasecmp(cmd_name, "multi")) {
+            parseMultiCommand(&builder, it, dbid_from_select);
+            parsed = 1;
+            break;
         }
-        uuidSetDeinitIterator(&us_iterator);
+        if (!strcasecmp(cmd_name, "gtid")) {
+            parseGtidCommand(&builder, argv, argc);
+            parsed = 1;
+            break;
+        }
+        serverLog(LL_WARNING, "[gaplog] gtidGaplogFillGno unexpected command %s", cmd_name);
+    }
+
+    if (!parsed) {
+        serverLog(LL_VERBOSE, "[gaplog] fill missed %s:%lld: parse failed "
+                "at offset %lld", uuid, gno, offset);
+    } else if (builder.numkeys > 0) {
+        gtidGaplogInsert(server.gtid_gap_log, uuid, gno, gtidGaplogKeysBuild(&builder));
     }
-    gtidSetDeinitIterator(&gs_iterator);
+    gtidGaplogDeinitKeysBuilder(&builder);
+    return parsed;
+}
 
+/* ========== gtidGaplog incremental fill ========== */
+/* Filling parses every lost command from backlog, which may stall the event
+ * loop when gap is close to maxgap. So it runs as a job: pending gnos are
+ * consumed in time-bounded slices from a time event, and readers see the
+ * gap log as building until pending drains. Gnos that can't be located in
+ * backlog (e.g. trimmed during the build) are counted as missed, and the
+ * gap log is degraded until cleared or rebuilt. */
+#define GTID_GAPLOG_FILL_SLICE_US 1000          /* time budget of one slice */
+#define GTID_GAPLOG_FILL_PERIOD_MS 1            /* delay between slices */
+#define GTID_GAPLOG_FILL_CHECK_INTERVAL 16      /* gnos filled per clock check */
+
+static struct {
+    gtidSet *pending;       /* gnos not filled yet, NULL if not building */
+    long long te_id;        /* fill time event, -1 if not scheduled */
+    long long total;
+    long long filled;
+    long long missed;       /* gnos not found in backlog, gap log degraded */
+    long long slices;
+    long long last_slice_us;
+    long long max_slice_us;
+    long long start_ms;
+} gaplog_fill = {NULL, -1, 0, 0, 0, 0, 0, 0, 0};
+
+static void gtidGaplogFillSlice(long long budget_us) {
+    long long start = ustime(), filled = 0, missed = 0;
+    int expired = 0;
+    uuidSet *us;
+    readBacklogIterator it;
+    readBacklogIteratorInit(&it);
+
+    while (!expired && (us = gaplog_fill.pending->header) != NULL) {
+        gtidIntervalNode *node = us->intervals->header->forwards[0];
+        gno_t start_gno = node->start, end_gno = node->end, gno;
+        sds uuid = sdsnewlen(us->uuid, us->uuid_len);
+
+        for (gno = start_gno; gno <= end_gno && !expired; gno++) {
+            GTID_LATENCY_START(latency);
+            if (gtidGaplogFillGno(&it, uuid, gno)) filled++; else missed++;
+            GTID_LATENCY_END(GTID_LATENCY_GAPLOG_FILL,latency);
+            if ((filled + missed) % GTID_GAPLOG_FILL_CHECK_INTERVAL == 0 &&
+                    ustime() - start >= budget_us) {
+                expired = 1;
+            }
+        }
+        /* us might be freed once its last interval is consumed */
+        gtidSetRemove(gaplog_fill.pending, uuid, sdslen(uuid), start_gno, gno - 1);
+        sdsfree(uuid);
+    }
     readBacklogIteratorDeinit(&it);
+
+    long long elapsed = ustime() - start;
+    gaplog_fill.filled += filled;
+    gaplog_fill.missed += missed;
+    gaplog_fill.slices++;
+    gaplog_fill.last_slice_us = elapsed;
+    if (elapsed > gaplog_fill.max_slice_us) gaplog_fill.max_slice_us = elapsed;
+
+    if (gaplog_fill.pending->header == NULL) {
+        serverLog(LL_NOTICE, "[gaplog] build finished: %lld gnos in %lld slices "
+                "(%lld ms, max slice %lld us)", gaplog_fill.filled,
+                gaplog_fill.slices, mstime() - gaplog_fill.start_ms,
+                gaplog_fill.max_slice_us);
+        if (gaplog_fill.missed) {
+            serverLog(LL_WARNING, "[gaplog] build degraded: %lld/%lld gnos "
+                    "missed (not in backlog), gap log is incomplete",
+                    gaplog_fill.missed, gaplog_fill.total);
+        }
+        gtidSetFree(gaplog_fill.pending);
+        gaplog_fill.pending = NULL;
+    }
+}
+
+static int gtidGaplogFillTimeProc(struct aeEventLoop *el, long long id, void *clientData) {
+    UNUSED(el), UNUSED(id), UNUSED(clientData);
+    if (gaplog_fill.pending && !server.gtid_gaplog_enabled) gtidGaplogFillAbort();
+    if (gaplog_fill.pending) gtidGaplogFillSlice(GTID_GAPLOG_FILL_SLICE_US);
+    if (gaplog_fill.pending) return GTID_GAPLOG_FILL_PERIOD_MS;
+    gaplog_fill.te_id = -1;
+    return AE_NOMORE;
+}
+
+static void gtidGaplogFillSchedule(void) {
+    if (gaplog_fill.pending == NULL || gaplog_fill.te_id != -1) return;
+    gaplog_fill.te_id = aeCreateTimeEvent(server.el, GTID_GAPLOG_FILL_PERIOD_MS,
+            gtidGaplogFillTimeProc, NULL, NULL);
+    if (gaplog_fill.te_id == AE_ERR) {
+        serverLog(LL_WARNING, "[gaplog] failed to create fill time event, "
+                "retry in cron");
+        gaplog_fill.te_id = -1;
+    }
+}
+
+/* Queue mlost for filling. Small gaps are filled right away in the first
+ * slice, the rest is left to the fill time event. */
+void gtidGaplogFillStart(gtidSet *mlost) {
+    if (gaplog_fill.pending == NULL) {
+        gaplog_fill.pending = gtidSetNew();
+        gaplog_fill.total = 0;
+        gaplog_fill.filled = 0;
+        gaplog_fill.missed = 0;
+        gaplog_fill.slices = 0;
+        gaplog_fill.last_slice_us = 0;
+        gaplog_fill.max_slice_us = 0;
+        gaplog_fill.start_ms = mstime();
+    }
+    gaplog_fill.total += gtidSetMerge(gaplog_fill.pending, mlost);
+
+    gtidGaplogFillSlice(GTID_GAPLOG_FILL_SLICE_US);
+    if (gaplog_fill.pending) {
+        serverLog(LL_NOTICE, "[gaplog] build continues in background: %lld/%lld gnos filled",
+                gaplog_fill.filled, gaplog_fill.total);
+        gtidGaplogFillSchedule();
+    }
+}
+
+/* Re-arm fill time event if it could not be created. */
+void gtidGaplogFillCron(void) {
+    gtidGaplogFillSchedule();
+}
+
+void gtidGaplogFillAbort(void) {
+    if (gaplog_fill.pending == NULL) return;
+    serverLog(LL_NOTICE, "[gaplog] build aborted: %lld/%lld gnos filled",
+            gaplog_fill.filled, gaplog_fill.total);
+    gtidSetFree(gaplog_fill.pending);
+    gaplog_fill.pending = NULL;
+}
+
+/* Drop gnos from pending so that deleted range would not be filled later. */
+void gtidGaplogFillCancelRange(sds uuid, gno_t start_gno, gno_t end_gno) {
+    if (gaplog_fill.pending == NULL) return;
+    gaplog_fill.total -= gtidSetRemove(gaplog_fill.pending, uuid, sdslen(uuid),
+            start_gno, end_gno);
+    if (gaplog_fill.pending->header == NULL) {
+        gtidSetFree(gaplog_fill.pending);
+        gaplog_fill.pending = NULL;
+    }
+}
+
+int gtidGaplogFillIsBuilding(void) {
+    return gaplog_fill.pending != NULL;
+}
+
+/* Gap log missed some gnos in the last build. */
+int gtidGaplogFillIsDegraded(void) {
+    return gaplog_fill.missed > 0;
+}
+
+/* Gap log cleared, missed gnos no longer matter. */
+void gtidGaplogFillResetDegraded(void) {
+    gaplog_fill.missed = 0;
+}
+
+sds gtidGaplogCatFillInfo(sds info) {
+    return sdscatprintf(info,
+            "gtid_gaplog_state:%s\r\n"
+            "gtid_gaplog_build_progress:%lld/%lld\r\n"
+            "gtid_gaplog_build_missed:%lld\r\n"
+            "gtid_gaplog_build_slices:%lld\r\n"
+            "gtid_gaplog_build_last_slice_us:%lld\r\n"
+            "gtid_gaplog_build_max_slice_us:%lld\r\n",
+            gtidGaplogFillIsBuilding() ? "building" :
+            (gtidGaplogFillIsDegraded() ? "degraded" : "ready"),
+            gaplog_fill.filled, gaplog_fill.total,
+            gaplog_fill.missed,
+            gaplog_fill.slices,
+            gaplog_fill.last_slice_us,
+            gaplog_fill.max_slice_us);
 }
 
 #ifdef REDIS_TEST
@@ -875,6 +1462,28 @@ int readBacklogIteratorTest(int argc, char **argv, int accurate) {
     return error;
 }
 
+static gtidGaplogKeys *gapLogTestKeysNew(const char *key) {
+    gtidGaplogKeysBuilder builder = GTID_GAPLOG_KEYS_BUILDER_INIT;
+    gtidGaplogKeysPrepareBuilder(&builder, 1);
+    builder.keys_infos[builder.numkeys++] =
+        gtidGaplogKeyNew(0, OBJ_STRING, sdsnew(key), NULL, 0);
+    gtidGaplogKeys *keys = gtidGaplogKeysBuild(&builder);
+    gtidGaplogDeinitKeysBuilder(&builder);
+    return keys;
+}
+
+/* uuid-1: [1-3, 10-12], uuid-2: [100-101] */
+static void gapLogTestInsertHistory(gtidGaplog *gap_log) {
+    sds uuid1 = sdsnew("uuid-1"), uuid2 = sdsnew("uuid-2");
+    gno_t gnos1[] = {1, 2, 3, 10, 11, 12}, gnos2[] = {100, 101};
+    for (size_t i = 0; i < sizeof(gnos1)/sizeof(gnos1[0]); i++)
+        gtidGaplogInsert(gap_log, uuid1, gnos1[i], gapLogTestKeysNew("k"));
+    for (size_t i = 0; i < sizeof(gnos2)/sizeof(gnos2[0]); i++)
+        gtidGaplogInsert(gap_log, uuid2, gnos2[i], gapLogTestKeysNew("k"));
+    sdsfree(uuid1);
+    sdsfree(uuid2);
+}
+
 int gapLogTest(int argc, char **argv, int accurate) {
     UNUSED(argc), UNUSED(argv), UNUSED(accurate);
     int error = 0;
@@ -912,6 +1521,94 @@ int gapLogTest(int argc, char **argv, int accurate) {
         gtidGaplogKeyRelease(NULL);
     }
 
+    TEST("gtid - gapLog key capture by reference") {
+        robj *argv[4];
+        argv[0] = createStringObject("hset", 4);
+        argv[1] = createStringObject("hashkey", 7);
+        argv[2] = createStringObject("field1", 6);
+        argv[3] = createStringObject("value1", 6);
+
+        robj *subkeys[1];
+        subkeys[0] = getDecodedObject(argv[2]);
+        gtidGaplogKey *gk = gtidGaplogKeyNewFromObjects(0, OBJ_HASH,
+                getDecodedObject(argv[1]), subkeys, 1);
+        test_assert(gk->objs != NULL);
+        test_assert(gk->key == argv[1]->ptr);       /* no copy */
+        test_assert(gk->subkeys[0] == argv[2]->ptr);
+        test_assert(argv[1]->refcount == 2);
+        test_assert(argv[2]->refcount == 2);
+
+        /* parser drops its references, gap log still owns the arguments */
+        for (int i = 0; i < 4; i++) decrRefCount(argv[i]);
+        test_assert(!strcmp(gk->key, "hashkey"));
+        test_assert(!strcmp(gk->subkeys[0], "field1"));
+        gtidGaplogKeyRelease(gk);
+
+        /* keys captured from a command */
+        gtidGaplogKeysBuilder builder = GTID_GAPLOG_KEYS_BUILDER_INIT;
+        robj *cmd[6];
+        cmd[0] = createStringObject("hset", 4);
+        cmd[1] = createStringObject("hashkey", 7);
+        cmd[2] = createStringObject("f1", 2);
+        cmd[3] = createStringObject("v1", 2);
+        cmd[4] = createStringObject("f2", 2);
+        cmd[5] = createStringObject("v2", 2);
+        gtidGaplogKeysBuilderAddFromCmd(&builder, 0, cmd, 6);
+        for (int i = 0; i < 6; i++) decrRefCount(cmd[i]);
+        gtidGaplogKeys *keys = gtidGaplogKeysBuild(&builder);
+        test_assert(keys->size == 1);
+        test_assert(keys->keys[0]->objs != NULL);
+        test_assert(keys->keys[0]->subkeys_count == 2);
+        test_assert(!strcmp(keys->keys[0]->subkeys[1], "f2"));
+        gtidGaplogKeysRelease(keys);
+        gtidGaplogDeinitKeysBuilder(&builder);
+    }
+
+    TEST("gtid - gapLog key extra from range writes") {
+        const char *cmds[][8] = {
+            {"ltrim", "list", "1", "-2"},
+            {"zremrangebylex", "zset", "[a", "(c"},
+            {"bitfield", "bits", "get", "u8", "0", "set", "i4", "#3"},
+            {"setrange", "str", "2", "abc"},
+            {"zremrangebyscore", "zset", "x", "1"},
+        };
+        int argcs[] = {4, 4, 8, 4, 4};
+        gtidGaplogKeysBuilder builder = GTID_GAPLOG_KEYS_BUILDER_INIT;
+        for (int i = 0; i < 5; i++) {
+            robj *cmd[9];
+            for (int j = 0; j < argcs[i]; j++)
+                cmd[j] = createStringObject(cmds[i][j], strlen(cmds[i][j]));
+            if (i == 2) cmd[argcs[i]++] = createStringObject("1", 1);
+            gtidGaplogKeysBuilderAddFromCmd(&builder, 0, cmd, argcs[i]);
+            for (int j = 0; j < argcs[i]; j++) decrRefCount(cmd[j]);
+        }
+        gtidGaplogKeys *keys = gtidGaplogKeysBuild(&builder);
+        test_assert(keys->size == 5);
+
+        cmdParseKeyExtra *e = keys->keys[0]->extra;
+        test_assert(e->extra_type == CMDPARSE_EXTRA_RANGE);
+        test_assert(e->range.start == 1 && e->range.end == -2 && e->range.invert);
+
+        e = keys->keys[1]->extra;
+        test_assert(e->extra_type == CMDPARSE_EXTRA_ZLEX);
+        test_assert(!e->zlex.minex && e->zlex.maxex);
+        test_assert(!strcmp(e->zlex.min->ptr, "[a"));
+
+        e = keys->keys[2]->extra;
+        test_assert(e->extra_type == CMDPARSE_EXTRA_BITRNG);
+        test_assert(e->bitrng.start == 12 && e->bitrng.end == 15);
+
+        e = keys->keys[3]->extra;
+        test_assert(e->extra_type == CMDPARSE_EXTRA_BITRNG);
+        test_assert(e->bitrng.start == 16 && e->bitrng.end == 39);
+
+        /* unparsable bound falls back to whole key */
+        test_assert(keys->keys[4]->extra == NULL);
+
+        gtidGaplogKeysRelease(keys);
+        gtidGaplogDeinitKeysBuilder(&builder);
+    }
+
     TEST("gtid - gapLog keys builder, build and release") {
         /* test builder */
         gtidGaplogKeysBuilder builder = GTID_GAPLOG_KEYS_BUILDER_INIT;
@@ -952,15 +1649,14 @@ int gapLogTest(int argc, char **argv, int accurate) {
         test_assert(gap_log != NULL);
         test_assert(gap_log->size == 0);
         test_assert(gap_log->data != NULL);
-        test_assert(gap_log->history != NULL);
+        test_assert(gap_log->history.len == 0);
         test_assert(dictSize(gap_log->data) == 0);
-        test_assert(listLength(gap_log->history) == 0);
 
         /* reset */
         gtidGaplogReset(gap_log);
         test_assert(gap_log->size == 0);
         test_assert(dictSize(gap_log->data) == 0);
-        test_assert(listLength(gap_log->history) == 0);
+        test_assert(gap_log->history.len == 0);
 
         /* relase */
         gtidGaplogRelease(gap_log);
@@ -1002,18 +1698,13 @@ int gapLogTest(int argc, char **argv, int accurate) {
 
         test_assert(gtidGaplogSize(gap_log) == 2);
 
-        listNode *ln = listFirst(gap_log->history);
-        test_assert(ln != NULL);
-        uuidSet *us = (uuidSet*)listNodeValue(ln);
-        test_assert(us != NULL);
-
-        sds stored_uuid = sdsnewlen(us->uuid, us->uuid_len);
-        dictEntry *de = dictFind(gap_log->data, stored_uuid);
-        sdsfree(stored_uuid);
+        test_assert(gap_log->history.len == 2);
+        dictEntry *de = dictFind(gap_log->data, gap_log->history.entries[0].uuid);
         test_assert(de != NULL);
-        skiplist *sl = dictGetVal(de);
+        gtidGaplogEntries *entries = dictGetVal(de);
+        test_assert(entries->length == 2 && entries->nchunks == 1);
         gtidGaplogDataIterator iter;
-        gtidGaplogDataInitIterator(&iter, sl, 1);
+        gtidGaplogDataInitIterator(&iter, entries, 1);
         gno_t gno = gtidGaplogDataGetGno(&iter);
         test_assert(gno == 1);
         gtidGaplogKeys *k1 = gtidGaplogDataNext(&iter);
@@ -1037,7 +1728,7 @@ int gapLogTest(int argc, char **argv, int accurate) {
 
         gtidGaplogDeinitDataIterator(&iter);
 
-        gtidGaplogDataInitIterator(&iter, sl, 3);
+        gtidGaplogDataInitIterator(&iter, entries, 3);
         gno = gtidGaplogDataGetGno(&iter);
         test_assert(gno == 5);
         gtidGaplogKeys *k_mid = gtidGaplogDataNext(&iter);
@@ -1045,7 +1736,7 @@ int gapLogTest(int argc, char **argv, int accurate) {
         test_assert(sdslen(k_mid->keys[0]->key) == 7); /* "hashkey" */
         gtidGaplogDeinitDataIterator(&iter);
 
-        gtidGaplogDataInitIterator(&iter, sl, 10);
+        gtidGaplogDataInitIterator(&iter, entries, 10);
         gno = gtidGaplogDataGetGno(&iter);
         test_assert(gno == -1); /* not find node */
         gtidGaplogKeys *k_empty = gtidGaplogDataNext(&iter);
@@ -1056,20 +1747,60 @@ int gapLogTest(int argc, char **argv, int accurate) {
         gtidGaplogRelease(gap_log);
     }
 
-    TEST("gtid - gapLog history iterator") {
+    TEST("gtid - gapLog entries chunks") {
+        gtidGaplogEntries *entries = gtidGaplogEntriesNew();
 
-        gtidGaplog *gap_log = gtidGaplogNew();
+        /* dense run crossing chunk boundaries, then a far sparse gno and an
+         * out of order gno that lands before the first chunk */
+        for (gno_t gno = 60; gno < 200; gno++) {
+            test_assert(gtidGaplogEntriesInsert(entries, gno, gapLogTestKeysNew("k")));
+        }
+        test_assert(gtidGaplogEntriesInsert(entries, 100000, gapLogTestKeysNew("k")));
+        test_assert(gtidGaplogEntriesInsert(entries, 5, gapLogTestKeysNew("k")));
+        gtidGaplogKeys *dup = gapLogTestKeysNew("k");
+        test_assert(!gtidGaplogEntriesInsert(entries, 100, dup));
+        gtidGaplogKeysRelease(dup);
+        test_assert(entries->length == 142);
+        test_assert(entries->nchunks == 5); /* 0,64,128,192,99968 */
+
+        test_assert(gtidGaplogEntriesFind(entries, 5) != NULL);
+        test_assert(gtidGaplogEntriesFind(entries, 6) == NULL);
+        test_assert(gtidGaplogEntriesFind(entries, 150) != NULL);
+        test_assert(gtidGaplogEntriesFind(entries, 200) == NULL);
+        test_assert(gtidGaplogEntriesFind(entries, 100000) != NULL);
+
+        gtidGaplogDataIterator iter;
+        gtidGaplogDataInitIterator(&iter, entries, 6);
+        test_assert(gtidGaplogDataGetGno(&iter) == 60);
+        gtidGaplogDataIteratorSeek(&iter, 199);
+        test_assert(gtidGaplogDataGetGno(&iter) == 199);
+        test_assert(gtidGaplogDataNext(&iter) != NULL);
+        test_assert(gtidGaplogDataGetGno(&iter) == 100000);
+        test_assert(gtidGaplogDataNext(&iter) != NULL);
+        test_assert(gtidGaplogDataGetGno(&iter) == -1);
+        test_assert(gtidGaplogDataNext(&iter) == NULL);
+        gtidGaplogDeinitDataIterator(&iter);
 
-        /* add uuid-1: [1-3, 10-12] */
-        uuidSet *us1 = uuidSetNew("uuid-1", 6);
-        uuidSetAdd(us1, 1, 3);
-        uuidSetAdd(us1, 10, 12);
-        listAddNodeTail(gap_log->history, us1);
+        /* drop chunk 64 entirely and parts of its neighbours */
+        test_assert(gtidGaplogEntriesDeleteRange(entries, 62, 130, NULL, NULL) == 69);
+        test_assert(entries->length == 73);
+        test_assert(entries->nchunks == 4);
+        test_assert(gtidGaplogEntriesFind(entries, 61) != NULL);
+        test_assert(gtidGaplogEntriesFind(entries, 62) == NULL);
+        test_assert(gtidGaplogEntriesFind(entries, 131) != NULL);
+        gtidGaplogDataInitIterator(&iter, entries, 62);
+        test_assert(gtidGaplogDataGetGno(&iter) == 131);
+        gtidGaplogDeinitDataIterator(&iter);
 
-        /* add uuid-2: [100-101] */
-        uuidSet *us2 = uuidSetNew("uuid-2", 6);
-        uuidSetAdd(us2, 100, 101);
-        listAddNodeTail(gap_log->history, us2);
+        test_assert(gtidGaplogEntriesDeleteRange(entries, 0, 1000000, NULL, NULL) == 73);
+        test_assert(entries->length == 0 && entries->nchunks == 0);
+        gtidGaplogEntriesFree(entries);
+    }
+
+    TEST("gtid - gapLog history iterator") {
+
+        gtidGaplog *gap_log = gtidGaplogNew();
+        gapLogTestInsertHistory(gap_log);
 
         /*  history iterator */
         gtidGaplogHistoryIterator iter;
@@ -1077,54 +1808,57 @@ int gapLogTest(int argc, char **argv, int accurate) {
 
         const char *uuid;
         size_t uuid_len;
+        gtidGaplogKeys *keys;
 
         /* uuid-1: gno=1 */
-        gno_t gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno_t gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, &keys);
         test_assert(gno == 1);
         test_assert(uuid_len == 6);
         test_assert(memcmp(uuid, "uuid-1", 6) == 0);
+        test_assert(keys != NULL && keys->size == 1);
 
         /* uuid-1: gno=2 */
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, &keys);
         test_assert(gno == 2);
         test_assert(memcmp(uuid, "uuid-1", 6) == 0);
 
         /* uuid-1: gno=3 */
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, &keys);
         test_assert(gno == 3);
         test_assert(memcmp(uuid, "uuid-1", 6) == 0);
 
         /* uuid-1: gno=10 (interval) */
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, &keys);
         test_assert(gno == 10);
         test_assert(memcmp(uuid, "uuid-1", 6) == 0);
 
         /* uuid-1: gno=11 */
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, &keys);
         test_assert(gno == 11);
 
         /* uuid-1: gno=12 */
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, &keys);
         test_assert(gno == 12);
 
-        /* uuid-2: gno=100 (uuidSet) */
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        /* uuid-2: gno=100 */
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, &keys);
         test_assert(gno == 100);
         test_assert(uuid_len == 6);
         test_assert(memcmp(uuid, "uuid-2", 6) == 0);
 
         /* uuid-2: gno=101 */
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, &keys);
         test_assert(gno == 101);
 
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, &keys);
         test_assert(gno == 0);
         test_assert(uuid == NULL);
+        test_assert(keys == NULL);
 
         gtidGaplogDeinitHistoryIterator(&iter);
 
         gtidGaplogInitHistoryIterator(&iter, gap_log, 4);
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, NULL);
         test_assert(gno == 11);
         test_assert(memcmp(uuid, "uuid-1", 6) == 0);
         gtidGaplogDeinitHistoryIterator(&iter);
@@ -1135,52 +1869,44 @@ int gapLogTest(int argc, char **argv, int accurate) {
 
     TEST("gtid - gapLog history iterator Seek by index") {
         gtidGaplog *gap_log = gtidGaplogNew();
-
-        uuidSet *us1 = uuidSetNew("uuid-1", 6);
-        uuidSetAdd(us1, 1, 3);
-        uuidSetAdd(us1, 10, 12);
-        listAddNodeTail(gap_log->history, us1);
-
-        uuidSet *us2 = uuidSetNew("uuid-2", 6);
-        uuidSetAdd(us2, 100, 101);
-        listAddNodeTail(gap_log->history, us2);
+        gapLogTestInsertHistory(gap_log);
 
         const char *uuid;
         size_t uuid_len;
 
         gtidGaplogHistoryIterator iter;
         gtidGaplogInitHistoryIterator(&iter, gap_log, 0);
-        gno_t gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno_t gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, NULL);
         test_assert(gno == 1);
         test_assert(memcmp(uuid, "uuid-1", 6) == 0);
         gtidGaplogDeinitHistoryIterator(&iter);
 
         gtidGaplogInitHistoryIterator(&iter, gap_log, 4);
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, NULL);
         test_assert(gno == 11);
         test_assert(memcmp(uuid, "uuid-1", 6) == 0);
         gtidGaplogDeinitHistoryIterator(&iter);
 
         gtidGaplogInitHistoryIterator(&iter, gap_log, 6);
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, NULL);
         test_assert(gno == 100);
         test_assert(memcmp(uuid, "uuid-2", 6) == 0);
         gtidGaplogDeinitHistoryIterator(&iter);
 
         gtidGaplogInitHistoryIterator(&iter, gap_log, 7);
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, NULL);
         test_assert(gno == 101);
         test_assert(memcmp(uuid, "uuid-2", 6) == 0);
         gtidGaplogDeinitHistoryIterator(&iter);
 
         gtidGaplogInitHistoryIterator(&iter, gap_log, 8);
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, NULL);
         test_assert(gno == 0);
         test_assert(uuid == NULL);
         gtidGaplogDeinitHistoryIterator(&iter);
 
         gtidGaplogInitHistoryIterator(&iter, gap_log, 0);
-        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len);
+        gno = gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, NULL);
         test_assert(gno == 1);
         gtidGaplogDeinitHistoryIterator(&iter);
 
@@ -1188,6 +1914,47 @@ int gapLogTest(int argc, char **argv, int accurate) {
         zfree(gap_log);
     }
 
+    TEST("gtid - gapLog history ring wraps on trim and deleterange") {
+        gtidGaplog *gap_log = gtidGaplogNew();
+        sds uuid_a = sdsnew("uuid-A"), uuid_b = sdsnew("uuid-B");
+
+        /* interleave two uuids so that the ring grows and wraps */
+        for (gno_t gno = 1; gno <= 40; gno++) {
+            gtidGaplogInsert(gap_log, gno % 2 ? uuid_a : uuid_b, gno,
+                             gapLogTestKeysNew("k"));
+            if (gno % 4 == 0) test_assert(gtidGaplogTrim(gap_log, 1) == 1);
+        }
+        test_assert(gtidGaplogSize(gap_log) == 30);
+        test_assert(gap_log->history.len == 30);
+        test_assert(gap_log->history.head != 0);
+
+        const char *uuid;
+        size_t uuid_len;
+        gtidGaplogHistoryIterator iter;
+        gtidGaplogInitHistoryIterator(&iter, gap_log, 0);
+        test_assert(gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, NULL) == 11);
+        gtidGaplogDeinitHistoryIterator(&iter);
+
+        /* remove odd gnos 21..39 of uuid-A, order of the rest is kept */
+        test_assert(gtidGaplogDeleteRange(gap_log, uuid_a, 21, 39) == 10);
+        test_assert(gtidGaplogSize(gap_log) == 20);
+        gtidGaplogInitHistoryIterator(&iter, gap_log, 10);
+        for (gno_t gno = 22; gno <= 40; gno += 2) {
+            test_assert(gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, NULL) == gno);
+            test_assert(memcmp(uuid, "uuid-B", 6) == 0);
+        }
+        test_assert(gtidGaplogHistoryNext(&iter, &uuid, &uuid_len, NULL) == 0);
+        gtidGaplogDeinitHistoryIterator(&iter);
+
+        test_assert(gtidGaplogTrim(gap_log, 100) == 20);
+        test_assert(dictSize(gap_log->data) == 0);
+
+        sdsfree(uuid_a);
+        sdsfree(uuid_b);
+        gtidGaplogRelease(gap_log);
+        zfree(gap_log);
+    }
+
     TEST("gtid - gapLog trim basic") {
         gtidGaplog *gap_log = gtidGaplogNew();
         sds uuid = sdsnew("uuid-A");
@@ -1214,12 +1981,172 @@ int gapLogTest(int argc, char **argv, int accurate) {
         int trimmed = gtidGaplogTrim(gap_log, 1);
         test_assert(trimmed == 1);
         test_assert(gtidGaplogSize(gap_log) == 0);
-        test_assert(listLength(gap_log->history) == 0);
+        test_assert(gap_log->history.len == 0);
 
         sdsfree(uuid);
         gtidGaplogRelease(gap_log);
     }
 
+    TEST("gtid - gapLog key index") {
+        gtidGaplog *gap_log = gtidGaplogNew();
+        sds uuid_a = sdsnew("uuid-A"), uuid_b = sdsnew("uuid-B");
+        test_assert(gtidGaplogKeyIndexEnabled(gap_log));
+
+        /* uuid-A:1 {0:k1, 0:k2}, uuid-B:3 {0:k1, 1:k1}, uuid-A:2 {0:k1, 0:k1} */
+        struct { sds uuid; gno_t gno; int dbid[2]; const char *key[2]; } ops[] = {
+            {uuid_a, 1, {0, 0}, {"k1", "k2"}},
+            {uuid_b, 3, {0, 1}, {"k1", "k1"}},
+            {uuid_a, 2, {0, 0}, {"k1", "k1"}},
+        };
+        for (size_t i = 0; i < sizeof(ops)/sizeof(ops[0]); i++) {
+            gtidGaplogKeysBuilder builder = GTID_GAPLOG_KEYS_BUILDER_INIT;
+            gtidGaplogKeysPrepareBuilder(&builder, 2);
+            for (int j = 0; j < 2; j++) {
+                builder.keys_infos[builder.numkeys++] = gtidGaplogKeyNew(
+                        ops[i].dbid[j], OBJ_STRING, sdsnew(ops[i].key[j]), NULL, 0);
+            }
+            gtidGaplogInsert(gap_log, ops[i].uuid, ops[i].gno, gtidGaplogKeysBuild(&builder));
+            gtidGaplogDeinitKeysBuilder(&builder);
+        }
+
+        gtidGaplogKeyRefs *refs = gtidGaplogLookupKey(gap_log, 0, "k1", 2);
+        test_assert(refs != NULL && refs->len == 3);
+        test_assert(!strcmp(refs->refs[0].uuid, "uuid-A") && refs->refs[0].gno == 1);
+        test_assert(!strcmp(refs->refs[1].uuid, "uuid-B") && refs->refs[1].gno == 3);
+        test_assert(!strcmp(refs->refs[2].uuid, "uuid-A") && refs->refs[2].gno == 2);
+        refs = gtidGaplogLookupKey(gap_log, 1, "k1", 2);
+        test_assert(refs != NULL && refs->len == 1);
+        test_assert(gtidGaplogLookupKey(gap_log, 2, "k1", 2) == NULL);
+
+        /* trim evicts uuid-A:1 */
+        test_assert(gtidGaplogTrim(gap_log, 1) == 1);
+        test_assert(gtidGaplogLookupKey(gap_log, 0, "k2", 2) == NULL);
+        refs = gtidGaplogLookupKey(gap_log, 0, "k1", 2);
+        test_assert(refs != NULL && refs->len == 2);
+        test_assert(refs->refs[0].gno == 3 && refs->refs[1].gno == 2);
+
+        /* deleterange drops uuid-B:3 */
+        test_assert(gtidGaplogDeleteRange(gap_log, uuid_b, 1, 10) == 1);
+        test_assert(gtidGaplogLookupKey(gap_log, 1, "k1", 2) == NULL);
+        refs = gtidGaplogLookupKey(gap_log, 0, "k1", 2);
+        test_assert(refs != NULL && refs->len == 1 && refs->refs[0].gno == 2);
+
+        /* disable then rebuild from data */
+        gtidGaplogSetKeyIndex(gap_log, 0);
+        test_assert(!gtidGaplogKeyIndexEnabled(gap_log));
+        test_assert(gtidGaplogLookupKey(gap_log, 0, "k1", 2) == NULL);
+        gtidGaplogSetKeyIndex(gap_log, 1);
+        refs = gtidGaplogLookupKey(gap_log, 0, "k1", 2);
+        test_assert(refs != NULL && refs->len == 1 && refs->refs[0].gno == 2);
+
+        gtidGaplogReset(gap_log);
+        test_assert(dictSize(gap_log->key_index) == 0);
+
+        sdsfree(uuid_a);
+        sdsfree(uuid_b);
+        gtidGaplogRelease(gap_log);
+        zfree(gap_log);
+    }
+
+    TEST("gtid - gapLog key index pops trimmed refs from head") {
+        gtidGaplog *gap_log = gtidGaplogNew();
+        sds uuid_a = sdsnew("uuid-A");
+        gtidGaplogKeyRefs *refs;
+
+        for (gno_t gno = 1; gno <= 100; gno++) {
+            gtidGaplogKeysBuilder builder = GTID_GAPLOG_KEYS_BUILDER_INIT;
+            gtidGaplogKeysPrepareBuilder(&builder, 1);
+            builder.keys_infos[builder.numkeys++] =
+                gtidGaplogKeyNew(0, OBJ_STRING, sdsnew("hot"), NULL, 0);
+            gtidGaplogInsert(gap_log, uuid_a, gno, gtidGaplogKeysBuild(&builder));
+            gtidGaplogDeinitKeysBuilder(&builder);
+            if (gno > 10) test_assert(gtidGaplogTrim(gap_log, 1) == 1);
+        }
+        refs = gtidGaplogLookupKey(gap_log, 0, "hot", 3);
+        test_assert(refs != NULL && refs->len == 10);
+        test_assert(refs->cap <= 32); /* popped refs reclaimed, not grown */
+        for (size_t i = 0; i < refs->len; i++)
+            test_assert(refs->refs[i].gno == (gno_t)(91 + i));
+
+        /* removal out of order keeps the rest in order */
+        test_assert(gtidGaplogDeleteRange(gap_log, uuid_a, 95, 95) == 1);
+        refs = gtidGaplogLookupKey(gap_log, 0, "hot", 3);
+        test_assert(refs->len == 9 && refs->refs[0].gno == 91 &&
+                refs->refs[3].gno == 94 && refs->refs[4].gno == 96);
+
+        sdsfree(uuid_a);
+        gtidGaplogRelease(gap_log);
+        zfree(gap_log);
+    }
+
+    TEST("gtid - gapLog key index grows with few refs popped") {
+        gtidGaplog *gap_log = gtidGaplogNew();
+        sds uuid_a = sdsnew("uuid-A");
+        gtidGaplogKeyRefs *refs;
+
+        /* cap=4 with one ref popped (head < cap/2), then grow */
+        for (gno_t gno = 1; gno <= 6; gno++) {
+            gtidGaplogKeysBuilder builder = GTID_GAPLOG_KEYS_BUILDER_INIT;
+            gtidGaplogKeysPrepareBuilder(&builder, 1);
+            builder.keys_infos[builder.numkeys++] =
+                gtidGaplogKeyNew(0, OBJ_STRING, sdsnew("hot"), NULL, 0);
+            gtidGaplogInsert(gap_log, uuid_a, gno, gtidGaplogKeysBuild(&builder));
+            gtidGaplogDeinitKeysBuilder(&builder);
+            if (gno == 4) {
+                refs = gtidGaplogLookupKey(gap_log, 0, "hot", 3);
+                test_assert(refs->cap == 4 && refs->len == 4);
+                test_assert(gtidGaplogTrim(gap_log, 1) == 1);
+                test_assert(refs->head == 1);
+            }
+        }
+        refs = gtidGaplogLookupKey(gap_log, 0, "hot", 3);
+        test_assert(refs->len == 5 && refs->head == 0 && refs->cap == 8);
+        for (size_t i = 0; i < refs->len; i++)
+            test_assert(refs->refs[i].gno == (gno_t)(2 + i));
+
+        sdsfree(uuid_a);
+        gtidGaplogRelease(gap_log);
+        zfree(gap_log);
+    }
+
+    TEST("gtid - gapLog used memory") {
+        gtidGaplog *gap_log = gtidGaplogNew();
+        sds uuid_a = sdsnew("uuid-A"), uuid_b = sdsnew("uuid-B");
+        size_t empty_memory = gtidGaplogUsedMemory(gap_log);
+
+        for (gno_t gno = 1; gno <= 100; gno++) {
+            gtidGaplogKeysBuilder builder = GTID_GAPLOG_KEYS_BUILDER_INIT;
+            gtidGaplogKeysPrepareBuilder(&builder, 1);
+            sds key = sdscatfmt(sdsempty(), "memkey%I", gno);
+            builder.keys_infos[builder.numkeys++] =
+                gtidGaplogKeyNew(0, OBJ_STRING, key, NULL, 0);
+            gtidGaplogInsert(gap_log, gno % 2 ? uuid_a : uuid_b, gno,
+                    gtidGaplogKeysBuild(&builder));
+            gtidGaplogDeinitKeysBuilder(&builder);
+        }
+        test_assert(gap_log->keys_memory > 100 * sizeof(gtidGaplogKey));
+        test_assert(gap_log->key_index_memory > 0);
+        test_assert(gtidGaplogUsedMemory(gap_log) > empty_memory +
+                gap_log->keys_memory + gap_log->key_index_memory);
+
+        /* disabling key index releases its memory */
+        gtidGaplogSetKeyIndex(gap_log, 0);
+        test_assert(gap_log->key_index_memory == 0);
+        gtidGaplogSetKeyIndex(gap_log, 1);
+        test_assert(gap_log->key_index_memory > 0);
+
+        test_assert(gtidGaplogTrim(gap_log, 10) == 10);
+        test_assert(gtidGaplogDeleteRange(gap_log, uuid_a, 1, 100) == 45);
+        test_assert(gtidGaplogDeleteRange(gap_log, uuid_b, 1, 100) == 45);
+        test_assert(gap_log->keys_memory == 0);
+        test_assert(gap_log->key_index_memory == 0);
+
+        sdsfree(uuid_a);
+        sdsfree(uuid_b);
+        gtidGaplogRelease(gap_log);
+        zfree(gap_log);
+    }
+
     return error;
 }
 #endif
@@ -52,10 +52,102 @@ void rdbSaveInfoGtidDestroy(rdbSaveInfoGtid *gtid_rsi) {
 #define GTID_AUX_REPL_MODE    "gtid-repl-mode"
 #define GTID_AUX_EXECUTED     "gtid-executed"
 #define GTID_AUX_LOST         "gtid-lost"
+/* Huge gtid sets are saved as several chunk fields, each a valid gtid set
+ * repr of about GTID_AUX_CHUNK_SIZE bytes that is merged when loaded. Sets
+ * that fit in one chunk keep the single field understood by old versions. */
+#define GTID_AUX_EXECUTED_CHUNK "gtid-executed-chunk"
+#define GTID_AUX_LOST_CHUNK     "gtid-lost-chunk"
+#define GTID_AUX_CHUNK_SIZE     (64*1024)
+
+static int rdbSaveGtidSetAuxChunk(rio *rdb, const char *field, sds chunk) {
+    if (rdbSaveAuxField(rdb, (void*)field, strlen(field), chunk,
+                sdslen(chunk)) == -1) {
+        return -1;
+    }
+    sdsclear(chunk);
+    return 0;
+}
+
+/* Write gtid_set without rendering the whole repr: intervals are appended
+ * to a chunk buffer which is flushed whenever it reaches chunk size. */
+static int rdbSaveGtidSetAuxField(rio *rdb, const char *field,
+        const char *chunk_field, gtidSet *gtid_set) {
+    int ret = -1;
+    sds chunk;
+    gtidSetIterator git;
+    uuidSetIterator uit;
+    uuidSet *uuid_set;
+    gtidIntervalNode *node;
+
+    if (gtidSetEstimatedEncodeBufferSize(gtid_set) <= GTID_AUX_CHUNK_SIZE) {
+        chunk = gtidSetDump(gtid_set);
+        ret = rdbSaveAuxField(rdb, (void*)field, strlen(field), chunk,
+                sdslen(chunk)) == -1 ? -1 : 0;
+        sdsfree(chunk);
+        return ret;
+    }
+
+    chunk = sdsMakeRoomFor(sdsempty(), GTID_AUX_CHUNK_SIZE);
+    gtidSetInitIterator(&git, gtid_set);
+    while ((uuid_set = gtidSetIteratorNext(&git)) != NULL) {
+        int uuid_in_chunk = 0;
+        uuidSetInitIterator(&uit, uuid_set);
+        while ((node = uuidSetIteratorNext(&uit)) != NULL) {
+            if (sdslen(chunk) >= GTID_AUX_CHUNK_SIZE) {
+                if (rdbSaveGtidSetAuxChunk(rdb, chunk_field, chunk) == -1) {
+                    uuidSetDeinitIterator(&uit);
+                    goto end;
+                }
+                uuid_in_chunk = 0;
+            }
+            if (!uuid_in_chunk) {
+                if (sdslen(chunk)) chunk = sdscatlen(chunk, ",", 1);
+                chunk = sdscatlen(chunk, uuid_set->uuid, uuid_set->uuid_len);
+                uuid_in_chunk = 1;
+            }
+            if (node->start == node->end)
+                chunk = sdscatfmt(chunk, ":%I", node->start);
+            else
+                chunk = sdscatfmt(chunk, ":%I-%I", node->start, node->end);
+        }
+        uuidSetDeinitIterator(&uit);
+    }
+    if (sdslen(chunk) && rdbSaveGtidSetAuxChunk(rdb, chunk_field, chunk) == -1)
+        goto end;
+    ret = 0;
+
+end:
+    gtidSetDeinitIterator(&git);
+    sdsfree(chunk);
+    return ret;
+}
+
+/* Merge one chunk into *pgtid_set, created if not loaded yet. A partial
+ * set is worse than none, so the whole set is dropped (and later chunks
+ * ignored) once any chunk is invalid, the same as an invalid single field. */
+static void loadGtidSetAuxChunk(gtidSet **pgtid_set, int *invalid,
+        const char *field, sds repr) {
+    gtidSet *chunk;
+    if (*invalid) return;
+    chunk = gtidSetDecode(repr, sdslen(repr));
+    if (chunk == NULL) {
+        serverLog(LL_WARNING, "Dropped gtid set of invalid %s aux field.",
+                field);
+        if (*pgtid_set) gtidSetFree(*pgtid_set);
+        *pgtid_set = NULL;
+        *invalid = 1;
+        return;
+    }
+    if (*pgtid_set == NULL) {
+        *pgtid_set = chunk;
+    } else {
+        gtidSetMerge(*pgtid_set, chunk);
+        gtidSetFree(chunk);
+    }
+}
 
 int rdbSaveInfoAuxFieldsGtid(rio* rdb, rdbSaveInfo *rsi) {
     char *repl_mode = NULL;
-    sds gtid_executed_repr = NULL, gtid_lost_repr = NULL;
 
     /* No need to save gtid related rep stream info if rdb is not in any
      * kind of replication history */
@@ -65,9 +157,9 @@ int rdbSaveInfoAuxFieldsGtid(rio* rdb, rdbSaveInfo *rsi) {
 #endif
        ) return 1;
 
+    GTID_LATENCY_START(latency);
     repl_mode = (char*)replModeName(server.repl_mode->mode);
-    gtid_executed_repr = gtidSetDump(server.gtid_executed);
-    gtid_lost_repr = gtidSetDump(server.gtid_lost);
+    serverGtidExecutedFlush();
 
     /* Note: gtid-repl-mode must save before other gtid aux fields, otherwise
      * aux fields will lost when load because gtid save info not initiated. */
@@ -76,25 +168,21 @@ int rdbSaveInfoAuxFieldsGtid(rio* rdb, rdbSaveInfo *rsi) {
         goto err;
     }
 
-    if (rdbSaveAuxField(rdb, GTID_AUX_EXECUTED,
-                strlen(GTID_AUX_EXECUTED),
-                gtid_executed_repr, sdslen(gtid_executed_repr)) == -1) {
+    if (rdbSaveGtidSetAuxField(rdb, GTID_AUX_EXECUTED,
+                GTID_AUX_EXECUTED_CHUNK, server.gtid_executed) == -1) {
         goto err;
     }
 
-    if (rdbSaveAuxField(rdb, GTID_AUX_LOST,
-                strlen(GTID_AUX_LOST),
-                gtid_lost_repr, sdslen(gtid_lost_repr)) == -1) {
+    if (rdbSaveGtidSetAuxField(rdb, GTID_AUX_LOST,
+                GTID_AUX_LOST_CHUNK, server.gtid_lost) == -1) {
         goto err;
     }
 
-    sdsfree(gtid_executed_repr);
-    sdsfree(gtid_lost_repr);
+    GTID_LATENCY_END(GTID_LATENCY_RDB_SAVE,latency);
     return 1;
 
 err:
-    sdsfree(gtid_executed_repr);
-    sdsfree(gtid_lost_repr);
+    GTID_LATENCY_END(GTID_LATENCY_RDB_SAVE,latency);
     return -1;
 }
 
@@ -118,19 +206,130 @@ int loadInfoAuxFieldsGtid(robj* key, robj* val, rdbSaveInfo *rsi) {
         return 1;
     } else if (!strcasecmp(key->ptr, GTID_AUX_EXECUTED)) {
         if (rsi) {
+            GTID_LATENCY_START(latency);
             serverAssert(gtid_rsi);
             gtid_rsi->gtid_executed = gtidSetDecode(val->ptr,sdslen(val->ptr));
+            GTID_LATENCY_END(GTID_LATENCY_RDB_LOAD,latency);
         }
         return 1;
     } else if (!strcasecmp(key->ptr, GTID_AUX_LOST)) {
         if (rsi) {
+            GTID_LATENCY_START(latency);
             serverAssert(gtid_rsi);
             gtidSet *gtid_lost = gtidSetDecode(val->ptr, sdslen(val->ptr));
             if (gtid_lost == NULL) gtid_lost = gtidSetNew();
             gtid_rsi->gtid_lost = gtid_lost;
+            GTID_LATENCY_END(GTID_LATENCY_RDB_LOAD,latency);
+        }
+        return 1;
+    } else if (!strcasecmp(key->ptr, GTID_AUX_EXECUTED_CHUNK)) {
+        if (rsi) {
+            GTID_LATENCY_START(latency);
+            serverAssert(gtid_rsi);
+            loadGtidSetAuxChunk(&gtid_rsi->gtid_executed,
+                    &gtid_rsi->gtid_executed_invalid,
+                    GTID_AUX_EXECUTED_CHUNK, val->ptr);
+            GTID_LATENCY_END(GTID_LATENCY_RDB_LOAD,latency);
+        }
+        return 1;
+    } else if (!strcasecmp(key->ptr, GTID_AUX_LOST_CHUNK)) {
+        if (rsi) {
+            GTID_LATENCY_START(latency);
+            serverAssert(gtid_rsi);
+            loadGtidSetAuxChunk(&gtid_rsi->gtid_lost,
+                    &gtid_rsi->gtid_lost_invalid,
+                    GTID_AUX_LOST_CHUNK, val->ptr);
+            if (gtid_rsi->gtid_lost == NULL) gtid_rsi->gtid_lost = gtidSetNew();
+            GTID_LATENCY_END(GTID_LATENCY_RDB_LOAD,latency);
         }
         return 1;
     }
     return 0;
 }
 
+#ifdef REDIS_TEST
+static gtidSet *rdbGtidTestSaveAndLoad(gtidSet *gtid_set, int *pnfields,
+        size_t *pmaxlen) {
+    rio rdb;
+    rdbSaveInfo rsi;
+    robj *key, *val;
+    gtidSet *loaded;
+
+    rioInitWithBuffer(&rdb, sdsempty());
+    serverAssert(rdbSaveGtidSetAuxField(&rdb, GTID_AUX_EXECUTED,
+                GTID_AUX_EXECUTED_CHUNK, gtid_set) == 0);
+
+    memset(&rsi, 0, sizeof(rsi));
+    rsi.gtid = rdbSaveInfoGtidCreate();
+    rioInitWithBuffer(&rdb, rdb.io.buffer.ptr);
+    *pnfields = 0, *pmaxlen = 0;
+    while (rdbLoadType(&rdb) == RDB_OPCODE_AUX) {
+        key = rdbLoadStringObject(&rdb);
+        val = rdbLoadStringObject(&rdb);
+        serverAssert(loadInfoAuxFieldsGtid(key, val, &rsi) == 1);
+        if (sdslen(val->ptr) > *pmaxlen) *pmaxlen = sdslen(val->ptr);
+        (*pnfields)++;
+        decrRefCount(key);
+        decrRefCount(val);
+    }
+    sdsfree(rdb.io.buffer.ptr);
+
+    loaded = rsi.gtid->gtid_executed;
+    rsi.gtid->gtid_executed = NULL;
+    rdbSaveInfoGtidDestroy(rsi.gtid);
+    return loaded;
+}
+
+int rdbGtidTest(int argc, char **argv, int accurate) {
+    UNUSED(argc), UNUSED(argv), UNUSED(accurate);
+    int error = 0;
+
+    TEST("gtid - rdb aux small gtid set saved in one field") {
+        int nfields;
+        size_t maxlen;
+        gtidSet *gtid_set = gtidSetDecode("A:1-10:20,B:3-5", 15);
+        gtidSet *loaded = rdbGtidTestSaveAndLoad(gtid_set, &nfields, &maxlen);
+        test_assert(nfields == 1);
+        test_assert(loaded && gtidSetEqual(loaded, gtid_set));
+        gtidSetFree(gtid_set);
+        gtidSetFree(loaded);
+    }
+
+    TEST("gtid - rdb aux huge gtid set saved and loaded in chunks") {
+        int nfields;
+        size_t maxlen;
+        gtidSet *gtid_set = gtidSetNew();
+        for (gno_t gno = 1; gno <= 200000; gno += 2) {
+            gtidSetAdd(gtid_set, "A", 1, gno, gno);
+            if (gno % 10 == 1) gtidSetAdd(gtid_set, "B", 1, gno, gno);
+        }
+        gtidSet *loaded = rdbGtidTestSaveAndLoad(gtid_set, &nfields, &maxlen);
+        test_assert(nfields > 1);
+        test_assert(maxlen < GTID_AUX_CHUNK_SIZE + 64);
+        test_assert(loaded && gtidSetEqual(loaded, gtid_set));
+        gtidSetFree(gtid_set);
+        gtidSetFree(loaded);
+    }
+
+    TEST("gtid - rdb aux invalid chunk drops the whole gtid set") {
+        rdbSaveInfo rsi;
+        const char *chunks[] = {"A:1-10", "A:x-", "A:20-30"};
+        robj *key = createStringObject(GTID_AUX_EXECUTED_CHUNK,
+                strlen(GTID_AUX_EXECUTED_CHUNK));
+
+        memset(&rsi, 0, sizeof(rsi));
+        rsi.gtid = rdbSaveInfoGtidCreate();
+        for (size_t i = 0; i < sizeof(chunks)/sizeof(chunks[0]); i++) {
+            robj *val = createStringObject(chunks[i], strlen(chunks[i]));
+            test_assert(loadInfoAuxFieldsGtid(key, val, &rsi) == 1);
+            decrRefCount(val);
+        }
+        test_assert(rsi.gtid->gtid_executed == NULL);
+        test_assert(rsi.gtid->gtid_executed_invalid);
+        rdbSaveInfoGtidDestroy(rsi.gtid);
+        decrRefCount(key);
+    }
+
+    return error;
+}
+#endif
@@ -269,6 +269,9 @@ typedef struct syncResult {
             long long reploff;
             gtidSet *gtid_cont;
             gtidSet *delta_lost;
+            /* aof ranges streamed ahead of backlog, NULL if continue
+             * point is in backlog. */
+            gtidAofRange *aof;
         } xc; /* xcontinue */
         struct {
             sds replid;
@@ -298,6 +301,7 @@ void syncResultFree(syncResult *result) {
         sdsfree(result->xc.replid);
         gtidSetFree(result->xc.gtid_cont);
         gtidSetFree(result->xc.delta_lost);
+        gtidAofRangeFree(result->xc.aof);
         break;
     case SYNC_ACTION_CONTINUE:
         sdsfree(result->cc.replid);
@@ -310,10 +314,20 @@ void syncResultFree(syncResult *result) {
     zfree(result);
 }
 
+void gtidAofRangeFree(gtidAofRange *range) {
+    if (range == NULL) return;
+    for (int i = 0; i < range->nfile; i++) sdsfree(range->paths[i]);
+    zfree(range->paths);
+    zfree(range->starts);
+    zfree(range->ends);
+    zfree(range);
+}
+
 void masterAnaPsyncRequest(syncResult *result, syncRequest *request) {
     syncLocateResult slr;
     sds psync_replid = request->p.replid;
     long long psync_offset = request->p.offset;
+    gtidSet *gtid_xsync;
 
     if (request->p.replid[0] == '?') {
         result->action = SYNC_ACTION_FULL;
@@ -355,14 +369,19 @@ void masterAnaPsyncRequest(syncResult *result, syncRequest *request) {
                 result->cc.replid = sdsnew(replid1);
                 result->cc.reploff = -1; /* no need to align reploff */
                 result->msg = sdsnew("prior psync => xsync");
+            } else if ((gtid_xsync = gtidSeqPsync(server.gtid_seq,
+                            psync_offset)) == NULL) {
+                result->action = SYNC_ACTION_FULL;
+                result->msg = sdscatprintf(sdsempty(),
+                        "gtids after psync offset(%lld) can't be located",
+                        psync_offset);
             } else {
-                gtidSet *gtid_master, *gtid_cont, *gtid_xsync;
+                gtidSet *gtid_master, *gtid_cont;
                 sds gtid_master_repr, gtid_continue_repr, gtid_xsync_repr;
 
                 gtid_master = serverGtidSetGet("[psync] [ana]");
                 gtid_master_repr = gtidSetDump(gtid_master);
 
-                gtid_xsync = gtidSeqPsync(server.gtid_seq,psync_offset);
                 gtid_cont = gtid_master, gtid_master = NULL;
                 gtidSetDiff(gtid_cont,gtid_xsync);
 
@@ -401,20 +420,99 @@ void masterAnaPsyncRequest(syncResult *result, syncRequest *request) {
     syncLocateResultDeinit(&slr);
 }
 
+/* gtid.set reprs for xsync analysis logs. serverLog does not evaluate its
+ * arguments below server verbosity, so sets are dumped only when actually
+ * logged, at most once per analysis, and summarized when too large. */
+#define XSYNC_ANA_REPR_SLOTS    8
+#define XSYNC_ANA_REPR_MAXLEN   1024
+
+typedef struct xsyncAnaReprs {
+    int used;
+    gtidSet *sets[XSYNC_ANA_REPR_SLOTS];
+    sds reprs[XSYNC_ANA_REPR_SLOTS];
+} xsyncAnaReprs;
+
+static const char *xsyncAnaRepr(xsyncAnaReprs *ar, gtidSet *gtid_set) {
+    gtidStat stat;
+    sds repr;
+
+    for (int i = 0; i < ar->used; i++) {
+        if (ar->sets[i] == gtid_set) return ar->reprs[i];
+    }
+    if (ar->used == XSYNC_ANA_REPR_SLOTS) return "...";
+
+    if (gtidSetEstimatedEncodeBufferSize(gtid_set) <= XSYNC_ANA_REPR_MAXLEN) {
+        repr = gtidSetDump(gtid_set);
+    } else {
+        gtidSetGetStat(gtid_set,&stat);
+        repr = sdscatprintf(sdsempty(),"<uuids=%zu,intervals=%zu,gnos=%lld>",
+                stat.uuid_count,stat.uuid_count+stat.gap_count,
+                (long long)stat.gno_count);
+    }
+    ar->sets[ar->used] = gtid_set;
+    ar->reprs[ar->used++] = repr;
+    return repr;
+}
+
+static void xsyncAnaReprsDeinit(xsyncAnaReprs *ar) {
+    for (int i = 0; i < ar->used; i++) sdsfree(ar->reprs[i]);
+    ar->used = 0;
+}
+
+/* Continue point locates at the very first gtid of gtid.seq while slave
+ * still misses gtids before it: those are trimmed from backlog, but might
+ * still be found in incremental aof files. If so, gtid.set-xsync is
+ * extended with gtids streamed from aof and aof ranges are returned. */
+static gtidAofRange *masterAnaXsyncFromAof(gtidSet *gtid_slave,
+        long long psync_offset, gtidSet *gtid_xsync) {
+    const char *uuid;
+    size_t uuid_len;
+    gno_t gno;
+    long long first_offset, reploff, maxbytes;
+    gtidSet *gtid_aof = NULL;
+    gtidAofRange *range;
+
+    if (server.gtid_seq == NULL || !gtidSeqFirst(server.gtid_seq,&uuid,
+                &uuid_len,&gno,&first_offset))
+        return NULL;
+    if (psync_offset != first_offset ||
+            gtidSetNext(gtid_slave,uuid,uuid_len,0) >= gno)
+        return NULL;
+
+    /* Streaming aof beyond gtid-xsync-aof-max-bytes (backlog size if 0)
+     * costs more than fullresync. Besides, XCONTINUE reploff is lowered by
+     * aof bytes so that slave offset reaches psync_offset right after aof is
+     * streamed, which must not go below the start of current repl mode. */
+    serverReplModeGetCurReplIdOff(psync_offset-1,&reploff);
+    maxbytes = server.gtid_xsync_aof_max_bytes ?
+        server.gtid_xsync_aof_max_bytes : server.repl_backlog_size;
+    if (maxbytes > reploff) maxbytes = reploff;
+    range = gtidAofXsync(gtid_slave,uuid,uuid_len,gno,maxbytes,&gtid_aof);
+    if (range == NULL) {
+        serverLog(LL_NOTICE, "[xsync] [ana] gtids before %.*s:%lld"
+                " not found in aof within %lld bytes.", (int)uuid_len, uuid,
+                gno, maxbytes);
+        return NULL;
+    }
+
+    gtidSetMerge(gtid_xsync,gtid_aof);
+    serverLog(LL_NOTICE, "[xsync] [ana] continue point extended to aof:"
+            " files=%d, bytes=%lld", range->nfile, range->bytes);
+    gtidSetFree(gtid_aof);
+    return range;
+}
+
+/* Only gtid.set-continue and gtid.set-mlost are handed out in result, the
+ * other sets in the analysis are only needed for their counts. */
 void masterAnaXsyncRequest(syncResult *result, syncRequest *request) {
     syncLocateResult slr;
     long long psync_offset, maxgap = request->x.maxgap;
     gtidSet *gtid_slave = request->x.gtid_slave;
-    gtidSet *gtid_master = NULL, *gtid_cont = NULL, *gtid_xsync = NULL,
-            *gtid_gap = NULL, *gtid_mlost = NULL, *gtid_slost = NULL,
-            *gtid_mexec = NULL, *gtid_sexec = NULL,
-            *gtid_mexec_gap = NULL, *gtid_sexec_gap = NULL;
-    sds gtid_master_repr = NULL, gtid_continue_repr = NULL,
-        gtid_xsync_repr = NULL, gtid_slave_repr = NULL,
-        gtid_mlost_repr = NULL, gtid_slost_repr = NULL,
-        gtid_mexec_repr = NULL, gtid_sexec_repr = NULL,
-        gtid_mgap_repr = NULL, gtid_sgap_repr = NULL,
-        gtid_lost_repr = NULL, gtid_executed_repr = NULL;
+    gtidSet *gtid_cont = NULL, *gtid_xsync = NULL, *gtid_mlost = NULL,
+            *gtid_mexec = NULL, *gtid_sexec = NULL;
+    gno_t slost, mgap, sgap;
+    gtidAofRange *aof = NULL;
+    xsyncAnaReprs ar = {0};
 
     syncLocateResultInit(&slr);
 
@@ -425,18 +523,16 @@ void masterAnaXsyncRequest(syncResult *result, syncRequest *request) {
         goto end;
     }
 
-    gtid_master = serverGtidSetGet("[xsync] [ana]");
-    gtid_master_repr = gtidSetDump(gtid_master);
-    gtid_slave_repr = gtidSetDump(gtid_slave);
+    gtid_cont = serverGtidSetGet("[xsync] [ana]");
 
     /* FullResync if gtidSet not related, for example:
      *   empty slave asks for xsync
      *   instance of another shard asks for xsync */
-    if (!gtidSetRelated(gtid_master,gtid_slave)) {
+    if (!gtidSetRelated(gtid_cont,gtid_slave)) {
         result->action = SYNC_ACTION_FULL;
         result->msg = sdscatprintf(sdsempty(),
                 "gtid.set-master(%s) and gtid.set-slave(%s) not related",
-                gtid_master_repr, gtid_slave_repr);
+                xsyncAnaRepr(&ar,gtid_cont), xsyncAnaRepr(&ar,gtid_slave));
         goto end;
     }
 
@@ -449,9 +545,8 @@ void masterAnaXsyncRequest(syncResult *result, syncRequest *request) {
         psync_offset = gtidSeqXsync(server.gtid_seq,gtid_slave,&gtid_xsync);
     }
 
-    gtid_xsync_repr = gtidSetDump(gtid_xsync);
     serverLog(LL_NOTICE, "[xsync] [ana] continue point locate at offset=%lld,"
-            " gtid.set-xsync=%s", psync_offset, gtid_xsync_repr);
+            " gtid.set-xsync=%s", psync_offset, xsyncAnaRepr(&ar,gtid_xsync));
 
     if (psync_offset < 0) {
         if (server.repl_mode->mode == REPL_MODE_XSYNC) {
@@ -481,64 +576,50 @@ void masterAnaXsyncRequest(syncResult *result, syncRequest *request) {
         goto end;
     }
 
-    gtidSetDiff(gtid_master,gtid_xsync);
-    gtid_cont = gtid_master, gtid_master = NULL;
+    if (slr.locate_type == LOCATE_TYPE_CUR)
+        aof = masterAnaXsyncFromAof(gtid_slave,psync_offset,gtid_xsync);
 
-    gtid_continue_repr = gtidSetDump(gtid_cont);
+    /* gtid.set-master was logged by serverGtidSetGet, diff it in place. */
+    gtidSetDiff(gtid_cont,gtid_xsync);
     serverLog(LL_NOTICE, "[xsync] [ana] gtid.set-continue(%s) ="
-            " gtid.set-master(%s) - gtid.set-xsync(%s)",
-            gtid_continue_repr,gtid_master_repr,gtid_xsync_repr);
+            " gtid.set-master - gtid.set-xsync(%s)",
+            xsyncAnaRepr(&ar,gtid_cont),xsyncAnaRepr(&ar,gtid_xsync));
 
-    gtid_slost = gtidSetDup(gtid_cont);
-    gtidSetDiff(gtid_slost,gtid_slave);
-
-    gtid_slost_repr = gtidSetDump(gtid_slost);
-    serverLog(LL_NOTICE, "[xsync] [ana] gtid.set-slost(%s) ="
-            " gtid.set-continue(%s) - gtid.set-slave(%s)",
-            gtid_slost_repr,gtid_continue_repr,gtid_slave_repr);
+    slost = gtidSetDiffCount(gtid_cont,gtid_slave);
+    serverLog(LL_NOTICE, "[xsync] [ana] gtid.set-slost count=%lld ="
+            " |gtid.set-continue(%s) - gtid.set-slave(%s)|",
+            slost,xsyncAnaRepr(&ar,gtid_cont),xsyncAnaRepr(&ar,gtid_slave));
 
     gtid_mlost = gtidSetDup(gtid_slave);
     gtidSetDiff(gtid_mlost,gtid_cont);
-
-    gtid_mlost_repr = gtidSetDump(gtid_mlost);
     serverLog(LL_NOTICE, "[xsync] [ana] gtid.set-mlost(%s) ="
             " gtid.set-slave(%s) - gtid.set-continue(%s)",
-            gtid_mlost_repr,gtid_slave_repr,gtid_continue_repr);
-
-    gtid_executed_repr = gtidSetDump(server.gtid_executed);
+            xsyncAnaRepr(&ar,gtid_mlost),xsyncAnaRepr(&ar,gtid_slave),
+            xsyncAnaRepr(&ar,gtid_cont));
 
+    serverGtidExecutedFlush();
     gtid_mexec = gtidSetDup(server.gtid_executed);
     gtidSetDiff(gtid_mexec, gtid_xsync);
-
-    gtid_mexec_repr = gtidSetDump(gtid_mexec);
     serverLog(LL_NOTICE, "[xsync] [ana] gtid.set-mexec(%s) ="
             " gtid.set-executed(%s) - gtid.set-xsync(%s)",
-            gtid_mexec_repr,gtid_executed_repr,gtid_xsync_repr);
-
-    gtid_lost_repr = gtidSetDump(request->x.gtid_lost);
+            xsyncAnaRepr(&ar,gtid_mexec),
+            xsyncAnaRepr(&ar,server.gtid_executed),
+            xsyncAnaRepr(&ar,gtid_xsync));
 
     gtid_sexec = gtidSetDup(gtid_slave);
     gtidSetDiff(gtid_sexec, request->x.gtid_lost);
-    gtid_sexec_repr = gtidSetDump(gtid_sexec);
     serverLog(LL_NOTICE, "[xsync] [ana] gtid.set-sexec(%s) ="
             " gtid.set-slave(%s) - gtid.set-lost(%s)",
-            gtid_sexec_repr, gtid_slave_repr, gtid_lost_repr);
-
-    gtid_mexec_gap = gtidSetDup(gtid_mexec);
-    gtidSetDiff(gtid_mexec_gap,gtid_sexec);
-    gtid_mgap_repr = gtidSetDump(gtid_mexec_gap);
-    serverLog(LL_NOTICE, "[xsync] [ana] gtid.set-mgap(%s) ="
-            " gtid.set-mexec(%s) - gtid.set-sexec(%s)",
-            gtid_mgap_repr, gtid_mexec_repr, gtid_sexec_repr);
-
-    gtid_sexec_gap = gtidSetDup(gtid_sexec);
-    gtidSetDiff(gtid_sexec_gap,gtid_mexec);
-    gtid_sgap_repr = gtidSetDump(gtid_sexec_gap);
-    serverLog(LL_NOTICE, "[xsync] [ana] gtid.set-sgap(%s) ="
-            " gtid.set-sexec(%s) - gtid.set-mexec(%s)",
-            gtid_sgap_repr, gtid_sexec_repr, gtid_mexec_repr);
-
-    gno_t gap = gtidSetCount(gtid_mexec_gap) + gtidSetCount(gtid_sexec_gap);
+            xsyncAnaRepr(&ar,gtid_sexec), xsyncAnaRepr(&ar,gtid_slave),
+            xsyncAnaRepr(&ar,request->x.gtid_lost));
+
+    mgap = gtidSetDiffCount(gtid_mexec,gtid_sexec);
+    sgap = gtidSetDiffCount(gtid_sexec,gtid_mexec);
+    serverLog(LL_NOTICE, "[xsync] [ana] gtid.set-mgap count=%lld ="
+            " |gtid.set-mexec - gtid.set-sexec|, gtid.set-sgap count=%lld ="
+            " |gtid.set-sexec - gtid.set-mexec|", mgap, sgap);
+
+    gno_t gap = mgap + sgap;
     if (gap > maxgap) {
         result->action = SYNC_ACTION_FULL;
         result->msg = sdscatprintf(sdsempty(), "gap=%lld > maxgap=%lld",
@@ -570,22 +651,166 @@ void masterAnaXsyncRequest(syncResult *result, syncRequest *request) {
         result->xc.delta_lost = gtid_mlost, gtid_mlost = NULL;
         result->msg = sdscatprintf(sdsempty(),
                 "gap=%lld <= maxgap=%lld",gap,maxgap);
+        if (aof) {
+            /* slave offset counts aof bytes streamed ahead of backlog */
+            result->xc.reploff -= aof->bytes;
+            result->msg = sdscatprintf(result->msg,", aof=%lld bytes",
+                    aof->bytes);
+            result->xc.aof = aof, aof = NULL;
+        }
     }
 
 end:
     syncLocateResultDeinit(&slr);
+    xsyncAnaReprsDeinit(&ar);
 
-    sdsfree(gtid_master_repr), sdsfree(gtid_continue_repr);
-    sdsfree(gtid_xsync_repr), sdsfree(gtid_slave_repr);
-    sdsfree(gtid_mlost_repr), sdsfree(gtid_slost_repr);
-    sdsfree(gtid_mexec_repr), sdsfree(gtid_sexec_repr);
-    sdsfree(gtid_mgap_repr), sdsfree(gtid_sgap_repr);
-    sdsfree(gtid_lost_repr), sdsfree(gtid_executed_repr);
-
-    gtidSetFree(gtid_master), gtidSetFree(gtid_cont), gtidSetFree(gtid_xsync);
-    gtidSetFree(gtid_gap), gtidSetFree(gtid_mlost), gtidSetFree(gtid_slost);
+    gtidSetFree(gtid_cont), gtidSetFree(gtid_xsync), gtidSetFree(gtid_mlost);
     gtidSetFree(gtid_mexec), gtidSetFree(gtid_sexec);
-    gtidSetFree(gtid_mexec_gap), gtidSetFree(gtid_sexec_gap);
+    gtidAofRangeFree(aof);
+}
+
+static void syncResultCopy(syncResult *dst, syncResult *src) {
+    dst->request_mode = src->request_mode;
+    dst->action = src->action;
+    dst->offset = src->offset;
+    dst->limit = src->limit;
+    dst->msg = src->msg ? sdsdup(src->msg) : NULL;
+    switch (src->action) {
+    case SYNC_ACTION_XCONTINUE:
+        dst->xc.replid = sdsdup(src->xc.replid);
+        dst->xc.reploff = src->xc.reploff;
+        dst->xc.gtid_cont = src->xc.gtid_cont ? gtidSetDup(src->xc.gtid_cont) : NULL;
+        dst->xc.delta_lost = src->xc.delta_lost ? gtidSetDup(src->xc.delta_lost) : NULL;
+        break;
+    case SYNC_ACTION_CONTINUE:
+        dst->cc.replid = sdsdup(src->cc.replid);
+        dst->cc.reploff = src->cc.reploff;
+        dst->cc.delta_lost = src->cc.delta_lost ? gtidSetDup(src->cc.delta_lost) : NULL;
+        break;
+    default:
+        break;
+    }
+}
+
+/* Replicas tend to reconnect in bursts (master restart, network blip),
+ * mostly asking with the same gtid.set, so xsync analysis results are
+ * cached. Entries are only valid for the master side state they were
+ * derived from, the whole cache is dropped once that state changes. */
+#define XSYNC_ANA_CACHE_SIZE 8
+
+typedef struct xsyncAnaState {
+    unsigned long long gtid_version;
+    long long master_repl_offset;
+    long long gtid_reploff_delta;
+    long long backlog_off;
+    long long backlog_histlen;
+    char replid[CONFIG_RUN_ID_SIZE+1];
+} xsyncAnaState;
+
+typedef struct xsyncAnaCacheEntry {
+    gtidSet *gtid_slave;
+    gtidSet *gtid_lost;
+    long long maxgap;
+    sds uuid_interested;
+    syncResult *result;
+} xsyncAnaCacheEntry;
+
+static struct {
+    xsyncAnaState state;
+    xsyncAnaCacheEntry entries[XSYNC_ANA_CACHE_SIZE];
+    int used;
+    int next; /* next entry to evict once full */
+    long long hits;
+    long long misses;
+} xsync_ana_cache;
+
+static void xsyncAnaStateGet(xsyncAnaState *state) {
+    state->gtid_version = serverGtidStateVersion();
+    state->master_repl_offset = server.master_repl_offset;
+    state->gtid_reploff_delta = server.gtid_reploff_delta;
+    state->backlog_off = server.repl_backlog ? gtidGetBacklogOffset() : -1;
+    state->backlog_histlen = server.repl_backlog ? gtidGetBacklogHistlen() : -1;
+    memcpy(state->replid,server.replid,sizeof(state->replid));
+}
+
+static int xsyncAnaStateEqual(xsyncAnaState *a, xsyncAnaState *b) {
+    return a->gtid_version == b->gtid_version &&
+        a->master_repl_offset == b->master_repl_offset &&
+        a->gtid_reploff_delta == b->gtid_reploff_delta &&
+        a->backlog_off == b->backlog_off &&
+        a->backlog_histlen == b->backlog_histlen &&
+        !memcmp(a->replid,b->replid,sizeof(a->replid));
+}
+
+static void xsyncAnaCacheEntryFree(xsyncAnaCacheEntry *entry) {
+    gtidSetFree(entry->gtid_slave);
+    gtidSetFree(entry->gtid_lost);
+    sdsfree(entry->uuid_interested);
+    syncResultFree(entry->result);
+    memset(entry,0,sizeof(*entry));
+}
+
+static void xsyncAnaCacheReset(void) {
+    for (int i = 0; i < xsync_ana_cache.used; i++)
+        xsyncAnaCacheEntryFree(&xsync_ana_cache.entries[i]);
+    xsync_ana_cache.used = 0;
+    xsync_ana_cache.next = 0;
+}
+
+/* Fill result from cache if an identical request was analyzed against
+ * current state, returns 1 if hit. */
+static int xsyncAnaCacheLookup(syncResult *result, syncRequest *request) {
+    xsyncAnaState state;
+
+    xsyncAnaStateGet(&state);
+    if (!xsyncAnaStateEqual(&state,&xsync_ana_cache.state)) {
+        xsyncAnaCacheReset();
+        xsync_ana_cache.state = state;
+    }
+
+    for (int i = 0; i < xsync_ana_cache.used; i++) {
+        xsyncAnaCacheEntry *entry = &xsync_ana_cache.entries[i];
+        if (entry->maxgap != request->x.maxgap ||
+                sdscmp(entry->uuid_interested,request->x.uuid_interested) ||
+                !gtidSetEqual(entry->gtid_slave,request->x.gtid_slave) ||
+                !gtidSetEqual(entry->gtid_lost,request->x.gtid_lost))
+            continue;
+        syncResultCopy(result,entry->result);
+        xsync_ana_cache.hits++;
+        return 1;
+    }
+
+    xsync_ana_cache.misses++;
+    return 0;
+}
+
+/* Must be called right after xsyncAnaCacheLookup missed, analysis does not
+ * change the state cache keyed on. */
+static void xsyncAnaCacheStore(syncResult *result, syncRequest *request) {
+    xsyncAnaCacheEntry *entry;
+
+    /* aof files are not part of the state cache keyed on. */
+    if (result->action == SYNC_ACTION_XCONTINUE && result->xc.aof) return;
+
+    if (xsync_ana_cache.used < XSYNC_ANA_CACHE_SIZE) {
+        entry = &xsync_ana_cache.entries[xsync_ana_cache.used++];
+    } else {
+        entry = &xsync_ana_cache.entries[xsync_ana_cache.next];
+        xsync_ana_cache.next = (xsync_ana_cache.next+1) % XSYNC_ANA_CACHE_SIZE;
+        xsyncAnaCacheEntryFree(entry);
+    }
+
+    entry->gtid_slave = gtidSetDup(request->x.gtid_slave);
+    entry->gtid_lost = gtidSetDup(request->x.gtid_lost);
+    entry->maxgap = request->x.maxgap;
+    entry->uuid_interested = sdsdup(request->x.uuid_interested);
+    entry->result = syncResultNew();
+    syncResultCopy(entry->result,result);
+}
+
+sds xsyncAnaCacheCatStat(sds info) {
+    return sdscatprintf(info,",xsync_ana_cache_hit=%lld,xsync_ana_cache_miss=%lld",
+            xsync_ana_cache.hits,xsync_ana_cache.misses);
 }
 
 syncResult *masterAnaSyncRequest(syncRequest *request) {
@@ -595,10 +820,20 @@ syncResult *masterAnaSyncRequest(syncRequest *request) {
         result->request_mode = REPL_MODE_PSYNC;
         masterAnaPsyncRequest(result,request);
         break;
-    case REPL_MODE_XSYNC:
+    case REPL_MODE_XSYNC: {
+        GTID_LATENCY_START(latency);
         result->request_mode = REPL_MODE_XSYNC;
-        masterAnaXsyncRequest(result,request);
+        if (xsyncAnaCacheLookup(result,request)) {
+            serverLog(LL_NOTICE, "[xsync] [ana] reuse cached analysis:"
+                    " offset=%lld, limit=%lld, msg=%s", result->offset,
+                    result->limit, result->msg);
+        } else {
+            masterAnaXsyncRequest(result,request);
+            xsyncAnaCacheStore(result,request);
+        }
+        GTID_LATENCY_END(GTID_LATENCY_XSYNC_ANA,latency);
         break;
+    }
     case REPL_MODE_UNSET:
         result->request_mode = REPL_MODE_UNSET;
         result->action = SYNC_ACTION_FULL;
@@ -608,12 +843,6 @@ syncResult *masterAnaSyncRequest(syncRequest *request) {
     return result;
 }
 
-long long addReplyReplicationBacklogLimited(client *c, long long offset,
-        long long limit) {
-    return consumeReplicationBacklogLimited(offset,limit,
-            consumeReplicationBacklogLimitedAddReplyCb,c);
-}
-
 typedef struct copyCbPrivData {
     char *buf;
     long long added;
@@ -634,13 +863,49 @@ long long copyReplicationBacklogLimited(char *buf, long long offset,
             consumeReplicationBacklogLimitedCopyCb,&pd);
 }
 
-/* see masterTryPartialResynchronization for more details. */
+/* see masterTryPartialResynchronization for more details, aof ranges
+ * (owned by callee) are streamed ahead of backlog if not NULL. */
 void masterSetupPartialSynchronization(client *c, long long offset,
-        long long limit, char *buf, int buflen) {
+        long long limit, gtidAofRange *aof, char *buf, int buflen) {
     long long sent;
 
     if (server.repl_backlog == NULL) ctrip_createReplicationBacklog();
 
+    /* Limited range is followed by stream of another repl mode, slave
+     * only gets the range and then disconnected. It's not registered as
+     * slave so that it won't be fed with anything beyond the limit. */
+    if (limit > 0) {
+        if (connWrite(c->conn,buf,buflen) != buflen) {
+            freeClientAsync(c);
+            return;
+        }
+        serverAssert(offset >= gtidGetBacklogOffset());
+        sent = gtidSendReplicationBacklogLimited(c,offset,limit);
+        serverLog(LL_NOTICE,
+            "[gtid] Sending %lld bytes of backlog starting from offset %lld limit %lld.",
+            sent, offset, limit);
+        return;
+    }
+
+    if (connWrite(c->conn,buf,buflen) != buflen) {
+        freeClientAsync(c);
+        return;
+    }
+
+    /* Slave is attached after aof ranges transferred. */
+    if (aof) {
+        serverAssert(offset >= gtidGetBacklogOffset());
+        gtidSendAofRange(c,aof,offset);
+        return;
+    }
+
+    masterAttachPartialSlave(c,offset);
+}
+
+/* Register client as online slave, streaming backlog from offset. */
+void masterAttachPartialSlave(client *c, long long offset) {
+    long long sent;
+
     c->flags |= CLIENT_SLAVE;
     c->replstate = SLAVE_STATE_ONLINE;
     c->repl_ack_time = server.unixtime;
@@ -648,28 +913,12 @@ void masterSetupPartialSynchronization(client *c, long long offset,
     
     listAddNodeTail(server.slaves,c);
 
-    if (connWrite(c->conn,buf,buflen) != buflen) {
-        freeClientAsync(c);
-        return;
-    }
     serverAssert(offset >= gtidGetBacklogOffset());
-    if (limit > 0) {
-        sent = addReplyReplicationBacklogLimited(c,offset,limit);
-    } else {
-        sent = addReplyReplicationBacklog(c,offset);
-    }
+    sent = addReplyReplicationBacklog(c,offset);
 
     serverLog(LL_NOTICE,
-        "[gtid] Sent %lld bytes of backlog starting from offset %lld limit %lld.",
-        sent, offset, limit);
-
-    if (limit > 0) {
-        serverLog(LL_NOTICE,
-                "[gtid] Disconnect slave %s to notify repl mode switched.",
-                replicationGetSlaveName(c));
-        gtidFreeClientAsync(c);
-        return;
-    }
+        "[gtid] Sent %lld bytes of backlog starting from offset %lld.",
+        sent, offset);
 
     /* Note that we don't need to set the selected DB at server.slaveseldb
      * to -1 to force the master to emit SELECT:
@@ -721,7 +970,8 @@ int masterReplySyncRequest(client *c, syncResult *result) {
                 (int)master_uuid_len,master_uuid,
                 result->xc.replid,result->xc.reploff);
         masterSetupPartialSynchronization(c,result->offset,
-                result->limit,buf,buflen);
+                result->limit,result->xc.aof,buf,buflen);
+        result->xc.aof = NULL;
 
         sdsfree(gtid_cont_repr);
         sdsfree(gtid_lost_repr);
@@ -747,7 +997,7 @@ int masterReplySyncRequest(client *c, syncResult *result) {
                     result->cc.replid, result->cc.reploff);
         }
         masterSetupPartialSynchronization(c,result->offset,
-                result->limit,buf,buflen);
+                result->limit,NULL,buf,buflen);
     } else {
         serverLog(LL_NOTICE, "[%s] Partial sync request from %s rejected: %s",
                 replModeName(result->request_mode),replicationGetSlaveName(c),
@@ -1262,6 +1512,7 @@ int ctrip_slaveTryPartialResynchronizationRead(connection *conn, sds reply) {
             gtidSet *reply_executed = gtidSetDup(parsed->xcontinue.gtid_cont);
             gtidSetDiff(reply_executed,parsed->xcontinue.gtid_lost);
 
+            serverGtidExecutedFlush();
             sds gtid_executed_repr = gtidSetDump(server.gtid_executed);
             sds gtid_lost_repr = gtidSetDump(server.gtid_lost);
             sds reply_cont_repr = gtidSetDump(parsed->xcontinue.gtid_cont);
@@ -1355,7 +1606,7 @@ int ctrip_slaveTryPartialResynchronizationRead(connection *conn, sds reply) {
                         gtid_mlost_repr, (int)gtidSetCount(gtid_mlost));
                 sdsfree(gtid_mlost_repr);
                 if (gtidSetCount(gtid_mlost) > 0) {
-                    gtidGaplogFillFromGtidSet(gtid_mlost);
+                    gtidGaplogFillStart(gtid_mlost);
                 }
                 gtidSetFree(gtid_mlost);
             }
@@ -1384,6 +1635,327 @@ by_redis:
     return PSYNC_BY_REDIS;
 }
 
+/* Replicas piggyback executed watermark (uuid:gno, gnos up to which are all
+ * executed or lost) of the latest executed uuid on REPLCONF ACK:
+ *     REPLCONF ACK <offset> [FACK <aofoffset>] GTID <uuid:gno>
+ * master tracks watermarks per replica, which serves WAITGTID and replica
+ * gtid lag. Watermarks are keyed by gtid, so they survive replid changes. */
+typedef struct gtidAckReplica {
+    uint64_t client_id;
+    client *c;
+    gtidSet *acked;
+    sds last_uuid;  /* uuid reported by the latest ack */
+    gno_t last_gno;
+} gtidAckReplica;
+
+typedef struct gtidWaiter {
+    client *c;         /* flagged CLIENT_GTID_WAITING while in waiters */
+    int local;         /* GTIDX WAITFOR: wait for gtid executed locally */
+    sds uuid;
+    gno_t gno;
+    long numreplicas;
+    mstime_t deadline; /* 0: wait forever */
+} gtidWaiter;
+
+static struct {
+    list *replicas; /* gtidAckReplica */
+    list *waiters;  /* gtidWaiter, blocked by WAITGTID or GTIDX WAITFOR */
+    long local_waiters;
+    long long te_id;
+    int executed;   /* gtid executed since waiters last checked */
+} gtid_ack = {NULL, NULL, 0, -1, 0};
+
+/* Replica side: watermark to report in REPLCONF ACK, NULL if not any. */
+sds ctrip_replicationAckGtid(void) {
+    const char *uuid;
+    size_t uuid_len;
+    gno_t gno;
+
+    if (!server.gtid_enabled) return NULL;
+    uuid = serverGtidExecutedLastUuid(&uuid_len);
+    if (uuid_len == 0) return NULL;
+    if ((gno = serverGtidSetWatermark(uuid,uuid_len)) <= 0) return NULL;
+    return sdscatprintf(sdsempty(),"%.*s:%lld",(int)uuid_len,uuid,gno);
+}
+
+static gtidAckReplica *gtidAckReplicaFind(client *c, int create) {
+    listIter li;
+    listNode *ln;
+    gtidAckReplica *r;
+
+    if (gtid_ack.replicas == NULL) gtid_ack.replicas = listCreate();
+    listRewind(gtid_ack.replicas,&li);
+    while ((ln = listNext(&li))) {
+        r = listNodeValue(ln);
+        if (r->c == c && r->client_id == c->id) return r;
+    }
+    if (!create) return NULL;
+
+    r = zcalloc(sizeof(*r));
+    r->client_id = c->id;
+    r->c = c;
+    r->acked = gtidSetNew();
+    r->last_uuid = sdsempty();
+    listAddNodeTail(gtid_ack.replicas,r);
+    return r;
+}
+
+static void gtidAckReplicaFree(gtidAckReplica *r) {
+    gtidSetFree(r->acked);
+    sdsfree(r->last_uuid);
+    zfree(r);
+}
+
+/* Replica acked might be freed or reconnected as another client. */
+static int gtidAckReplicaValid(gtidAckReplica *r) {
+    client *c = lookupClientByID(r->client_id);
+    return c != NULL && c == r->c && (c->flags & CLIENT_SLAVE);
+}
+
+static long gtidAckCountReplicas(const char *uuid, size_t uuid_len, gno_t gno) {
+    listIter li;
+    listNode *ln;
+    long count = 0;
+
+    if (gtid_ack.replicas == NULL) return 0;
+    listRewind(gtid_ack.replicas,&li);
+    while ((ln = listNext(&li))) {
+        gtidAckReplica *r = listNodeValue(ln);
+        if (gtidAckReplicaValid(r) &&
+                gtidSetContains(r->acked,uuid,uuid_len,gno))
+            count++;
+    }
+    return count;
+}
+
+static void gtidWaiterFree(gtidWaiter *w) {
+    if (w->local) gtid_ack.local_waiters--;
+    sdsfree(w->uuid);
+    zfree(w);
+}
+
+/* Reply and unblock waiters satisfied (or timed out if timeout set). */
+static void gtidWaitersProcess(int timeout) {
+    listIter li;
+    listNode *ln;
+    mstime_t now = timeout ? mstime() : 0;
+
+    if (gtid_ack.waiters == NULL) return;
+    listRewind(gtid_ack.waiters,&li);
+    while ((ln = listNext(&li))) {
+        gtidWaiter *w = listNodeValue(ln);
+        long count;
+
+        if (w->local)
+            count = serverGtidSetContains(w->uuid,sdslen(w->uuid),w->gno);
+        else
+            count = gtidAckCountReplicas(w->uuid,sdslen(w->uuid),w->gno);
+        if (count >= w->numreplicas || (timeout && w->deadline &&
+                    now >= w->deadline)) {
+            /* cleared first so that unblock hook leaves waiters alone */
+            w->c->flags &= ~CLIENT_GTID_WAITING;
+            addReplyLongLong(w->c,count);
+            gtidUnblockClient(w->c);
+            listDelNode(gtid_ack.waiters,ln);
+            gtidWaiterFree(w);
+        }
+    }
+}
+
+static int gtidWaitersTimeoutProc(struct aeEventLoop *el, long long id,
+        void *data) {
+    UNUSED(el), UNUSED(id), UNUSED(data);
+    gtidWaitersProcess(1);
+    if (listLength(gtid_ack.waiters) == 0) {
+        gtid_ack.te_id = -1;
+        return AE_NOMORE;
+    }
+    return GTID_WAIT_TIMEOUT_RESOLUTION;
+}
+
+/* Called whenever a gtid is executed, GTIDX WAITFOR waiters are checked
+ * in beforeSleep rather than in the middle of current command. */
+void gtidWaitersNotifyExecuted(void) {
+    if (gtid_ack.local_waiters) gtid_ack.executed = 1;
+}
+
+void gtidWaitersBeforeSleep(void) {
+    if (!gtid_ack.executed) return;
+    gtid_ack.executed = 0;
+    gtidWaitersProcess(0);
+}
+
+static void gtidWaiterBlock(client *c, int local, const char *uuid,
+        size_t uuid_len, gno_t gno, long numreplicas, mstime_t timeout) {
+    gtidWaiter *w;
+
+    if (gtid_ack.waiters == NULL) gtid_ack.waiters = listCreate();
+    w = zcalloc(sizeof(*w));
+    w->c = c;
+    w->local = local;
+    w->uuid = sdsnewlen(uuid,uuid_len);
+    w->gno = gno;
+    w->numreplicas = numreplicas;
+    w->deadline = timeout;
+    listAddNodeTail(gtid_ack.waiters,w);
+    if (local) gtid_ack.local_waiters++;
+    c->flags |= CLIENT_GTID_WAITING;
+
+    gtidBlockForReplication(c,numreplicas);
+    if (gtid_ack.te_id == -1) {
+        gtid_ack.te_id = aeCreateTimeEvent(server.el,
+                GTID_WAIT_TIMEOUT_RESOLUTION,gtidWaitersTimeoutProc,NULL,NULL);
+    }
+}
+
+/* Called by host whenever a client blocked by WAIT is unblocked, including
+ * CLIENT UNBLOCK and client freed. Waiter must be dropped right here: once
+ * unblocked, a pipelined WAIT or BLPOP might block the same client again. */
+void ctrip_unblockClientWaitingGtid(client *c) {
+    listIter li;
+    listNode *ln;
+
+    if (!(c->flags & CLIENT_GTID_WAITING)) return;
+    c->flags &= ~CLIENT_GTID_WAITING;
+    listRewind(gtid_ack.waiters,&li);
+    while ((ln = listNext(&li))) {
+        gtidWaiter *w = listNodeValue(ln);
+        if (w->c != c) continue;
+        listDelNode(gtid_ack.waiters,ln);
+        gtidWaiterFree(w);
+        return;
+    }
+}
+
+static int gtidWaitParseArgs(client *c, robj *gtid, robj *timeout_obj,
+        char **uuid, size_t *uuid_len, gno_t *gno, mstime_t *timeout) {
+    *uuid = uuidGnoDecode(gtid->ptr,sdslen(gtid->ptr),gno,uuid_len);
+    if (*uuid == NULL || *gno < GTID_GNO_INITIAL) {
+        addReplyError(c,"Invalid gtid");
+        return C_ERR;
+    }
+    return getTimeoutFromObjectOrReply(c,timeout_obj,timeout,
+            UNIT_MILLISECONDS);
+}
+
+/* Master side: called by REPLCONF ACK, argv[3..] might carry GTID pair. */
+void ctrip_replconfAckGtid(client *c) {
+    gtidAckReplica *r;
+    char *uuid;
+    size_t uuid_len;
+    long long gno;
+
+    for (int j = 3; j+1 < c->argc; j += 2) {
+        if (strcasecmp(c->argv[j]->ptr,"gtid")) continue;
+        uuid = uuidGnoDecode(c->argv[j+1]->ptr,sdslen(c->argv[j+1]->ptr),
+                &gno,&uuid_len);
+        if (uuid == NULL || gno < GTID_GNO_INITIAL) return;
+        r = gtidAckReplicaFind(c,1);
+        gtidSetAdd(r->acked,uuid,uuid_len,GTID_GNO_INITIAL,gno);
+        r->last_uuid = sdscpylen(r->last_uuid,uuid,uuid_len);
+        r->last_gno = gno;
+        gtidWaitersProcess(0);
+        return;
+    }
+}
+
+/* WAITGTID <uuid:gno> <numreplicas> <timeout>
+ *
+ * Note that CLIENT UNBLOCK replies 0 rather than replicas acked so far: host
+ * replies the way WAIT times out, counting acks of an offset never reached. */
+void waitgtidCommand(client *c) {
+    mstime_t timeout;
+    long numreplicas, count;
+    char *uuid;
+    size_t uuid_len;
+    gno_t gno;
+
+    if (server.masterhost) {
+        addReplyError(c,"WAITGTID cannot be used with replica instances. "
+                "Please also note that writes to replicas are just local "
+                "and are not propagated.");
+        return;
+    }
+    if (getLongFromObjectOrReply(c,c->argv[2],&numreplicas,NULL) != C_OK)
+        return;
+    if (gtidWaitParseArgs(c,c->argv[1],c->argv[3],&uuid,&uuid_len,&gno,
+                &timeout) != C_OK)
+        return;
+
+    count = gtidAckCountReplicas(uuid,uuid_len,gno);
+    if (count >= numreplicas || (c->flags & CLIENT_DENY_BLOCKING)) {
+        addReplyLongLong(c,count);
+        return;
+    }
+
+    gtidWaiterBlock(c,0,uuid,uuid_len,gno,numreplicas,timeout);
+    /* Ask replicas for ack (and watermark) asap, just like WAIT. */
+    server.get_ack_from_slaves = 1;
+}
+
+/* GTIDX WAITFOR <uuid:gno> <timeout>: replies 1 once gtid is executed (or
+ * lost, e.g. received by fullresync) locally, 0 if timed out or interrupted
+ * by CLIENT UNBLOCK. */
+void gtidWaitforCommand(client *c) {
+    mstime_t timeout;
+    char *uuid;
+    size_t uuid_len;
+    gno_t gno;
+    int executed;
+
+    if (gtidWaitParseArgs(c,c->argv[2],c->argv[3],&uuid,&uuid_len,&gno,
+                &timeout) != C_OK)
+        return;
+
+    executed = serverGtidSetContains(uuid,uuid_len,gno);
+    if (executed || (c->flags & CLIENT_DENY_BLOCKING)) {
+        addReplyLongLong(c,executed);
+        return;
+    }
+
+    gtidWaiterBlock(c,1,uuid,uuid_len,gno,1,timeout);
+}
+
+/* Drop watermarks of replicas gone. */
+void gtidAckReplicasCron(void) {
+    listIter li;
+    listNode *ln;
+
+    if (gtid_ack.replicas == NULL) return;
+    listRewind(gtid_ack.replicas,&li);
+    while ((ln = listNext(&li))) {
+        gtidAckReplica *r = listNodeValue(ln);
+        if (!gtidAckReplicaValid(r)) {
+            listDelNode(gtid_ack.replicas,ln);
+            gtidAckReplicaFree(r);
+        }
+    }
+}
+
+/* Lag is gnos executed by master but not yet acked by replica, counted on
+ * the uuid replica reported latest. */
+sds gtidAckReplicasCatInfo(sds info) {
+    listIter li;
+    listNode *ln;
+    int i = 0;
+
+    if (gtid_ack.replicas == NULL) return info;
+    listRewind(gtid_ack.replicas,&li);
+    while ((ln = listNext(&li))) {
+        gtidAckReplica *r = listNodeValue(ln);
+        gno_t executed, lag;
+        if (!gtidAckReplicaValid(r)) continue;
+        executed = serverGtidSetWatermark(r->last_uuid,sdslen(r->last_uuid));
+        lag = executed > r->last_gno ? executed - r->last_gno : 0;
+        info = sdscatprintf(info,
+                "gtid_replica%d:addr=%s,uuid=%s,gno=%lld,lag=%lld\r\n",
+                i++, replicationGetSlaveName(r->c), r->last_uuid,
+                r->last_gno, lag);
+    }
+    return info;
+}
+
+
 
 
 #ifdef REDIS_TEST
@@ -1553,6 +2125,57 @@ int replTest(int argc, char **argv, int accurate) {
         syncLocateResultDeinit(slr);
     }
 
+    TEST("gtid - xsync analysis cache") {
+        syncRequest *request = syncRequestNew();
+        syncResult *result = syncResultNew(), *cached;
+        robj *gtidset = createStringObject("A:1-10",6);
+        robj *uuid_interested = createStringObject("*",1);
+        long long hits = xsync_ana_cache.hits, misses = xsync_ana_cache.misses;
+
+        masterParseXsyncRequest(request,uuid_interested,gtidset,0,NULL);
+        test_assert(request->mode == REPL_MODE_XSYNC);
+
+        result->request_mode = REPL_MODE_XSYNC;
+        result->action = SYNC_ACTION_XCONTINUE;
+        result->offset = 100;
+        result->xc.replid = sdsnew("0123456789012345678901234567890123456789");
+        result->xc.reploff = 99;
+        result->xc.gtid_cont = gtidSetDecode("A:1-10",6);
+        result->xc.delta_lost = gtidSetNew();
+        result->msg = sdsnew("gap=0 <= maxgap=0");
+
+        cached = syncResultNew();
+        test_assert(xsyncAnaCacheLookup(cached,request) == 0);
+        xsyncAnaCacheStore(result,request);
+        test_assert(xsyncAnaCacheLookup(cached,request) == 1);
+        test_assert(cached->action == SYNC_ACTION_XCONTINUE);
+        test_assert(cached->offset == 100 && cached->xc.reploff == 99);
+        test_assert(gtidSetEqual(cached->xc.gtid_cont,result->xc.gtid_cont));
+        test_assert(cached->xc.gtid_cont != result->xc.gtid_cont);
+        syncResultFree(cached);
+
+        request->x.maxgap = 1;
+        cached = syncResultNew();
+        test_assert(xsyncAnaCacheLookup(cached,request) == 0);
+        syncResultFree(cached);
+        request->x.maxgap = 0;
+
+        serverGtidStateTouch();
+        cached = syncResultNew();
+        test_assert(xsyncAnaCacheLookup(cached,request) == 0);
+        test_assert(xsync_ana_cache.used == 0);
+        syncResultFree(cached);
+
+        test_assert(xsync_ana_cache.hits == hits+1);
+        test_assert(xsync_ana_cache.misses == misses+3);
+
+        xsyncAnaCacheReset();
+        decrRefCount(gtidset);
+        decrRefCount(uuid_interested);
+        syncRequestFree(request);
+        syncResultFree(result);
+    }
+
     TEST("gtid - parse sync reply") {
         parsedSyncReply *parsed;
         sds reply, replid = sdsnew("0123456789012345678901234567890123456789"),
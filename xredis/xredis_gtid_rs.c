@@ -53,18 +53,78 @@ void propagateArgsInit(propagateArgs *pargs, struct redisCommand *cmd,
     pargs->orig_dbid = dbid;
 }
 
+/* Propagation pool: objects reused by propagateArgsPrepareToFeed so that
+ * rewriting a write to gtid... costs no allocation in the steady state.
+ * - gtid_repr: "uuid:gno" with room for any gno, uuid prefix kept and only
+ *   gno rewritten in place (unless someone still holds a reference).
+ * - dbids: shared string object per db.
+ * - argv: reused argv array, argv[0~2] point to pooled objects. */
+#define GTID_REPR_GNO_MAX_LEN 21
+static struct {
+    robj *gtid_repr;
+    size_t prefix_len; /* uuid + ':' */
+    robj **dbids;
+    int dbnum;
+    robj **argv;
+    int argv_cap;
+    int in_use;
+} propagate_pool;
+
+static robj *propagatePoolGtidRepr(const char *uuid, size_t uuid_len, gno_t gno) {
+    robj *o = propagate_pool.gtid_repr;
+    if (o == NULL || o->refcount != 1 || propagate_pool.prefix_len != uuid_len+1 ||
+            memcmp(o->ptr, uuid, uuid_len) != 0) {
+        if (o) decrRefCount(o);
+        sds repr = sdsnewlen(NULL, uuid_len+1+GTID_REPR_GNO_MAX_LEN);
+        memcpy(repr, uuid, uuid_len);
+        repr[uuid_len] = ':';
+        o = propagate_pool.gtid_repr = createObject(OBJ_STRING, repr);
+        propagate_pool.prefix_len = uuid_len+1;
+    }
+    sds repr = o->ptr;
+    size_t len = ll2string(repr+propagate_pool.prefix_len, GTID_REPR_GNO_MAX_LEN+1, gno);
+    sdssetlen(repr, propagate_pool.prefix_len+len);
+    return o;
+}
+
+static robj *propagatePoolDbid(int dbid) {
+    if (dbid >= propagate_pool.dbnum) {
+        int dbnum = dbid < server.dbnum ? server.dbnum : dbid+1;
+        propagate_pool.dbids = zrealloc(propagate_pool.dbids, dbnum*sizeof(robj*));
+        memset(propagate_pool.dbids+propagate_pool.dbnum, 0,
+                (dbnum-propagate_pool.dbnum)*sizeof(robj*));
+        propagate_pool.dbnum = dbnum;
+    }
+    if (propagate_pool.dbids[dbid] == NULL) {
+        propagate_pool.dbids[dbid] = makeObjectShared(
+                createObject(OBJ_STRING, sdsfromlonglong(dbid)));
+    }
+    return propagate_pool.dbids[dbid];
+}
+
+static robj **propagatePoolArgv(int argc) {
+    if (argc > propagate_pool.argv_cap) {
+        int cap = propagate_pool.argv_cap ? propagate_pool.argv_cap : 16;
+        while (cap < argc) cap *= 2;
+        propagate_pool.argv = zrealloc(propagate_pool.argv, cap*sizeof(robj*));
+        propagate_pool.argv_cap = cap;
+    }
+    return propagate_pool.argv;
+}
+
 /* Prepare to feed:
  * 1. rewrite to gtid... if needed: set k v  -> gtid {gtid_repr} {dbid} set k v
  * 2. prepare info to create gtid_seq index */
 void propagateArgsPrepareToFeed(propagateArgs *pargs) {
     gno_t gno = 0;
     long long offset;
-    size_t bufmaxlen, buflen, uuid_len = server.uuid_len;
-    int argc, dbid;
+    size_t uuid_len = server.uuid_len;
+    int argc, dbid, pooled = 0;
     robj **argv;
-    char *buf, *uuid = server.uuid;
+    char *uuid = server.uuid;
     sds gtid_repr;
     struct redisCommand *cmd;
+    GTID_LATENCY_START(latency);
 
     if (server.gtid_dbid_at_multi >= 0) {
         dbid = server.gtid_dbid_at_multi;
@@ -106,20 +166,27 @@ void propagateArgsPrepareToFeed(propagateArgs *pargs) {
         argc = pargs->orig_argc;
         argv = pargs->orig_argv;
     } else {
+        serverGtidExecutedFlush();
         gno = gtidSetCurrentUuidSetNext(server.gtid_executed,1);
 
-        bufmaxlen = uuid_len+1+21/* GNO_REPR_MAX_LEN */;
-        buf = zmalloc(bufmaxlen);
-        buflen = uuidGnoEncode(buf, bufmaxlen, uuid, uuid_len, gno);
-        gtid_repr = sdsnewlen(buf, buflen);
-        zfree(buf);
-
         cmd = gtidGetGtidCommand();
         argc = pargs->orig_argc+3;
-        argv = zmalloc(argc*sizeof(robj*));
+        if (!propagate_pool.in_use) {
+            /* steady state: no allocation */
+            propagate_pool.in_use = pooled = 1;
+            argv = propagatePoolArgv(argc);
+            argv[1] = propagatePoolGtidRepr(uuid, uuid_len, gno);
+            argv[2] = propagatePoolDbid(dbid);
+        } else {
+            /* nested propagation, fall back to owned args */
+            size_t bufmaxlen = uuid_len+1+GTID_REPR_GNO_MAX_LEN;
+            gtid_repr = sdsnewlen(NULL, bufmaxlen);
+            sdssetlen(gtid_repr, uuidGnoEncode(gtid_repr, bufmaxlen, uuid, uuid_len, gno));
+            argv = zmalloc(argc*sizeof(robj*));
+            argv[1] = createObject(OBJ_STRING, gtid_repr);
+            argv[2] = createObject(OBJ_STRING, sdsfromlonglong(dbid));
+        }
         argv[0] = shared.gtid;
-        argv[1] = createObject(OBJ_STRING, gtid_repr);
-        argv[2] = createObject(OBJ_STRING, sdsfromlonglong(dbid));
         for(int i = 0; i < pargs->orig_argc; i++) {
             argv[i+3] = pargs->orig_argv[i];
         }
@@ -132,16 +199,94 @@ void propagateArgsPrepareToFeed(propagateArgs *pargs) {
     pargs->uuid_len = uuid_len;
     pargs->gno = gno;
     pargs->offset = offset;
+    pargs->pooled = pooled;
+    if (gno > 0) gtidTrackingRecord(uuid,uuid_len,gno);
+    GTID_LATENCY_END(GTID_LATENCY_PROPAGATE,latency);
 }
 
 void propagateArgsDeinit(propagateArgs *pargs) {
     if (pargs->orig_argv == pargs->argv) return;
+    if (pargs->pooled) {
+        propagate_pool.in_use = 0;
+        pargs->orig_argv = pargs->argv = NULL;
+        return;
+    }
     decrRefCount(pargs->argv[1]);
     decrRefCount(pargs->argv[2]);
     zfree(pargs->argv);
     pargs->orig_argv = pargs->argv = NULL;
 }
 
+/* RESP of gtid commands: the "$L\r\n<uuid>:" part of the gtid repr is cached
+ * per uuid and gno width, so that only gno digits, dbid and the original
+ * command are serialized per command. */
+static struct {
+    sds fragment;   /* "$L\r\n<uuid>:" */
+    size_t prefix_len; /* uuid + ':' */
+    size_t repr_len;   /* L */
+} gtid_resp_cache;
+
+static sds catRespBulk(sds dst, robj *o) {
+    char buf[LONG_STR_SIZE+3];
+    size_t len;
+    if (o->encoding == OBJ_ENCODING_INT) {
+        char num[LONG_STR_SIZE];
+        size_t numlen = ll2string(num, sizeof(num), (long)o->ptr);
+        buf[0] = '$';
+        len = 1 + ll2string(buf+1, sizeof(buf)-1, numlen);
+        buf[len++] = '\r';
+        buf[len++] = '\n';
+        dst = sdscatlen(dst, buf, len);
+        dst = sdscatlen(dst, num, numlen);
+    } else {
+        buf[0] = '$';
+        len = 1 + ll2string(buf+1, sizeof(buf)-1, sdslen(o->ptr));
+        buf[len++] = '\r';
+        buf[len++] = '\n';
+        dst = sdscatlen(dst, buf, len);
+        dst = sdscatlen(dst, o->ptr, sdslen(o->ptr));
+    }
+    return sdscatlen(dst, "\r\n", 2);
+}
+
+/* Same output as catAppendOnlyGenericCommand for gtid <uuid:gno> <dbid> ... */
+sds catAppendOnlyGtidCommand(sds dst, int argc, robj **argv) {
+    char buf[LONG_STR_SIZE+3];
+    size_t len;
+    robj *repr = argv[1];
+
+    if (argc <= GTID_COMMAN_ARGC || !sdsEncodedObject(repr))
+        return catAppendOnlyGenericCommand(dst, argc, argv);
+
+    const char *p = repr->ptr;
+    size_t repr_len = sdslen(repr->ptr), prefix_len = gtid_resp_cache.prefix_len;
+    if (gtid_resp_cache.fragment == NULL || gtid_resp_cache.repr_len != repr_len ||
+            p[prefix_len-1] != ':' ||
+            memcmp(p, gtid_resp_cache.fragment+sdslen(gtid_resp_cache.fragment)-prefix_len,
+                prefix_len) != 0) {
+        const char *colon = memchr(p, ':', repr_len);
+        if (colon == NULL) return catAppendOnlyGenericCommand(dst, argc, argv);
+        prefix_len = colon-p+1;
+        sdsfree(gtid_resp_cache.fragment);
+        gtid_resp_cache.fragment = sdscatprintf(sdsempty(), "$%zu\r\n", repr_len);
+        gtid_resp_cache.fragment = sdscatlen(gtid_resp_cache.fragment, p, prefix_len);
+        gtid_resp_cache.prefix_len = prefix_len;
+        gtid_resp_cache.repr_len = repr_len;
+    }
+
+    buf[0] = '*';
+    len = 1 + ll2string(buf+1, sizeof(buf)-1, argc);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    dst = sdscatlen(dst, buf, len);
+    dst = catRespBulk(dst, argv[0]);
+    dst = sdscatlen(dst, gtid_resp_cache.fragment, sdslen(gtid_resp_cache.fragment));
+    dst = sdscatlen(dst, p+prefix_len, repr_len-prefix_len);
+    dst = sdscatlen(dst, "\r\n", 2);
+    for (int j = 2; j < argc; j++) dst = catRespBulk(dst, argv[j]);
+    return dst;
+}
+
 /* Server repl mode:
  * - repl_mode: current repl mode(Note that xsync/psync detail not set)
  * - prev_repl_mode: previous repl mode, contains xsync/psync detail. */
@@ -161,6 +306,7 @@ void resetServerReplMode(int mode, const char *log_prefix) {
     replModeInit(server.prev_repl_mode);
     server.repl_mode->mode = mode;
     server.repl_mode->from = server.master_repl_offset+1;
+    serverGtidStateTouch();
     cur = dumpServerReplMode();
     if (log_prefix) {
         serverLog(LL_NOTICE,"[gtid] reset repl mode to %s: %s => %s (%s)",
@@ -190,6 +336,7 @@ void shiftServerReplMode(int mode, const char *log_prefix) {
 
     repl_mode->from = from;
     repl_mode->mode = mode;
+    serverGtidStateTouch();
 
     cur = dumpServerReplMode();
     serverLog(LL_NOTICE,"[gtid] shift repl mode to %s: %s => %s (%s)",
@@ -362,20 +509,32 @@ void locateServerReplMode(int request_mode, long long psync_offset,
     }
 }
 
+/* Gtid index of backlog, sampled every gtid-seq-sample gnos: offsets in
+ * between are located by scanning backlog from the sample before. */
+gtidSeq *serverGtidSeqCreate(void) {
+    gtidSeq *seq = gtidSeqCreate();
+    gtidSeqSetSample(seq,server.gtid_seq_sample);
+    gtidSeqSetScanProc(seq,readBacklogScanGtid,NULL);
+    return seq;
+}
+
 /* Backlog with gtid index */
 void ctrip_createReplicationBacklog(void) {
     serverAssert(server.gtid_seq == NULL);
     createReplicationBacklog();
-    server.gtid_seq = gtidSeqCreate();
+    server.gtid_seq = serverGtidSeqCreate();
+    serverGtidStateTouch();
 }
 
 
 
 void ctrip_freeReplicationBacklog(void) {
+    gtidReplTransfersAbort();
     freeReplicationBacklog();
     if (server.gtid_seq != NULL) {
         gtidSeqDestroy(server.gtid_seq);
         server.gtid_seq = NULL;
+        serverGtidStateTouch();
     }
 }
 
@@ -389,7 +548,8 @@ void ctrip_resetReplicationBacklog(void) {
     /* gtid_seq became invalid if master offset bumped. */
     if (server.gtid_seq != NULL) {
         gtidSeqDestroy(server.gtid_seq);
-        server.gtid_seq = gtidSeqCreate();
+        server.gtid_seq = serverGtidSeqCreate();
+        serverGtidStateTouch();
     }
 }
 
@@ -561,6 +721,7 @@ void serverReplStreamSwitchIfNeeded(int to_mode, int flags,
             memcpy(server.uuid,uuid,CONFIG_RUN_ID_SIZE+1);
             server.uuid_len = CONFIG_RUN_ID_SIZE;
 
+            serverGtidExecutedFlush();
             gtidSetCurrentUuidSetUpdate(server.gtid_executed,server.uuid,server.uuid_len);
         }
 
@@ -648,7 +809,8 @@ void serverReplStreamSwitch2Xsync(sds replid, long long reploff,
 
     if (server.gtid_seq != NULL) {
         gtidSeqDestroy(server.gtid_seq);
-        server.gtid_seq = gtidSeqCreate();
+        server.gtid_seq = serverGtidSeqCreate();
+        serverGtidStateTouch();
     }
 
     replicationDiscardCachedMaster();
@@ -5,5 +5,6 @@
 #define gtid_malloc zmalloc
 #define gtid_realloc zrealloc
 #define gtid_free zfree
+#define gtid_malloc_size zmalloc_size
 #endif
 